@@ -7,17 +7,358 @@
 #include <inspireface/inspireface.hpp>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <algorithm>
+#include <cstdio>
+#include <map>
+#include "cosine_similarity.h"
+#include "directory_walker.h"
+#include "embedding_cache.h"
+#include "enrollment_manifest.h"
+#include "enrollment_pipeline.h"
+#include "face_gallery.h"
+#include "person_names.h"
+#include "video_enrollment.h"
+
+// Number of extracted features inserted into the database per batch
+const size_t kInsertBatchSize = 64;
+
+/**
+ * @brief 将待插入的人脸特征作为一个批次写入数据库
+ *
+ * @param face_gallery 绑定到FeatureHubDB的人脸库
+ * @param features 待插入的人脸特征
+ * @param paths 每个特征对应的图像路径
+ * @param persons 每个特征所属的人员ID，-1表示该特征单独作为一个人员
+ * @param partition 特征所属的分区
+ * @param ids 输出成功写入的特征ID，与输入顺序一致；失败时只包含失败之前写入的特征
+ * @return int 成功写入的特征数量
+ */
+int FlushInsertBatch(gallery::FaceGallery& face_gallery, const std::vector<inspire::Embedded>& features,
+                     const std::vector<std::string>& paths, const std::vector<int64_t>& persons, int32_t partition,
+                     std::vector<int64_t>& ids) {
+    ids.clear();  // empty: ids are assigned by auto increment
+    if (features.empty()) {
+        return 0;
+    }
+    std::vector<int32_t> partitions(features.size(), partition);
+    int32_t insert_result = face_gallery.FaceFeatureInsertBatch(features, ids, persons, partitions);
+    for (size_t i = 0; i < ids.size(); i++) {
+        std::cout << "成功将人脸特征添加到数据库，ID: " << ids[i] << " (" << paths[i] << ")" << std::endl;
+    }
+    if (insert_result != 0) {
+        std::cerr << "错误: 无法将人脸特征添加到数据库 (错误代码: " << insert_result << ")" << std::endl;
+    }
+    return static_cast<int>(ids.size());
+}
+
+/**
+ * @struct DedupOptions
+ * @brief 登记去重设置
+ */
+struct DedupOptions {
+    float threshold = 0.95f;  ///< 与已有特征或同批次特征的余弦相似度达到该值即视为重复 (0: 不去重)
+    bool merge = false;       ///< 与库中其他人员的特征重复时归入该人员，而不是跳过
+};
+
+/**
+ * @brief 批次写入前的去重，从待插入的特征中移除重复的特征
+ *
+ * 整个批次一次性与所在分区的已有特征做批量 top-1 检索 (SearchNearestBatch)，并在批次内部两两比较，
+ * 相似度达到阈值的特征视为重复:
+ * - 与同批次中先前保留的特征重复: 跳过
+ * - 与库中已有特征重复: 跳过；合并模式下若已有特征属于其他人员，则改为作为该人员的模板写入
+ * 被跳过的图像以特征ID -1 记入登记清单，文件大小与修改时间不变时再次运行不再处理。
+ *
+ * @param face_gallery 人脸库
+ * @param features 待插入的人脸特征，被跳过的特征从中移除
+ * @param paths 每个特征对应的图像路径，与 features 同步移除
+ * @param persons 每个特征所属的人员ID，合并的特征改为已有人员
+ * @param entries 每个特征对应的登记清单记录，与 features 同步移除
+ * @param partition 特征所属的分区，只与该分区的已有特征比较
+ * @param options 去重设置
+ * @param merged_count 累加合并到已有人员的特征数量
+ * @param manifest 记录被跳过图像的登记清单，为空表示不记录
+ * @return size_t 跳过的特征数量
+ */
+size_t DeduplicateBatch(gallery::FaceGallery& face_gallery, std::vector<inspire::Embedded>& features, std::vector<std::string>& paths,
+                        std::vector<int64_t>& persons, std::vector<gallery::ManifestEntry>& entries, int32_t partition,
+                        const DedupOptions& options, size_t& merged_count, gallery::EnrollmentManifest* manifest) {
+    if (options.threshold <= 0.0f || features.empty()) {
+        return 0;
+    }
+    std::vector<inspire::FaceSearchResult> nearest;
+    int32_t search_result = face_gallery.SearchNearestBatch(features, std::vector<int32_t>(1, partition), nearest);
+    if (search_result != 0) {
+        std::cerr << "警告: 去重检索失败, 本批次不去重 (错误代码: " << search_result << ")" << std::endl;
+        return 0;
+    }
+    // Pairwise scores within the batch; a feature is compared with the kept features before it
+    const size_t count = features.size();
+    const size_t dim = features[0].size();
+    std::vector<float> matrix(count * dim);
+    for (size_t i = 0; i < count; i++) {
+        if (features[i].size() != dim) {
+            return 0;
+        }
+        std::copy(features[i].begin(), features[i].end(), matrix.begin() + i * dim);
+    }
+    std::vector<float> scores(count * count);
+    gallery::CosineSimilarityNxM(matrix.data(), count, dim, matrix.data(), count, dim, dim, false, scores.data());
+
+    size_t skipped = 0;
+    std::vector<size_t> kept;
+    // Recorded without a feature, like a file with no face, so a rerun does not search it again
+    auto skip = [&](size_t i) {
+        ++skipped;
+        if (manifest != nullptr) {
+            entries[i].id = -1;
+            manifest->Record(paths[i], entries[i]);
+        }
+    };
+    for (size_t i = 0; i < count; i++) {
+        size_t twin = count;
+        for (size_t k : kept) {
+            if (scores[i * count + k] >= options.threshold) {
+                twin = k;
+                break;
+            }
+        }
+        if (twin != count) {
+            std::cout << "跳过重复图像: " << paths[i] << " 与同批图像 " << paths[twin] << " 相似度 " << scores[i * count + twin]
+                      << std::endl;
+            skip(i);
+            continue;
+        }
+        if (nearest[i].id >= 0 && nearest[i].similarity >= options.threshold) {
+            int64_t existing_person = -1;
+            int32_t existing_partition = 0;
+            if (!options.merge || face_gallery.GetFaceLabel(nearest[i].id, existing_person, existing_partition) != 0 ||
+                existing_person == persons[i]) {
+                std::cout << "跳过重复图像: " << paths[i] << " 与库中人脸 ID " << nearest[i].id << " 相似度 " << nearest[i].similarity
+                          << std::endl;
+                skip(i);
+                continue;
+            }
+            std::cout << "合并重复图像: " << paths[i] << " 与库中人脸 ID " << nearest[i].id << " 相似度 " << nearest[i].similarity
+                      << ", 作为人员 " << existing_person << " 的模板写入" << std::endl;
+            persons[i] = existing_person;
+            ++merged_count;
+        }
+        kept.push_back(i);
+    }
+    // kept is increasing, so moving each survivor forward never overwrites one still to be moved
+    for (size_t n = 0; n < kept.size(); n++) {
+        if (kept[n] != n) {
+            features[n] = std::move(features[kept[n]]);
+            paths[n] = std::move(paths[kept[n]]);
+            persons[n] = persons[kept[n]];
+            entries[n] = entries[kept[n]];
+        }
+    }
+    features.resize(kept.size());
+    paths.resize(kept.size());
+    persons.resize(kept.size());
+    entries.resize(kept.size());
+    return skipped;
+}
+
+// Files of the main database
+const char kDatabasePath[] = "database/face_features.db";
+const char kLabelsPath[] = "database/face_identities.txt";
+const char kSnapshotPath[] = "database/face_features.snapshot";
+
+/**
+ * @brief 批量登记与导入使用的名单库写入策略
+ *
+ * 不按时间或条数做检查点，关闭名单库时一次写入快照；每批写入先同步日志，
+ * 中断后重新打开名单库时由日志恢复。
+ */
+gallery::WriteBehindConfiguration BatchStoreConfiguration() {
+    gallery::WriteBehindConfiguration configuration;
+    configuration.checkpoint_interval_ms = 0;
+    configuration.checkpoint_ops = 0;
+    configuration.strict = true;
+    return configuration;
+}
+
+/**
+ * @brief 打开登记的目标人脸库: 独立名单库，或与 FeatureHubDB 同步的主数据库
+ *
+ * @param store_dir 独立名单库目录，为空表示主数据库
+ * @param face_gallery 输出的人脸库
+ * @param feature_hub 输出的 FeatureHubDB，仅主数据库时设置
+ * @return int 0表示成功，非0表示失败
+ */
+int OpenEnrollmentGallery(const std::string& store_dir, gallery::FaceGallery& face_gallery,
+                          std::shared_ptr<inspire::FeatureHubDB>& feature_hub) {
+    inspire::DatabaseConfiguration db_config;
+    if (!store_dir.empty()) {
+        int32_t store_result = face_gallery.OpenStore(store_dir, BatchStoreConfiguration());
+        if (store_result != 0) {
+            std::cerr << "错误: 无法打开名单库 " << store_dir << " (错误代码: " << store_result << ")" << std::endl;
+            return -1;
+        }
+    } else {
+        // Initialize FeatureHubDB with persistence
+        feature_hub = inspire::FeatureHubDB::GetInstance();
+        db_config.enable_persistence = true;  // Enable persistence
+        db_config.primary_key_mode = inspire::PrimaryKeyMode::AUTO_INCREMENT;  // Use auto increment ID
+        db_config.recognition_threshold = 0.48f;
+    
+        // Create database directory if it doesn't exist
+        struct stat info;
+        if (stat("database", &info) != 0) {
+            #if defined(_WIN32)
+            _mkdir("database");
+            #else
+            mkdir("database", 0755);
+            #endif
+            std::cout << "创建数据库目录: database" << std::endl;
+        }
+    
+        db_config.persistence_db_path = kDatabasePath;
+    
+        int32_t hub_result = feature_hub->EnableHub(db_config);
+        if (hub_result != 0) {
+            std::cerr << "错误: 无法启用FeatureHubDB (错误代码: " << hub_result << ")" << std::endl;
+            return -1;
+        }
+    
+        // Mirror the database into the gallery; inserts go through it in batches
+        int32_t gallery_result = face_gallery.LoadFromHub(feature_hub);
+        if (gallery_result != 0) {
+            std::cerr << "错误: 无法从FeatureHubDB加载人脸库 (错误代码: " << gallery_result << ")" << std::endl;
+            return -1;
+        }
+        gallery_result = face_gallery.LoadIdentityLabels(kLabelsPath);
+        if (gallery_result != 0) {
+            std::cerr << "错误: 无法读取人员标签文件 " << kLabelsPath << " (错误代码: " << gallery_result << ")" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 结束登记: 名单库写入最终检查点；主数据库整理人员标签文件并更新快照
+ *
+ * @param store_dir 独立名单库目录，为空表示主数据库
+ * @param face_gallery 人脸库
+ * @param feature_hub 主数据库的 FeatureHubDB
+ * @param changed 本次是否添加或删除了人脸特征
+ * @return int 0表示成功，非0表示名单库写入失败
+ */
+int CloseEnrollmentGallery(const std::string& store_dir, gallery::FaceGallery& face_gallery,
+                           const std::shared_ptr<inspire::FeatureHubDB>& feature_hub, bool changed) {
+    // A store is made durable by its final checkpoint, which also compacts it into its snapshot
+    if (!store_dir.empty()) {
+        int32_t close_result = face_gallery.DisableWriteBehind();
+        if (close_result != 0) {
+            std::cerr << "错误: 无法写入名单库 " << store_dir << " (错误代码: " << close_result << ")" << std::endl;
+            return -1;
+        }
+        std::cout << "名单库中的人员数量: " << face_gallery.IdentityCount() << std::endl;
+        return 0;
+    }
+
+    // Refresh the memory-mapped snapshot so the recognizer can start without reloading the database
+    if (changed) {
+        // Person labels are not stored in FeatureHubDB; compact the side file the batches appended to
+        int32_t labels_result = face_gallery.SaveIdentityLabels(kLabelsPath);
+        if (labels_result != 0) {
+            std::cerr << "警告: 无法写入人员标签文件 " << kLabelsPath << " (错误代码: " << labels_result << ")" << std::endl;
+        }
+        std::cout << "人脸库中的人员数量: " << face_gallery.IdentityCount() << std::endl;
+
+        // Close the hub first so the database file is final before it is stamped
+        feature_hub->DisableHub();
+        int32_t save_result = face_gallery.SaveSnapshot(
+            kSnapshotPath, gallery::FileSourceStamp(std::vector<std::string>{kDatabasePath, kLabelsPath}));
+        if (save_result == 0) {
+            std::cout << "已更新人脸库快照: " << kSnapshotPath << std::endl;
+        } else {
+            std::cerr << "警告: 无法写入人脸库快照 (错误代码: " << save_result << ")" << std::endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开特征缓存，失败时打印警告
+ *
+ * @param cache_path 特征缓存文件，为空表示不使用缓存
+ * @param model_path 模型路径，用于计算模型指纹
+ * @param embedding_cache 输出的特征缓存
+ * @return bool 缓存是否可用
+ */
+bool OpenEmbeddingCache(const std::string& cache_path, const std::string& model_path, gallery::EmbeddingCache& embedding_cache) {
+    if (cache_path.empty()) {
+        return false;
+    }
+    // The cache is shared by the main database and the stores, so its directory may not exist yet
+    const size_t slash = cache_path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        mkdir(cache_path.substr(0, slash).c_str(), 0755);
+    }
+    const uint64_t model = gallery::ModelFingerprint(model_path);
+    int32_t cache_result = model != 0 ? embedding_cache.Open(cache_path, model) : HERR_INVALID_PARAM;
+    if (cache_result == 0) {
+        std::cout << "特征缓存中已有 " << embedding_cache.Size() << " 个特征" << std::endl;
+    } else {
+        std::cerr << "警告: 无法打开特征缓存 " << cache_path << " (错误代码: " << cache_result << "), 不使用缓存" << std::endl;
+    }
+    return cache_result == 0;
+}
 
 /**
- * @brief 从图像目录中提取所有人脸特征并添加到数据库
+ * @brief 图像未能登记的原因
+ */
+const char* RejectionReason(gallery::EnrollmentStatus status) {
+    switch (status) {
+        case gallery::ENROLL_READ_FAILED:
+            return "无法读取";
+        case gallery::ENROLL_DECODE_FAILED:
+            return "无法解码";
+        case gallery::ENROLL_DETECT_FAILED:
+            return "人脸检测失败";
+        case gallery::ENROLL_NO_FACE:
+            return "未检测到人脸";
+        case gallery::ENROLL_FACE_TOO_SMALL:
+            return "人脸过小";
+        case gallery::ENROLL_POSE_REJECTED:
+            return "人脸角度过大";
+        case gallery::ENROLL_LOW_QUALITY:
+            return "人脸质量过低";
+        case gallery::ENROLL_QUALITY_FAILED:
+            return "人脸质量评估失败";
+        case gallery::ENROLL_EXTRACT_FAILED:
+            return "特征提取失败";
+        default:
+            return "其他";
+    }
+}
+
+/**
+ * @brief 从图像目录（包括各级子目录）中提取所有人脸特征并添加到数据库
+ *
+ * 子目录中的图像以子目录相对于图像目录的路径作为人员名称，同名图像属于同一个人员；
+ * 图像目录下直接存放的图像各自作为一个人员。
+ * 处理结果记录在登记清单中：再次运行时跳过未变化的图像，重新登记内容变化的图像，
+ * 并删除已不存在的图像对应的人脸特征；中断的运行从最后一个检查点继续。
  * 
  * @param image_dir 图像目录路径
  * @param model_path 模型路径
+ * @param person_id 目录中所有图像所属的人员ID，-1表示按子目录确定人员
+ * @param partition 目录中所有图像所属的分区
+ * @param store_dir 独立名单库目录，为空表示写入FeatureHubDB
+ * @param enroll_config 解码线程数和特征提取线程数
+ * @param cache_path 特征缓存文件，为空表示不使用缓存
+ * @param dedup 去重设置
  * @return int 0表示成功，非0表示失败
  */
-int AddFacesFromDirectory(const std::string& image_dir, const std::string& model_path) {
+int AddFacesFromDirectory(const std::string& image_dir, const std::string& model_path, int64_t person_id, int32_t partition,
+                          const std::string& store_dir, const gallery::EnrollmentConfiguration& enroll_config,
+                          const std::string& cache_path, const DedupOptions& dedup) {
     // Initialize InspireFace
     auto context = inspire::Launch::GetInstance();
     context->SwitchImageProcessingBackend(inspire::Launch::IMAGE_PROCESSING_CPU);
@@ -28,199 +369,754 @@ int AddFacesFromDirectory(const std::string& image_dir, const std::string& model
         return -1;
     }
 
-    // Create session with face detection and recognition enabled
-    inspire::CustomPipelineParameter param;
-    param.enable_recognition = true;
-    param.enable_face_quality = true;
-    
-    std::shared_ptr<inspire::Session> session(
-        inspire::Session::CreatePtr(inspire::DETECT_MODE_ALWAYS_DETECT, 1, param, 320));
-    
-    if (session == nullptr) {
+    // Each extraction thread owns a session with face detection and recognition enabled
+    gallery::EnrollmentPipeline pipeline(enroll_config);
+    if (pipeline.Initialize() != 0) {
         std::cerr << "错误: 无法创建会话" << std::endl;
         return -1;
     }
-
-    // Initialize FeatureHubDB with persistence
-    auto feature_hub = inspire::FeatureHubDB::GetInstance();
-    inspire::DatabaseConfiguration db_config;
-    db_config.enable_persistence = true;  // Enable persistence
-    db_config.primary_key_mode = inspire::PrimaryKeyMode::AUTO_INCREMENT;  // Use auto increment ID
-    db_config.recognition_threshold = 0.48f;
-    
-    // Create database directory if it doesn't exist
-    struct stat info;
-    if (stat("database", &info) != 0) {
-        #if defined(_WIN32)
-        _mkdir("database");
-        #else
-        mkdir("database", 0755);
-        #endif
-        std::cout << "创建数据库目录: database" << std::endl;
-    }
-    
-    db_config.persistence_db_path = "database/face_features.db";
-    
-    int32_t hub_result = feature_hub->EnableHub(db_config);
-    if (hub_result != 0) {
-        std::cerr << "错误: 无法启用FeatureHubDB (错误代码: " << hub_result << ")" << std::endl;
+    // A watchlist store is independent of FeatureHubDB and keeps its persons itself
+    gallery::FaceGallery face_gallery;
+    std::shared_ptr<inspire::FeatureHubDB> feature_hub;
+    const std::string names_path = store_dir.empty() ? "database/face_persons.txt" : store_dir + "/persons.txt";
+    const std::string manifest_path = store_dir.empty() ? "database/face_manifest.txt" : store_dir + "/manifest.txt";
+    if (OpenEnrollmentGallery(store_dir, face_gallery, feature_hub) != 0) {
         return -1;
     }
     
-    // Get current face count in database to determine next ID
-    int32_t face_count_before = feature_hub->GetFaceFeatureCount();
-    int32_t next_id = face_count_before + 1;
+    // The ids are assigned by the gallery and printed as each batch is written
+    int32_t face_count_before = static_cast<int32_t>(face_gallery.Size());
     std::cout << "开始处理目录: " << image_dir << std::endl;
     std::cout << "数据库中现有人脸数量: " << face_count_before << std::endl;
-    std::cout << "将从ID " << next_id << " 开始添加" << std::endl;
 
-    // Open directory
-    DIR* dir = opendir(image_dir.c_str());
-    if (!dir) {
+    // Embeddings of aligned crops seen before, by any gallery, are reused instead of extracted again
+    gallery::EmbeddingCache embedding_cache;
+    if (OpenEmbeddingCache(cache_path, model_path, embedding_cache)) {
+        pipeline.SetEmbeddingCache(&embedding_cache);
+    }
+
+    // Files are listed while they are processed, so the first image starts right away
+    std::string root = image_dir;
+    while (root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    gallery::DirectoryWalker walker;
+    if (walker.Open(root) != 0) {
         std::cerr << "错误: 无法打开目录 " << image_dir << std::endl;
         return -1;
     }
-
-    // Read directory entries
-    struct dirent* entry;
-    std::vector<std::string> image_files;
-    
-    while ((entry = readdir(dir)) != nullptr) {
-        std::string filename = entry->d_name;
-        // Check if file has image extension
-        std::string ext = filename.substr(filename.find_last_of(".") + 1);
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        
-        if (ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp") {
-            std::string full_path = image_dir + "/" + filename;
-            image_files.push_back(full_path);
-            std::cout << "找到图像文件: " << full_path << std::endl;
-        }
+    // Folder names map to person ids through the names file, so later runs add templates to the same person
+    gallery::PersonNames person_names;
+    if (person_names.Load(names_path) != 0) {
+        std::cerr << "错误: 无法读取人员名称文件 " << names_path << std::endl;
+        return -1;
     }
-    
-    closedir(dir);
-    
-    if (image_files.empty()) {
-        std::cerr << "目录中未找到图像文件" << std::endl;
+    // Imported persons may be missing from the names file; new names must not reuse their ids
+    person_names.Reserve(face_gallery.MaxPerson());
+    // The manifest remembers the files of earlier runs, so only new and changed files are processed
+    gallery::EnrollmentManifest manifest;
+    if (manifest.Open(manifest_path) != 0) {
+        std::cerr << "错误: 无法读取登记清单 " << manifest_path << std::endl;
         return -1;
     }
-    
-    std::cout << "总共找到 " << image_files.size() << " 个图像文件" << std::endl;
+    std::cout << "登记清单中已有 " << manifest.Size() << " 个图像文件" << std::endl;
+
+    // Unchanged files are skipped by size and modification time before they are read
+    size_t unchanged_count = 0;
+    auto next_file = [&](std::string& path, std::string& label) {
+        while (walker.Next(path, label)) {
+            struct stat file_info;
+            if (stat(path.c_str(), &file_info) == 0 &&
+                manifest.Visit(path, static_cast<uint64_t>(file_info.st_size),
+                               static_cast<int64_t>(file_info.st_mtim.tv_sec) * 1000000000 + file_info.st_mtim.tv_nsec)) {
+                ++unchanged_count;
+                continue;
+            }
+            return true;
+        }
+        return false;
+    };
+    // ... and by content hash, for files that were copied or touched, before they are decoded
+    pipeline.SetScreen([&manifest](gallery::EnrollmentResult& result) {
+        gallery::ManifestEntry entry;
+        if (manifest.Find(result.path, entry) && entry.size == result.file_size && entry.hash == result.content_hash) {
+            result.status = gallery::ENROLL_SKIPPED;
+            return true;
+        }
+        return false;
+    });
+
+    // Removes the feature an earlier run enrolled from a file that has changed or been deleted
+    size_t removed_count = 0;
+    auto retire = [&](const gallery::ManifestEntry& entry) {
+        if (entry.id < 0) {
+            return;
+        }
+        int32_t remove_result = face_gallery.FaceFeatureRemove(static_cast<int32_t>(entry.id));
+        if (remove_result == 0) {
+            ++removed_count;
+        } else if (remove_result != HERR_FT_HUB_NOT_FOUND_FEATURE) {
+            std::cerr << "警告: 无法删除人脸特征 " << entry.id << " (错误代码: " << remove_result << ")" << std::endl;
+        }
+    };
     
     int success_count = 0;
-    // Process each image file
-    for (const auto& image_path : image_files) {
-        std::cout << "\n处理图像: " << image_path << std::endl;
-        
-        // Load image
-        cv::Mat image = cv::imread(image_path);
-        if (image.empty()) {
-            std::cerr << "错误: 无法加载图像 " << image_path << std::endl;
-            continue;
+    size_t skipped_count = 0;
+    size_t duplicate_count = 0;
+    size_t merged_count = 0;
+    std::map<gallery::EnrollmentStatus, size_t> rejected_counts;
+    std::vector<inspire::Embedded> pending_features;
+    std::vector<std::string> pending_paths;
+    std::vector<int64_t> pending_persons;
+    std::vector<gallery::ManifestEntry> pending_entries;
+    // One checkpoint per batch: names first, so no stored label refers to an unnamed person, then the
+    // features, their labels and finally the manifest. A crash can repeat at most the batch being written.
+    auto flush = [&]() {
+        duplicate_count += DeduplicateBatch(face_gallery, pending_features, pending_paths, pending_persons, pending_entries, partition,
+                                            dedup, merged_count, &manifest);
+        if (pending_features.empty()) {
+            manifest.Checkpoint();
+            return;
         }
-
-        // Convert OpenCV Mat to InspireCV Image
-        inspirecv::Image img(image.cols, image.rows, 3, image.data, false);
-        inspirecv::FrameProcess process = inspirecv::FrameProcess::Create(
-            img.Data(), img.Height(), img.Width(), inspirecv::BGR, inspirecv::ROTATION_0);
-
-        // Detect faces
-        std::vector<inspire::FaceTrackWrap> faces;
-        int detect_result = session->FaceDetectAndTrack(process, faces);
-        if (detect_result != 0) {
-            std::cerr << "警告: 人脸检测失败, 错误代码: " << detect_result << std::endl;
-            continue;
+        person_names.Append(names_path);
+        std::vector<int64_t> ids;
+        success_count += FlushInsertBatch(face_gallery, pending_features, pending_paths, pending_persons, partition, ids);
+        if (store_dir.empty()) {
+            face_gallery.AppendIdentityLabels(kLabelsPath, ids);
         }
-
-        if (faces.empty()) {
-            std::cerr << "错误: 图像中未检测到人脸 " << image_path << std::endl;
-            continue;
+        for (size_t i = 0; i < ids.size(); i++) {
+            pending_entries[i].id = ids[i];
+            manifest.Record(pending_paths[i], pending_entries[i]);
+        }
+        manifest.Checkpoint();
+        pending_features.clear();
+        pending_paths.clear();
+        pending_persons.clear();
+        pending_entries.clear();
+    };
+    // Results arrive in file order on this thread, so the batches get the same IDs whatever the thread counts
+    auto enroll = [&](gallery::EnrollmentResult& result) {
+        gallery::ManifestEntry entry;
+        const bool known = manifest.Find(result.path, entry);
+        entry.size = result.file_size;
+        entry.mtime = result.file_mtime;
+        entry.hash = result.content_hash;
+        if (result.status == gallery::ENROLL_SKIPPED) {
+            // Same content as when it was enrolled; only the modification time is new
+            ++skipped_count;
+            manifest.Record(result.path, entry);
+            return;
         }
 
-        std::cout << "在 " << image_path << " 中检测到 " << faces.size() << " 张人脸" << std::endl;
-
-        // Process the first detected face
-        auto& face = faces[0];
-        
-        // Check if the face is frontal
-        float yaw = face.face3DAngle.yaw;
-        float pitch = face.face3DAngle.pitch;
-        float roll = face.face3DAngle.roll;
-        const float angle_threshold = 15.0f;
-        bool is_frontal = (std::abs(yaw) < angle_threshold) && 
-                          (std::abs(pitch) < angle_threshold) && 
-                          (std::abs(roll) < angle_threshold);
-        
-        if (!is_frontal) {
-            std::cerr << "警告: 检测到的人脸不是正脸，可能影响识别效果" << std::endl;
-            std::cout << "人脸角度 - 偏航角: " << yaw << ", 俯仰角: " << pitch << ", 翻滚角: " << roll << std::endl;
-        }
-        
-        // Extract face features
-        inspire::FaceEmbedding feature;
-        int extract_result = session->FaceFeatureExtract(process, face, feature);
-        if (extract_result != 0) {
-            std::cerr << "错误: 人脸特征提取失败, 错误代码: " << extract_result << std::endl;
-            continue;
+        std::cout << "\n处理图像: " << result.path;
+        if (person_id < 0 && !result.label.empty()) {
+            std::cout << " (人员: " << result.label << ")";
+        }
+        std::cout << std::endl;
+        if (result.status != gallery::ENROLL_OK) {
+            ++rejected_counts[result.status];
+        }
+        switch (result.status) {
+            case gallery::ENROLL_READ_FAILED:
+                std::cerr << "错误: 无法读取图像 " << result.path << std::endl;
+                return;
+            case gallery::ENROLL_DECODE_FAILED:
+            case gallery::ENROLL_NO_FACE:
+                if (result.status == gallery::ENROLL_DECODE_FAILED) {
+                    std::cerr << "错误: 无法加载图像 " << result.path << std::endl;
+                } else {
+                    std::cerr << "错误: 图像中未检测到人脸 " << result.path << std::endl;
+                }
+                // Recorded without a feature, so the file is not retried until it changes
+                if (known) {
+                    retire(entry);
+                }
+                entry.id = -1;
+                manifest.Record(result.path, entry);
+                return;
+            case gallery::ENROLL_DETECT_FAILED:
+                std::cerr << "警告: 人脸检测失败, 错误代码: " << result.error_code << std::endl;
+                return;
+            case gallery::ENROLL_QUALITY_FAILED:
+                // Not judged against the quality bar, so it is neither enrolled nor recorded
+                std::cerr << "警告: 人脸质量评估失败, 不予登记 " << result.path << " (错误代码: " << result.error_code << ")" << std::endl;
+                return;
+            case gallery::ENROLL_FACE_TOO_SMALL:
+            case gallery::ENROLL_POSE_REJECTED:
+            case gallery::ENROLL_LOW_QUALITY:
+                std::cerr << "错误: " << RejectionReason(result.status) << ", 不予登记 " << result.path << " (人脸边长: " << result.face_side
+                          << " 像素, 偏航角: " << result.yaw << ", 俯仰角: " << result.pitch << ", 质量: " << result.quality << ")" << std::endl;
+                // Not recorded, so a later run with a different bar judges the file again
+                if (known) {
+                    retire(entry);
+                    manifest.Erase(result.path);
+                }
+                return;
+            default:
+                break;
         }
 
-        std::cout << "人脸特征提取成功，特征维度: " << feature.embedding.size() << std::endl;
+        std::cout << "在 " << result.path << " 中检测到 " << result.face_count << " 张人脸, 选取的人脸边长 " << result.face_side
+                  << " 像素, 质量 " << result.quality << std::endl;
 
-        // Add face feature to database with auto increment ID
-        int64_t result_id;
-        std::vector<float> feature_vector(feature.embedding.begin(), feature.embedding.end());
-        int32_t insert_result = feature_hub->FaceFeatureInsert(feature_vector, -1, result_id);  // -1 for auto increment
-        
-        if (insert_result == 0) {
-            std::cout << "成功将人脸特征添加到数据库，ID: " << result_id << std::endl;
-            success_count++;
+        if (result.status != gallery::ENROLL_OK) {
+            std::cerr << "错误: 人脸特征提取失败, 错误代码: " << result.error_code << std::endl;
+            return;
+        }
+        std::cout << "人脸特征提取成功，特征维度: " << result.embedding.size() << std::endl;
+
+        // The file changed since it was enrolled: its old feature is replaced
+        if (known) {
+            retire(entry);
+        }
+        // Queue the feature; the database is written once per batch with auto increment IDs
+        pending_features.push_back(std::move(result.embedding));
+        pending_paths.push_back(result.path);
+        if (person_id >= 0) {
+            pending_persons.push_back(person_id);
         } else {
-            std::cerr << "错误: 无法将人脸特征添加到数据库 (错误代码: " << insert_result << ")" << std::endl;
+            pending_persons.push_back(result.label.empty() ? -1 : person_names.Resolve(result.label));
         }
+        pending_entries.push_back(entry);
+        if (pending_features.size() >= kInsertBatchSize) {
+            flush();
+        }
+    };
+    gallery::EnrollmentStatistics stats;
+    pipeline.Run(next_file, enroll, &stats);
+    flush();
+
+    // Files recorded by earlier runs that the walk did not meet again have been deleted
+    if (walker.SkippedDirectories() > 0) {
+        std::cerr << "警告: " << walker.SkippedDirectories() << " 个子目录无法打开, 已跳过; 本次不删除已不存在的图像对应的人脸特征" << std::endl;
+    } else {
+        for (const auto& deleted : manifest.Unvisited(root)) {
+            retire(deleted.second);
+            manifest.Erase(deleted.first);
+        }
+    }
+    int32_t manifest_result = manifest.Close();
+    if (manifest_result != 0) {
+        std::cerr << "警告: 无法写入登记清单 " << manifest_path << " (错误代码: " << manifest_result << ")" << std::endl;
+    }
+    int32_t names_result = person_names.Save(names_path);
+    if (names_result != 0) {
+        std::cerr << "警告: 无法写入人员名称文件 " << names_path << " (错误代码: " << names_result << ")" << std::endl;
+    }
+    if (stats.images == 0 && unchanged_count == 0 && removed_count == 0) {
+        std::cerr << "目录中未找到图像文件" << std::endl;
+        return -1;
     }
     
     // Print final database status
-    int32_t face_count_after = feature_hub->GetFaceFeatureCount();
+    int32_t face_count_after = static_cast<int32_t>(face_gallery.Size());
     std::cout << "\n处理完成!" << std::endl;
     std::cout << "成功添加 " << success_count << " 个人脸特征到数据库" << std::endl;
+    std::cout << "未变化而跳过 " << unchanged_count + skipped_count << " 个图像文件, 删除 " << removed_count
+              << " 个已变化或已不存在的图像对应的人脸特征" << std::endl;
     std::cout << "数据库中现有人脸数量: " << face_count_after << std::endl;
+    std::cout << "处理速度: " << stats.ImagesPerSecond() << " 张/秒 (" << stats.images << " 张, " << stats.wall_seconds << " 秒)" << std::endl;
+    std::cout << "各阶段利用率 - 解码 (" << stats.decoders << " 线程): " << stats.DecodeUtilization() * 100.0
+              << "%, 检测与特征提取 (" << stats.workers << " 线程): " << stats.ExtractUtilization() * 100.0
+              << "%, 写入数据库: " << stats.SinkUtilization() * 100.0 << "%" << std::endl;
+    if (stats.reduced_decodes > 0) {
+        std::cout << "缩小解码 " << stats.reduced_decodes << " 张, 其中 " << stats.full_redecodes
+                  << " 张因人脸过小按原尺寸重新解码" << std::endl;
+    }
+    if (!cache_path.empty()) {
+        std::cout << "特征缓存命中 " << stats.cache_hits << " 张, 免去特征提取" << std::endl;
+    }
+    if (!rejected_counts.empty()) {
+        std::cout << "未登记的图像:";
+        for (const auto& rejected : rejected_counts) {
+            std::cout << " " << RejectionReason(rejected.first) << " " << rejected.second << " 张;";
+        }
+        std::cout << std::endl;
+    }
+    if (dedup.threshold > 0.0f) {
+        std::cout << "去重 (阈值 " << dedup.threshold << "): 跳过 " << duplicate_count << " 张重复图像";
+        if (dedup.merge) {
+            std::cout << ", 合并 " << merged_count << " 张到已有人员";
+        }
+        std::cout << std::endl;
+    }
     
     // Print all IDs in database
     if (face_count_after > 0) {
-        auto& existing_ids = feature_hub->GetExistingIds();
+        std::vector<int64_t> existing_ids;
+        face_gallery.GetExistingIds(existing_ids);
         std::cout << "数据库中的人脸ID: ";
         for (const auto& id : existing_ids) {
             std::cout << id << " ";
         }
         std::cout << std::endl;
     }
+
+    // A run that had new files to enroll but enrolled none of them failed
+    const bool failed = success_count == 0 && stats.images > skipped_count;
     
-    return (success_count > 0) ? 0 : -1;
+    if (CloseEnrollmentGallery(store_dir, face_gallery, feature_hub, success_count > 0 || removed_count > 0) != 0) {
+        return -1;
+    }
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief 从视频文件中跟踪人脸，选取多张差异较大的高质量帧作为模板添加到数据库
+ *
+ * 视频按段并行解码与跟踪，每条人脸轨迹保留质量最好的若干帧，同一人脸的多条轨迹合并为一个人员，
+ * 再从中选取两两差异最大的几帧作为模板。视频中出现帧数最多的人员被登记，其他人员只报告不登记。
+ * 不指定人员ID时以视频文件名 (不含扩展名) 作为人员名称，与同名子目录中的图像属于同一个人员。
+ * 模板写入前同样经过去重；视频不记入登记清单。
+ *
+ * @param video_path 视频文件路径
+ * @param model_path 模型路径
+ * @param person_id 模板所属的人员ID，-1表示按视频文件名确定人员
+ * @param partition 模板所属的分区
+ * @param store_dir 独立名单库目录，为空表示写入FeatureHubDB
+ * @param video_config 分段数与选帧设置
+ * @param cache_path 特征缓存文件，为空表示不使用缓存
+ * @param dedup 去重设置
+ * @return int 0表示成功，非0表示失败
+ */
+int AddFacesFromVideo(const std::string& video_path, const std::string& model_path, int64_t person_id, int32_t partition,
+                      const std::string& store_dir, const gallery::VideoEnrollmentConfiguration& video_config,
+                      const std::string& cache_path, const DedupOptions& dedup) {
+    auto context = inspire::Launch::GetInstance();
+    context->SwitchImageProcessingBackend(inspire::Launch::IMAGE_PROCESSING_CPU);
+    int load_result = context->Load(model_path);
+    if (load_result != 0) {
+        std::cerr << "错误: 无法加载模型 (错误代码: " << load_result << ")" << std::endl;
+        return -1;
+    }
+
+    // Each segment thread owns a tracking session
+    gallery::VideoEnrollment video(video_config);
+    if (video.Initialize() != 0) {
+        std::cerr << "错误: 无法创建会话" << std::endl;
+        return -1;
+    }
+    gallery::FaceGallery face_gallery;
+    std::shared_ptr<inspire::FeatureHubDB> feature_hub;
+    const std::string names_path = store_dir.empty() ? "database/face_persons.txt" : store_dir + "/persons.txt";
+    if (OpenEnrollmentGallery(store_dir, face_gallery, feature_hub) != 0) {
+        return -1;
+    }
+    gallery::PersonNames person_names;
+    if (person_names.Load(names_path) != 0) {
+        std::cerr << "错误: 无法读取人员名称文件 " << names_path << std::endl;
+        return -1;
+    }
+    // Imported persons may be missing from the names file; new names must not reuse their ids
+    person_names.Reserve(face_gallery.MaxPerson());
+    gallery::EmbeddingCache embedding_cache;
+    if (OpenEmbeddingCache(cache_path, model_path, embedding_cache)) {
+        video.SetEmbeddingCache(&embedding_cache);
+    }
+
+    std::cout << "开始处理视频: " << video_path << std::endl;
+    std::vector<gallery::VideoIdentity> identities;
+    gallery::VideoStatistics stats;
+    int32_t run_result = video.Run(video_path, identities, &stats);
+    if (run_result != 0) {
+        std::cerr << "错误: 无法读取视频 " << video_path << " (错误代码: " << run_result << ")" << std::endl;
+        CloseEnrollmentGallery(store_dir, face_gallery, feature_hub, false);
+        return -1;
+    }
+    std::cout << "处理 " << stats.frames << " 帧 (" << stats.segments << " 段并行), " << stats.FramesPerSecond() << " 帧/秒, "
+              << stats.tracks << " 条有效人脸轨迹, 提取特征 " << stats.extractions << " 次 (特征缓存命中 " << stats.cache_hits << " 次)"
+              << std::endl;
+    if (identities.empty() || identities[0].templates.empty()) {
+        std::cerr << "错误: 视频中没有符合登记条件的人脸" << std::endl;
+        CloseEnrollmentGallery(store_dir, face_gallery, feature_hub, false);
+        return -1;
+    }
+    for (size_t i = 1; i < identities.size(); i++) {
+        std::cerr << "警告: 视频中另有一个人员出现在 " << identities[i].frames << " 帧中 (" << identities[i].tracks << " 条轨迹), 未登记"
+                  << std::endl;
+    }
+
+    // The person seen the longest is the one the clip was recorded for
+    const gallery::VideoIdentity& subject = identities[0];
+    int64_t person = person_id;
+    if (person < 0) {
+        std::string label = video_path.substr(video_path.find_last_of('/') + 1);
+        label = label.substr(0, label.find_last_of('.'));
+        person = person_names.Resolve(label);
+        std::cout << "人员名称: " << label << std::endl;
+    }
+    std::vector<inspire::Embedded> features;
+    std::vector<std::string> paths;
+    std::vector<int64_t> persons;
+    std::vector<gallery::ManifestEntry> entries;
+    for (const auto& chosen : subject.templates) {
+        std::cout << "选取第 " << chosen.frame << " 帧 (" << chosen.seconds << " 秒) 作为模板, 质量: " << chosen.quality << std::endl;
+        features.push_back(chosen.embedding);
+        paths.push_back(video_path + "@" + std::to_string(chosen.frame));
+        persons.push_back(person);
+        entries.emplace_back();
+    }
+    size_t merged_count = 0;
+    const size_t duplicate_count =
+        DeduplicateBatch(face_gallery, features, paths, persons, entries, partition, dedup, merged_count, nullptr);
+    int success_count = 0;
+    if (!features.empty()) {
+        person_names.Append(names_path);
+        std::vector<int64_t> ids;
+        success_count = FlushInsertBatch(face_gallery, features, paths, persons, partition, ids);
+        if (store_dir.empty()) {
+            face_gallery.AppendIdentityLabels(kLabelsPath, ids);
+        }
+    }
+    int32_t names_result = person_names.Save(names_path);
+    if (names_result != 0) {
+        std::cerr << "警告: 无法写入人员名称文件 " << names_path << " (错误代码: " << names_result << ")" << std::endl;
+    }
+
+    std::cout << "\n处理完成!" << std::endl;
+    std::cout << "从 " << subject.frames << " 帧 (" << subject.tracks << " 条轨迹) 中选取 " << subject.templates.size() << " 个模板, 成功添加 "
+              << success_count << " 个人脸特征到数据库" << std::endl;
+    if (dedup.threshold > 0.0f) {
+        std::cout << "去重 (阈值 " << dedup.threshold << "): 跳过 " << duplicate_count << " 个重复模板";
+        if (dedup.merge) {
+            std::cout << ", 合并 " << merged_count << " 个到已有人员";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "数据库中现有人脸数量: " << face_gallery.Size() << std::endl;
+    if (CloseEnrollmentGallery(store_dir, face_gallery, feature_hub, success_count > 0) != 0) {
+        return -1;
+    }
+    // Templates that were all duplicates of enrolled ones are not a failure
+    return success_count > 0 || duplicate_count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief 导出文件附带的人员名称文件: 与导出文件同名，后缀 .persons
+ */
+std::string ExportNamesPath(const std::string& export_path) {
+    return export_path + ".persons";
+}
+
+/**
+ * @brief 导出时把人员名称文件一并复制到导出文件旁
+ *
+ * @param names_path 本机的人员名称文件
+ * @param export_path 导出文件路径
+ */
+void ExportPersonNames(const std::string& names_path, const std::string& export_path) {
+    gallery::PersonNames person_names;
+    if (person_names.Load(names_path) != 0) {
+        std::cerr << "警告: 无法读取人员名称文件 " << names_path << ", 导出文件不带人员名称" << std::endl;
+        return;
+    }
+    const std::string export_names_path = ExportNamesPath(export_path);
+    if (person_names.Size() == 0) {
+        // A names file left by an earlier export must not be imported with this one
+        std::remove(export_names_path.c_str());
+        return;
+    }
+    int32_t save_result = person_names.Save(export_names_path);
+    if (save_result != 0) {
+        std::cerr << "警告: 无法写入人员名称文件 " << export_names_path << " (错误代码: " << save_result << ")" << std::endl;
+        return;
+    }
+    std::cout << "已导出 " << person_names.Size() << " 个人员名称到 " << export_names_path << std::endl;
+}
+
+/**
+ * @brief 导入时将导出端的人员名称合并到本机的人员名称文件
+ *
+ * 导入保留导出端的人员ID，名称随之合并；本机已有同名但ID不同、或同ID但名称不同的人员保持不变，并打印警告。
+ *
+ * @param names_path 本机的人员名称文件
+ * @param import_path 导入文件路径
+ */
+void ImportPersonNames(const std::string& names_path, const std::string& import_path) {
+    const std::string import_names_path = ExportNamesPath(import_path);
+    gallery::PersonNames imported_names;
+    gallery::PersonNames person_names;
+    if (imported_names.Load(import_names_path) != 0 || person_names.Load(names_path) != 0) {
+        std::cerr << "警告: 无法读取人员名称文件, 未合并人员名称" << std::endl;
+        return;
+    }
+    if (imported_names.Size() == 0) {
+        return;
+    }
+    std::vector<std::string> conflicts;
+    size_t added = person_names.Merge(imported_names, conflicts);
+    for (const auto& name : conflicts) {
+        std::cerr << "警告: 人员名称 " << name << " 与本机人员冲突, 保留本机的名称" << std::endl;
+    }
+    if (added > 0) {
+        int32_t save_result = person_names.Save(names_path);
+        if (save_result != 0) {
+            std::cerr << "警告: 无法写入人员名称文件 " << names_path << " (错误代码: " << save_result << ")" << std::endl;
+            return;
+        }
+    }
+    std::cout << "已合并 " << added << " 个人员名称" << std::endl;
+}
+
+/**
+ * @brief 导出独立名单库，或将导出文件合并到名单库
+ *
+ * @param store_dir 名单库目录
+ * @param export_path 导出文件路径，为空表示导入
+ * @param import_path 导入文件路径，为空表示导出
+ * @param fp16 导出时以半精度保存特征
+ * @return int 0表示成功，非0表示失败
+ */
+int TransferStore(const std::string& store_dir, const std::string& export_path, const std::string& import_path, bool fp16) {
+    const std::string names_path = store_dir + "/persons.txt";
+    gallery::FaceGallery face_gallery;
+    int32_t store_result = face_gallery.OpenStore(store_dir, BatchStoreConfiguration());
+    if (store_result != 0) {
+        std::cerr << "错误: 无法打开名单库 " << store_dir << " (错误代码: " << store_result << ")" << std::endl;
+        return -1;
+    }
+    if (import_path.empty()) {
+        int32_t export_result = face_gallery.ExportSnapshot(export_path, fp16);
+        if (export_result != 0) {
+            std::cerr << "错误: 无法导出名单库到 " << export_path << " (错误代码: " << export_result << ")" << std::endl;
+            return -1;
+        }
+        std::cout << "已导出 " << face_gallery.Size() << " 个人脸特征到 " << export_path << std::endl;
+        ExportPersonNames(names_path, export_path);
+        return 0;
+    }
+
+    size_t imported = 0;
+    int32_t import_result = face_gallery.ImportSnapshot(import_path, &imported);
+    // The rows imported before a corrupt chunk are kept, like a FeatureHubDB import
+    int32_t close_result = face_gallery.DisableWriteBehind();
+    std::cout << "已导入 " << imported << " 个人脸特征, 名单库中现有人脸数量: " << face_gallery.Size() << std::endl;
+    if (imported > 0) {
+        ImportPersonNames(names_path, import_path);
+    }
+    if (close_result != 0) {
+        std::cerr << "错误: 无法写入名单库 " << store_dir << " (错误代码: " << close_result << ")" << std::endl;
+        return -1;
+    }
+    if (import_result != 0) {
+        std::cerr << "错误: 导入文件 " << import_path << " 损坏或不完整 (错误代码: " << import_result << ")" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 导出整个人脸库，或将导出文件合并到本机数据库
+ *
+ * 导入时保留导出端的人脸ID，因此数据库以手动主键模式打开；ID相同的人脸会被覆盖。
+ *
+ * @param export_path 导出文件路径，为空表示导入
+ * @param import_path 导入文件路径，为空表示导出
+ * @param fp16 导出时以半精度保存特征
+ * @param store_dir 独立名单库目录，为空表示FeatureHubDB
+ * @return int 0表示成功，非0表示失败
+ */
+int TransferDatabase(const std::string& export_path, const std::string& import_path, bool fp16, const std::string& store_dir) {
+    const std::string db_path = "database/face_features.db";
+    const std::string labels_path = "database/face_identities.txt";
+    const std::string names_path = "database/face_persons.txt";
+    const bool importing = !import_path.empty();
+    if (!store_dir.empty()) {
+        return TransferStore(store_dir, export_path, import_path, fp16);
+    }
+    struct stat info;
+    if (importing && stat("database", &info) != 0) {
+        mkdir("database", 0755);
+        std::cout << "创建数据库目录: database" << std::endl;
+    }
+
+    auto feature_hub = inspire::FeatureHubDB::GetInstance();
+    inspire::DatabaseConfiguration db_config;
+    db_config.enable_persistence = true;
+    db_config.persistence_db_path = db_path;
+    db_config.primary_key_mode = importing ? inspire::PrimaryKeyMode::MANUAL_INPUT : inspire::PrimaryKeyMode::AUTO_INCREMENT;
+    int32_t hub_result = feature_hub->EnableHub(db_config);
+    if (hub_result != 0) {
+        std::cerr << "错误: 无法启用FeatureHubDB (错误代码: " << hub_result << ")" << std::endl;
+        return -1;
+    }
+
+    gallery::GalleryConfiguration gallery_config;
+    gallery_config.primary_key_mode = db_config.primary_key_mode;
+    gallery::FaceGallery face_gallery(gallery_config);
+    int32_t gallery_result = face_gallery.LoadFromHub(feature_hub);
+    if (gallery_result == 0) {
+        gallery_result = face_gallery.LoadIdentityLabels(labels_path);
+    }
+    if (gallery_result != 0) {
+        std::cerr << "错误: 无法加载人脸库 (错误代码: " << gallery_result << ")" << std::endl;
+        return -1;
+    }
+
+    if (!importing) {
+        int32_t export_result = face_gallery.ExportSnapshot(export_path, fp16);
+        if (export_result != 0) {
+            std::cerr << "错误: 无法导出人脸库到 " << export_path << " (错误代码: " << export_result << ")" << std::endl;
+            return -1;
+        }
+        std::cout << "已导出 " << face_gallery.Size() << " 个人脸特征到 " << export_path << std::endl;
+        ExportPersonNames(names_path, export_path);
+        return 0;
+    }
+
+    size_t imported = 0;
+    int32_t import_result = face_gallery.ImportSnapshot(import_path, &imported);
+    std::cout << "已导入 " << imported << " 个人脸特征, 数据库中现有人脸数量: " << face_gallery.Size() << std::endl;
+    if (imported > 0) {
+        ImportPersonNames(names_path, import_path);
+        face_gallery.SaveIdentityLabels(labels_path);
+        feature_hub->DisableHub();
+        face_gallery.SaveSnapshot("database/face_features.snapshot",
+                                  gallery::FileSourceStamp(std::vector<std::string>{db_path, labels_path}));
+    }
+    if (import_result != 0) {
+        std::cerr << "错误: 导入文件 " << import_path << " 损坏或不完整 (错误代码: " << import_result << ")" << std::endl;
+        return -1;
+    }
+    return 0;
 }
 
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "用法: " << argv[0] << " <模型路径> [图像目录]" << std::endl;
+    std::vector<std::string> positional;
+    int64_t person_id = -1;
+    std::string export_path;
+    std::string import_path;
+    bool fp16 = false;
+    std::string store_dir;
+    int32_t partition = 0;
+    gallery::EnrollmentConfiguration enroll_config;
+    gallery::VideoEnrollmentConfiguration video_config;
+    std::string cache_path = "database/face_embeddings.cache";
+    DedupOptions dedup;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--person" && i + 1 < argc) {
+            person_id = std::stoll(argv[++i]);
+        } else if (arg == "--export" && i + 1 < argc) {
+            export_path = argv[++i];
+        } else if (arg == "--import" && i + 1 < argc) {
+            import_path = argv[++i];
+        } else if (arg == "--fp16") {
+            fp16 = true;
+        } else if (arg == "--partition" && i + 1 < argc) {
+            partition = std::stoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            enroll_config.workers = std::stoi(argv[++i]);
+        } else if (arg == "--decoders" && i + 1 < argc) {
+            enroll_config.decoders = std::stoi(argv[++i]);
+        } else if (arg == "--decode-side" && i + 1 < argc) {
+            enroll_config.decode_side = std::stoi(argv[++i]);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (arg == "--no-cache") {
+            cache_path.clear();
+        } else if (arg == "--max-faces" && i + 1 < argc) {
+            enroll_config.max_faces = std::stoi(argv[i + 1]);
+            video_config.max_faces = std::stoi(argv[++i]);
+        } else if (arg == "--min-face" && i + 1 < argc) {
+            enroll_config.min_enroll_side = std::stoi(argv[i + 1]);
+            video_config.min_face_side = std::stoi(argv[++i]);
+        } else if (arg == "--max-pose" && i + 1 < argc) {
+            enroll_config.max_pose = std::stof(argv[i + 1]);
+            video_config.max_pose = std::stof(argv[++i]);
+        } else if (arg == "--min-quality" && i + 1 < argc) {
+            enroll_config.min_quality = std::stof(argv[i + 1]);
+            video_config.min_quality = std::stof(argv[++i]);
+        } else if (arg == "--segments" && i + 1 < argc) {
+            video_config.segments = std::stoi(argv[++i]);
+        } else if (arg == "--track-frames" && i + 1 < argc) {
+            video_config.frames_per_track = std::stoi(argv[++i]);
+        } else if (arg == "--templates" && i + 1 < argc) {
+            video_config.templates = std::stoi(argv[++i]);
+        } else if (arg == "--dedup" && i + 1 < argc) {
+            dedup.threshold = std::stof(argv[++i]);
+        } else if (arg == "--dedup-merge") {
+            dedup.merge = true;
+        } else if (arg == "--store" && i + 1 < argc) {
+            store_dir = argv[++i];
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (export_path.empty() != import_path.empty()) {
+        return TransferDatabase(export_path, import_path, fp16, store_dir);
+    }
+
+    if (positional.size() < 2) {
+        std::cout << "用法: " << argv[0] << " <模型路径> [图像目录 | 视频文件] [--person 人员ID] [--partition 分区] [--workers N] [--decoders N] [--decode-side N] [--max-faces N] [--min-face N] [--max-pose 角度] [--min-quality Q] [--segments N] [--track-frames N] [--templates N] [--cache 文件 | --no-cache] [--dedup 阈值] [--dedup-merge] [--store 名单库目录]" << std::endl;
+        std::cout << "      " << argv[0] << " --export 导出文件 [--fp16] [--store 名单库目录]" << std::endl;
+        std::cout << "      " << argv[0] << " --import 导出文件 [--store 名单库目录]" << std::endl;
         std::cout << "  如果提供图像目录，则从目录中所有图像提取人脸特征" << std::endl;
+        std::cout << "  图像目录中的子目录会被递归处理, 子目录名作为人员名称, 同一子目录中的图像属于同一个人员" << std::endl;
+        std::cout << "  登记是增量的: 再次运行时只处理新增或变化的图像, 删除已不存在的图像对应的人脸特征, 中断后从最后一批继续" << std::endl;
+        std::cout << "  如果提供视频文件 (mp4/avi/mov/mkv/h264/h265), 则跟踪视频中的人脸, 选取多帧差异较大的高质量人脸作为同一人员的模板, 视频文件名作为人员名称" << std::endl;
+        std::cout << "  --person 人员ID: 目录中的图像都是同一个人的多张模板 (默认: 按子目录区分人员, 直接位于图像目录下的图像各自作为一个人员)" << std::endl;
+        std::cout << "  --partition 分区: 目录中的图像登记到该分区 (非负整数, 如站点或分组编号, 默认: 0)" << std::endl;
+        std::cout << "  --workers N: 人脸检测与特征提取线程数, 每个线程使用独立的会话 (默认: 1)" << std::endl;
+        std::cout << "  --decoders N: 图像解码线程数 (默认: 1)" << std::endl;
+        std::cout << "  --decode-side N: 大尺寸 JPEG 缩小解码, 短边不小于 N 像素, 人脸过小时按原尺寸重新解码 (默认: 640, 0 表示总是按原尺寸解码)" << std::endl;
+        std::cout << "  --max-faces N: 每张图像最多检测的人脸数, 从中选取尺寸、正脸程度与质量综合最好的一张登记 (默认: 8)" << std::endl;
+        std::cout << "  --min-face N: 选取的人脸边长 (原图像素) 小于 N 时不予登记 (默认: 64)" << std::endl;
+        std::cout << "  --max-pose 角度: 选取的人脸偏航角或俯仰角超过该角度时不予登记 (默认: 30, 0 表示不限制)" << std::endl;
+        std::cout << "  --min-quality Q: 选取的人脸质量评分低于 Q 时不予登记 (默认: 0.5, 0 表示不限制)" << std::endl;
+        std::cout << "  --segments N: 视频分段并行解码与跟踪的段数, 每段使用独立的会话 (默认: 4)" << std::endl;
+        std::cout << "  --track-frames N: 视频中每条人脸轨迹保留的最好帧数 (默认: 8)" << std::endl;
+        std::cout << "  --templates N: 从视频中为人员选取的模板数上限 (默认: 5)" << std::endl;
+        std::cout << "  --cache 文件: 特征缓存, 对齐后人脸图像与模型相同时直接复用特征, 不再提取 (默认: database/face_embeddings.cache); --no-cache 不使用缓存" << std::endl;
+        std::cout << "  --dedup 阈值: 与所在分区已有特征或同批图像的相似度达到阈值的图像视为重复而跳过, 并逐张报告 (默认: 0.95, 0 表示不去重)" << std::endl;
+        std::cout << "  --dedup-merge: 与其他人员的已有特征重复的图像不跳过, 而是作为该人员的模板写入" << std::endl;
+        std::cout << "  --export 导出文件: 将整个人脸库导出为分块校验的二进制文件, 人员名称写到 导出文件.persons, --fp16 以半精度保存 (文件减半)" << std::endl;
+        std::cout << "  --import 导出文件: 将导出文件合并到本机数据库, 保留原人脸ID, 相同ID的人脸被覆盖, 并合并 导出文件.persons 中的人员名称" << std::endl;
+        std::cout << "  --store 名单库目录: 操作独立的名单库 (如黑名单、VIP名单) 而不是主数据库, 目录不存在时自动创建" << std::endl;
         std::cout << "示例:" << std::endl;
         std::cout << "  " << argv[0] << " ../model /path/to/image/directory" << std::endl;
+        std::cout << "  " << argv[0] << " ../model /path/to/zhangsan --person 1001" << std::endl;
+        std::cout << "  " << argv[0] << " ../model /path/to/vip/images --store vip" << std::endl;
+        std::cout << "  " << argv[0] << " ../model /path/to/image/directory --workers 3 --decoders 2" << std::endl;
+        std::cout << "  " << argv[0] << " ../model /path/to/zhangsan.mp4 --segments 3" << std::endl;
         return -1;
     }
 
-    std::string model_path = argv[1];
+    std::string model_path = positional[0];
 
-    if (argc >= 2) {
-        // Check if argv[2] is a directory
-        struct stat info;
-        if (stat(argv[2], &info) == 0 && info.st_mode & S_IFDIR) {
-            // It's a directory, process all images in the directory
-            return AddFacesFromDirectory(argv[2], model_path);
-        } else {
-			std::cout<<"输入的参数不是目录"<<std::endl;
-			return -1;
-		}
-    } else {
-        std::cout << "参数错误，请检查用法" << std::endl;
+    // Check if the second argument is a directory or a video file
+    struct stat info;
+    const bool exists = stat(positional[1].c_str(), &info) == 0;
+    const bool is_directory = exists && S_ISDIR(info.st_mode);
+    const bool is_video = exists && S_ISREG(info.st_mode) && gallery::VideoEnrollment::IsVideoFile(positional[1]);
+    if (!is_directory && !is_video) {
+        std::cout << "输入的参数不是目录或视频文件" << std::endl;
+        return -1;
+    }
+    if (partition < 0) {
+        std::cerr << "错误: 分区必须是非负整数" << std::endl;
+        return -1;
+    }
+    if (enroll_config.workers < 1 || enroll_config.decoders < 1 || video_config.segments < 1) {
+        std::cerr << "错误: 线程数必须是正整数" << std::endl;
         return -1;
     }
-}
\ No newline at end of file
+    if (enroll_config.max_faces < 1) {
+        std::cerr << "错误: 最多检测的人脸数必须是正整数" << std::endl;
+        return -1;
+    }
+    if (video_config.frames_per_track < 1 || video_config.templates < 1) {
+        std::cerr << "错误: 保留帧数与模板数必须是正整数" << std::endl;
+        return -1;
+    }
+    if (dedup.threshold > 1.0f) {
+        std::cerr << "错误: 去重阈值不能大于 1" << std::endl;
+        return -1;
+    }
+    if (is_video) {
+        return AddFacesFromVideo(positional[1], model_path, person_id, partition, store_dir, video_config, cache_path, dedup);
+    }
+    return AddFacesFromDirectory(positional[1], model_path, person_id, partition, store_dir, enroll_config, cache_path, dedup);
+}
@@ -10,20 +10,61 @@
 #include <sstream>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "face_gallery.h"
+#include "gallery_federation.h"
+#include "person_names.h"
+#include "score_converter.h"
 
 // Function to parse command line arguments
-bool ParseArguments(int argc, char** argv, std::string& model_path, int& camera_index) {
-    if (argc < 2 || argc > 3) {
-        std::cout << "用法: " << argv[0] << " <模型路径> [摄像头索引]" << std::endl;
+bool ParseArguments(int argc, char** argv, std::string& model_path, int& camera_index,
+                    gallery::GalleryConfiguration& gallery_config, std::vector<std::string>& watchlists,
+                    std::vector<int32_t>& partitions) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--search-threads" && i + 1 < argc) {
+            gallery_config.search_threads = std::stoi(argv[++i]);
+        } else if (arg == "--search-shards" && i + 1 < argc) {
+            gallery_config.search_shards = std::stoi(argv[++i]);
+        } else if (arg == "--big-cores") {
+            gallery_config.big_cores_only = true;
+        } else if (arg == "--eager") {
+            gallery_config.search_mode = inspire::SEARCH_MODE_EAGER;
+        } else if (arg == "--prefilter" && i + 1 < argc) {
+            gallery_config.hash_prefilter = true;
+            gallery_config.prefilter_candidates = std::stoi(argv[++i]);
+        } else if (arg == "--query-cache" && i + 1 < argc) {
+            gallery_config.query_cache_tracks = 32;
+            gallery_config.query_cache_epsilon = std::stof(argv[++i]);
+        } else if (arg == "--watchlist" && i + 1 < argc) {
+            watchlists.push_back(argv[++i]);
+        } else if (arg == "--partition" && i + 1 < argc) {
+            partitions.push_back(std::stoi(argv[++i]));
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.size() < 1 || positional.size() > 2) {
+        std::cout << "用法: " << argv[0] << " <模型路径> [摄像头索引] [选项]" << std::endl;
         std::cout << "  摄像头索引: 0 表示默认摄像头, 1 表示第二个摄像头, 以此类推 (默认: 0)" << std::endl;
+        std::cout << "选项:" << std::endl;
+        std::cout << "  --search-threads N  人脸库检索线程数 (默认: 全部核心)" << std::endl;
+        std::cout << "  --search-shards N   每次检索的分片数 (默认: 与线程数相同)" << std::endl;
+        std::cout << "  --big-cores         检索线程只运行在大核上 (big.LITTLE 架构)" << std::endl;
+        std::cout << "  --eager             快速检索: 优先比对最近匹配过的人脸, 达到阈值即停止" << std::endl;
+        std::cout << "  --prefilter N       先用二值哈希筛选 N 个候选, 再精确比对 (N 越大召回率越高)" << std::endl;
+        std::cout << "  --query-cache E     同一跟踪目标的特征与上次检索的余弦差小于 E 时复用上次结果 (如 0.01)" << std::endl;
+        std::cout << "  --watchlist DIR     同时比对 DIR 中的独立名单库 (可重复指定, 由 add_face_to_database --store 创建)" << std::endl;
+        std::cout << "  --partition N       只比对分区 N 中的人脸 (可重复指定, 分区由 add_face_to_database --partition 设置)" << std::endl;
         return false;
     }
 
-    model_path = argv[1];
+    model_path = positional[0];
     camera_index = 0;
     
-    if (argc == 3) {
-        camera_index = std::stoi(argv[2]);
+    if (positional.size() == 2) {
+        camera_index = std::stoi(positional[1]);
     }
     
     return true;
@@ -84,6 +125,9 @@ bool LoadModel(const std::string& model_path) {
     }
 
     printf("模型加载成功!!!!!!!!!!\n");
+
+    // Match scores are shown with the SDK's cosine-to-percentage curve, converted lock-free
+    gallery::ScoreConverter::Instance().UpdateConfig(SIMILARITY_CONVERTER_GET_CONFIG());
     return true;
 }
 
@@ -158,6 +202,96 @@ std::shared_ptr<inspire::FeatureHubDB> InitializeFeatureHub() {
     return feature_hub;
 }
 
+// Function to load the in-memory search gallery
+// The memory-mapped snapshot is used when it was built from the current database and label files;
+// otherwise the features are loaded from FeatureHubDB and the snapshot is rewritten.
+std::shared_ptr<gallery::FaceGallery> InitializeGallery(const gallery::GalleryConfiguration& gallery_config) {
+    const std::string db_path = "database/face_features.db";
+    const std::string labels_path = "database/face_identities.txt";
+    const std::string snapshot_path = "database/face_features.snapshot";
+    auto face_gallery = std::make_shared<gallery::FaceGallery>(gallery_config);
+
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t stamp = gallery::FileSourceStamp(std::vector<std::string>{db_path, labels_path});
+    if (stamp != 0 && face_gallery->LoadFromSnapshot(snapshot_path, stamp) == 0) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+        std::cout << "从快照加载人脸库: " << snapshot_path << ", 人脸数量: " << face_gallery->Size()
+                  << ", 耗时: " << elapsed.count() << " 毫秒" << std::endl;
+        return face_gallery;
+    }
+
+    auto feature_hub = InitializeFeatureHub();
+    if (feature_hub == nullptr) {
+        return nullptr;
+    }
+    int32_t load_result = face_gallery->LoadFromHub(feature_hub);
+    if (load_result != 0) {
+        std::cerr << "错误: 无法从FeatureHubDB加载人脸库 (错误代码: " << load_result << ")" << std::endl;
+        return nullptr;
+    }
+    int32_t labels_result = face_gallery->LoadIdentityLabels(labels_path);
+    if (labels_result != 0) {
+        std::cerr << "警告: 无法读取人员标签文件 " << labels_path << " (错误代码: " << labels_result << ")" << std::endl;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "从数据库加载人脸库, 人脸数量: " << face_gallery->Size() << ", 人员数量: " << face_gallery->IdentityCount() << ", 耗时: " << elapsed.count() << " 毫秒" << std::endl;
+
+    stamp = gallery::FileSourceStamp(std::vector<std::string>{db_path, labels_path});
+    if (stamp != 0) {
+        int32_t save_result = face_gallery->SaveSnapshot(snapshot_path, stamp);
+        if (save_result == 0) {
+            std::cout << "已更新人脸库快照: " << snapshot_path << std::endl;
+        } else {
+            std::cerr << "警告: 无法写入人脸库快照 (错误代码: " << save_result << ")" << std::endl;
+        }
+    }
+    return face_gallery;
+}
+
+// Function to open the watchlist galleries
+// Every watchlist is an independent store-backed gallery with its own threshold; the federation
+// searches all of them in parallel. Returns nullptr when no watchlist was given or one fails to open.
+std::unique_ptr<gallery::GalleryFederation> InitializeWatchlists(const std::vector<std::string>& watchlists,
+                                                                 const gallery::GalleryConfiguration& gallery_config) {
+    if (watchlists.empty()) {
+        return nullptr;
+    }
+    std::vector<std::shared_ptr<gallery::FaceGallery>> galleries;
+    for (const auto& directory : watchlists) {
+        auto watchlist = std::make_shared<gallery::FaceGallery>(gallery_config);
+        // The recognizer only searches: a mistyped directory must fail rather than create an empty store.
+        int32_t open_result = watchlist->OpenStoreReadOnly(directory);
+        if (open_result != 0) {
+            std::cerr << "错误: 无法打开名单库 " << directory << " (错误代码: " << open_result << ")" << std::endl;
+            return nullptr;
+        }
+        std::cout << "已加载名单库: " << directory << ", 人脸数量: " << watchlist->Size() << std::endl;
+        galleries.push_back(watchlist);
+    }
+    return std::unique_ptr<gallery::GalleryFederation>(new gallery::GalleryFederation(galleries));
+}
+
+// Function to check a face against every watchlist and mark a hit on the frame
+void CheckWatchlists(gallery::GalleryFederation& watchlists, const std::vector<std::string>& names,
+                     const inspire::Embedded& embedding, cv::Mat& frame, const inspire::FaceRect& face_rect) {
+    std::vector<gallery::FederatedSearchResult> hits;
+    int32_t search_result = watchlists.SearchTopK(embedding, hits, 1);
+    if (search_result != 0) {
+        std::cerr << "警告: 名单库检索失败, 错误代码: " << search_result << std::endl;
+        return;
+    }
+    if (hits.empty()) {
+        return;
+    }
+    const auto& hit = hits[0];
+    std::cout << "名单命中: " << names[hit.gallery] << ", ID: " << hit.id << ", 相似度: " << hit.similarity << std::endl;
+    std::string hit_info = "名单: " + names[hit.gallery] + " ID: " + std::to_string(hit.id);
+    cv::putText(frame, hit_info,
+               cv::Point(face_rect.x, face_rect.y + face_rect.height + 70),
+               cv::FONT_HERSHEY_SIMPLEX, 0.6,
+               cv::Scalar(0, 0, 255), 2);
+}
+
 // Function to configure session parameters
 void ConfigureSession(std::shared_ptr<inspire::Session> session) {
     // Configure face detection threshold (default is typically 0.5)
@@ -198,7 +332,10 @@ bool IsFrontalFace(const inspire::FaceTrackWrap& face) {
 }
 
 // Function to compare face with database and return match result
-bool CompareFaceWithDatabase(std::shared_ptr<inspire::FeatureHubDB> feature_hub, 
+bool CompareFaceWithDatabase(std::shared_ptr<gallery::FaceGallery> face_gallery, 
+                            const gallery::PersonNames& person_names,
+                            const std::vector<int32_t>& partitions,
+                            int track_id,
                             const inspire::Embedded& embedding, 
                             cv::Mat& frame, 
                             const inspire::FaceRect& face_rect,
@@ -209,7 +346,7 @@ bool CompareFaceWithDatabase(std::shared_ptr<inspire::FeatureHubDB> feature_hub,
     std::cout << "特征向量维度: " << embedding.size() << std::endl;
     
     // Check database status
-    int32_t face_count = feature_hub->GetFaceFeatureCount();
+    int32_t face_count = static_cast<int32_t>(face_gallery->Size());
     std::cout << "数据库中人脸数量: " << face_count << std::endl;
     
     if (face_count == 0) {
@@ -223,9 +360,29 @@ bool CompareFaceWithDatabase(std::shared_ptr<inspire::FeatureHubDB> feature_hub,
         return false;
     }
     
-    // Compare with faces in the database
+    // Compare with faces in the database; with several templates per person, search by person.
+    // A still face repeats its last query, which the gallery answers from its per-track cache.
+    // Searches restricted to some partitions scan only those and bypass the cache.
     std::vector<inspire::FaceSearchResult> search_results;
-    int32_t search_result = feature_hub->SearchFaceFeatureTopK(embedding, search_results, 3, false);
+    int32_t search_result = 0;
+    if (face_gallery->IdentityCount() < face_gallery->Size()) {
+        std::vector<gallery::IdentitySearchResult> identity_results;
+        if (partitions.empty()) {
+            search_result = face_gallery->SearchTrackIdentityTopK(track_id, embedding, identity_results, 3);
+        } else {
+            search_result = face_gallery->SearchIdentityTopK(embedding, identity_results, 3, partitions);
+        }
+        for (const auto& identity : identity_results) {
+            inspire::FaceSearchResult result;
+            result.id = identity.person;
+            result.similarity = identity.similarity;
+            search_results.push_back(result);
+        }
+    } else if (partitions.empty()) {
+        search_result = face_gallery->SearchTrackTopK(track_id, embedding, search_results, 3);
+    } else {
+        search_result = face_gallery->SearchFaceFeatureTopK(embedding, search_results, 3, partitions);
+    }
     std::cout << "比对结果代码: " << search_result << ", 找到匹配数量: " << search_results.size() << std::endl;
     
     if (search_result == 0 && !search_results.empty()) {
@@ -233,12 +390,30 @@ bool CompareFaceWithDatabase(std::shared_ptr<inspire::FeatureHubDB> feature_hub,
         auto& top_match = search_results[0];
         matched_id = top_match.id;
         similarity = top_match.similarity;
-        
-        std::cout << "找到匹配的人脸 - ID: " << matched_id << ", 相似度: " << similarity << std::endl;
+
+        // Convert the whole candidate list in one call
+        std::vector<float> cosines;
+        for (const auto& result : search_results) {
+            cosines.push_back(result.similarity);
+        }
+        std::vector<double> percentages(cosines.size());
+        gallery::ScoreConverter::Instance().ConvertBatch(cosines.data(), percentages.data(), cosines.size());
+        for (size_t i = 0; i < search_results.size(); ++i) {
+            std::cout << "候选 " << i + 1 << " - ID: " << search_results[i].id << ", 余弦相似度: " << cosines[i]
+                      << ", 匹配度: " << static_cast<int>(percentages[i] * 100) << "%" << std::endl;
+        }
+
+        // Persons enrolled from a folder are shown by the folder name
+        const std::string* name = person_names.Name(matched_id);
+        std::cout << "找到匹配的人脸 - ID: " << matched_id;
+        if (name != nullptr) {
+            std::cout << " (" << *name << ")";
+        }
+        std::cout << ", 相似度: " << similarity << std::endl;
         
         // Display match information on the image
-        std::string match_info = "匹配ID: " + std::to_string(matched_id);
-        std::string similarity_info = "相似度: " + std::to_string(static_cast<int>(similarity * 100)) + "%";
+        std::string match_info = name != nullptr ? "匹配: " + *name : "匹配ID: " + std::to_string(matched_id);
+        std::string similarity_info = "相似度: " + std::to_string(static_cast<int>(percentages[0] * 100)) + "%";
         
         cv::putText(frame, match_info, 
                    cv::Point(face_rect.x, face_rect.y - 30), 
@@ -388,9 +563,12 @@ bool HasGlassesWithReflections(const cv::Mat& frame, const inspire::FaceTrackWra
 int main(int argc, char** argv) {
     std::string model_path;
     int camera_index;
+    gallery::GalleryConfiguration gallery_config;
+    std::vector<std::string> watchlist_dirs;
+    std::vector<int32_t> partitions;
     
     // Parse command line arguments
-    if (!ParseArguments(argc, argv, model_path, camera_index)) {
+    if (!ParseArguments(argc, argv, model_path, camera_index, gallery_config, watchlist_dirs, partitions)) {
         return -1;
     }
 
@@ -411,9 +589,21 @@ int main(int argc, char** argv) {
         return -1;
     }
     
-    // Initialize FeatureHubDB for face recognition comparison
-    auto feature_hub = InitializeFeatureHub();
-    if (feature_hub == nullptr) {
+    // Load the face gallery used for recognition comparison
+    auto face_gallery = InitializeGallery(gallery_config);
+    if (face_gallery == nullptr) {
+        return -1;
+    }
+
+    // Names of the persons enrolled from folders; a missing file just means ids are shown
+    gallery::PersonNames person_names;
+    if (person_names.Load("database/face_persons.txt") != 0) {
+        std::cerr << "警告: 无法读取人员名称文件 database/face_persons.txt" << std::endl;
+    }
+
+    // Open the watchlists searched alongside the main gallery
+    auto watchlists = InitializeWatchlists(watchlist_dirs, gallery_config);
+    if (!watchlist_dirs.empty() && watchlists == nullptr) {
         return -1;
     }
     
@@ -558,7 +748,10 @@ int main(int argc, char** argv) {
                 // Compare with faces in the database and get match result
                 int64_t matched_id;
                 double similarity;
-                bool is_matched = CompareFaceWithDatabase(feature_hub, feature.embedding, frame, rect, matched_id, similarity);
+                bool is_matched = CompareFaceWithDatabase(face_gallery, person_names, partitions, face.trackId, feature.embedding, frame, rect, matched_id, similarity);
+                if (watchlists != nullptr) {
+                    CheckWatchlists(*watchlists, watchlist_dirs, feature.embedding, frame, rect);
+                }
                 
                 // Save face image only if match is found
                 if (is_matched && matched_id != -1) {
@@ -615,6 +808,16 @@ int main(int argc, char** argv) {
         }
     }
 
+    gallery::SearchStatistics search_stats = face_gallery->GetSearchStatistics();
+    if (search_stats.queries > 0) {
+        std::cout << "检索次数: " << search_stats.queries << ", 平均每次比对: "
+                  << static_cast<double>(search_stats.comparisons) / search_stats.queries << " 条" << std::endl;
+    }
+    if (search_stats.cache_lookups > 0) {
+        std::cout << "检索缓存命中率: " << 100.0 * search_stats.cache_hits / search_stats.cache_lookups << "%, 节省检索时间: "
+                  << search_stats.cache_saved_ns / 1000000.0 << " 毫秒" << std::endl;
+    }
+
     // Release resources
     cap.release();
     if (gui_available) {
@@ -0,0 +1,673 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <inspireface/inspireface.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "cosine_similarity.h"
+#include "face_gallery.h"
+#include "person_names.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Rows compared against each other per block of the all-pairs scan
+const size_t kPairBlockRows = 256;
+// Similar pairs kept for the report; all of them are counted
+const size_t kMaxReportedPairs = 20;
+
+/**
+ * @struct CheckOptions
+ * @brief 命令行选项
+ */
+struct CheckOptions {
+    std::string store_dir;             ///< 独立名单库目录，为空表示检查主数据库
+    size_t queries = 1000;             ///< 自检索和基准测试的查询数量
+    size_t top_k = 10;                 ///< SearchFaceFeatureTopK 的 K
+    float duplicate_threshold = 0.95f; ///< 两个人员的模板相似度达到该值视为重复人员
+    float near_threshold = -1.0f;      ///< 近似重复人员的阈值，负数表示使用识别阈值
+    bool skip_pairs = false;           ///< 跳过全量两两比对
+    bool json = false;                 ///< 在标准输出打印 JSON 报告，其余信息打印到标准错误
+    gallery::GalleryConfiguration gallery_config;
+};
+
+/**
+ * @struct LatencySummary
+ * @brief 一组检索耗时的统计 (微秒)
+ */
+struct LatencySummary {
+    size_t count = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+/**
+ * @struct SimilarPair
+ * @brief 属于不同人员、相似度达到阈值的两个模板
+ */
+struct SimilarPair {
+    int64_t person_a;
+    int64_t person_b;
+    int64_t id_a;
+    int64_t id_b;
+    float similarity;
+};
+
+/**
+ * @brief 汇总耗时样本，样本会被排序
+ */
+LatencySummary Summarize(std::vector<double>& samples) {
+    LatencySummary summary;
+    summary.count = samples.size();
+    if (samples.empty()) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    auto percentile = [&samples](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+        return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+    summary.mean = sum / samples.size();
+    summary.p50 = percentile(0.50);
+    summary.p90 = percentile(0.90);
+    summary.p99 = percentile(0.99);
+    summary.max = samples.back();
+    return summary;
+}
+
+double MicrosecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/**
+ * @brief 转义 JSON 字符串
+ */
+std::string JsonString(const std::string& text) {
+    std::string escaped = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += static_cast<char>(c);
+        }
+    }
+    return escaped + "\"";
+}
+
+std::string JsonLatency(const LatencySummary& summary) {
+    std::ostringstream json;
+    json << "{\"count\": " << summary.count << ", \"mean_us\": " << summary.mean << ", \"p50_us\": " << summary.p50
+         << ", \"p90_us\": " << summary.p90 << ", \"p99_us\": " << summary.p99 << ", \"max_us\": " << summary.max << "}";
+    return json.str();
+}
+
+void PrintLatency(std::ostream& out, const std::string& title, const LatencySummary& summary) {
+    out << title << ": " << summary.count << " 次, 平均 " << summary.mean << " 微秒, P50 " << summary.p50 << ", P90 " << summary.p90
+        << ", P99 " << summary.p99 << ", 最大 " << summary.max << std::endl;
+}
+
+/**
+ * @brief 解析命令行参数
+ * @return bool 参数有效时返回 true
+ */
+bool ParseArguments(int argc, char** argv, CheckOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--store" && i + 1 < argc) {
+            options.store_dir = argv[++i];
+        } else if (arg == "--queries" && i + 1 < argc) {
+            options.queries = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--topk" && i + 1 < argc) {
+            options.top_k = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--duplicate" && i + 1 < argc) {
+            options.duplicate_threshold = std::stof(argv[++i]);
+        } else if (arg == "--near" && i + 1 < argc) {
+            options.near_threshold = std::stof(argv[++i]);
+        } else if (arg == "--no-pairs") {
+            options.skip_pairs = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--search-threads" && i + 1 < argc) {
+            options.gallery_config.search_threads = std::stoi(argv[++i]);
+        } else if (arg == "--search-shards" && i + 1 < argc) {
+            options.gallery_config.search_shards = std::stoi(argv[++i]);
+        } else if (arg == "--big-cores") {
+            options.gallery_config.big_cores_only = true;
+        } else if (arg == "--eager") {
+            options.gallery_config.search_mode = inspire::SEARCH_MODE_EAGER;
+        } else if (arg == "--prefilter" && i + 1 < argc) {
+            options.gallery_config.hash_prefilter = true;
+            options.gallery_config.prefilter_candidates = std::stoi(argv[++i]);
+        } else {
+            std::cout << "用法: " << argv[0] << " [--store 名单库目录] [--queries N] [--topk K] [--duplicate T] [--near T] [--no-pairs] [--json]" << std::endl;
+            std::cout << "      [--search-threads N] [--search-shards N] [--big-cores] [--eager] [--prefilter N]" << std::endl;
+            std::cout << "  检查人脸库 (默认: database/face_features.db, 或 --store 指定的名单库) 的完整性, 并测试检索性能:" << std::endl;
+            std::cout << "  1. 每条特征的维度、数值和模长" << std::endl;
+            std::cout << "  2. 全量两两比对, 找出模板相似度达到 --duplicate (默认: 0.95) 的重复人员和达到 --near (默认: 识别阈值) 的近似重复人员;" << std::endl;
+            std::cout << "     特征很多时耗时较长, --no-pairs 跳过" << std::endl;
+            std::cout << "  3. 自检索召回率: 用库中 --queries 条特征 (默认: 1000) 检索自身, 统计 Top-1 和 Top-K 命中率" << std::endl;
+            std::cout << "  4. SearchFaceFeature 和 SearchFaceFeatureTopK 的耗时分位数, 以及并发写入时的检索耗时" << std::endl;
+            std::cout << "  检索选项与 camera_face_recognizer 相同. --json 在标准输出打印 JSON 报告." << std::endl;
+            std::cout << "  发现完整性错误时返回 1." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 打开主数据库并加载人脸库
+ * @return 成功时返回 FeatureHubDB，失败时返回 nullptr
+ */
+std::shared_ptr<inspire::FeatureHubDB> LoadMainDatabase(gallery::FaceGallery& face_gallery, std::ostream& out) {
+    const std::string db_path = "database/face_features.db";
+    const std::string labels_path = "database/face_identities.txt";
+    // Enabling the hub would create an empty database; a missing one is an error here
+    struct stat info;
+    if (stat(db_path.c_str(), &info) != 0) {
+        std::cerr << "错误: 数据库文件不存在 " << db_path << std::endl;
+        return nullptr;
+    }
+    auto feature_hub = inspire::FeatureHubDB::GetInstance();
+    inspire::DatabaseConfiguration db_config;
+    db_config.enable_persistence = true;
+    db_config.persistence_db_path = db_path;
+    db_config.primary_key_mode = inspire::PrimaryKeyMode::AUTO_INCREMENT;
+    int32_t hub_result = feature_hub->EnableHub(db_config);
+    if (hub_result != 0) {
+        std::cerr << "错误: 无法打开数据库 " << db_path << " (错误代码: " << hub_result << ")" << std::endl;
+        return nullptr;
+    }
+    int32_t load_result = face_gallery.LoadFromHub(feature_hub);
+    if (load_result != 0) {
+        std::cerr << "错误: 无法从FeatureHubDB加载人脸库 (错误代码: " << load_result << ")" << std::endl;
+        return nullptr;
+    }
+    int32_t labels_result = face_gallery.LoadIdentityLabels(labels_path);
+    if (labels_result != 0) {
+        std::cerr << "警告: 无法读取人员标签文件 " << labels_path << " (错误代码: " << labels_result << ")" << std::endl;
+    }
+    out << "已加载数据库: " << db_path << std::endl;
+    return feature_hub;
+}
+
+/**
+ * @brief 检查每条特征的维度、数值和模长
+ *
+ * 人脸库中的行是归一化后的特征，模长应为 1；主数据库中的原始特征另外与人脸库逐条核对。
+ * @return std::string JSON 格式的检查结果
+ */
+std::string CheckRows(const gallery::FaceGallery& face_gallery, const std::shared_ptr<inspire::FeatureHubDB>& feature_hub,
+                      std::ostream& out, bool& ok) {
+    const float kNormTolerance = 1e-3f;
+    const size_t dim = face_gallery.Dimension();
+    std::vector<int64_t> ids;
+    face_gallery.GetExistingIds(ids);
+
+    size_t bad_dimension = 0;
+    size_t non_finite = 0;
+    size_t bad_norm = 0;
+    size_t raw_checked = 0;
+    size_t raw_missing = 0;
+    size_t raw_bad = 0;
+    size_t raw_mismatch = 0;
+    double raw_norm_min = ids.empty() ? 0.0 : 1e30;
+    double raw_norm_max = 0.0;
+    inspire::Embedded row;
+    std::vector<float> raw;
+    for (int64_t id : ids) {
+        if (face_gallery.GetFaceFeature(id, row) != 0 || row.size() != dim) {
+            ++bad_dimension;
+            continue;
+        }
+        double norm = 0.0;
+        bool finite = true;
+        for (float value : row) {
+            finite = finite && std::isfinite(value);
+            norm += static_cast<double>(value) * value;
+        }
+        if (!finite) {
+            ++non_finite;
+            continue;
+        }
+        if (std::fabs(std::sqrt(norm) - 1.0) > kNormTolerance) {
+            ++bad_norm;
+        }
+        if (feature_hub == nullptr) {
+            continue;
+        }
+        // The hub keeps the features as extracted; the gallery row must be their normalized copy
+        ++raw_checked;
+        if (id > INT32_MAX || feature_hub->GetFaceFeature(static_cast<int32_t>(id), raw) != 0) {
+            ++raw_missing;
+            continue;
+        }
+        double raw_norm = 0.0;
+        bool raw_finite = raw.size() == dim;
+        for (float value : raw) {
+            raw_finite = raw_finite && std::isfinite(value);
+            raw_norm += static_cast<double>(value) * value;
+        }
+        raw_norm = std::sqrt(raw_norm);
+        if (!raw_finite || raw_norm == 0.0) {
+            ++raw_bad;
+            continue;
+        }
+        raw_norm_min = std::min(raw_norm_min, raw_norm);
+        raw_norm_max = std::max(raw_norm_max, raw_norm);
+        double cosine = 0.0;
+        for (size_t i = 0; i < dim; ++i) {
+            cosine += static_cast<double>(raw[i]) * row[i];
+        }
+        if (std::fabs(cosine / raw_norm - 1.0) > kNormTolerance) {
+            ++raw_mismatch;
+        }
+    }
+    int32_t hub_rows = feature_hub != nullptr ? feature_hub->GetFaceFeatureCount() : -1;
+    const bool count_mismatch = feature_hub != nullptr && hub_rows != static_cast<int32_t>(ids.size());
+    ok = bad_dimension == 0 && non_finite == 0 && bad_norm == 0 && raw_missing == 0 && raw_bad == 0 && raw_mismatch == 0 && !count_mismatch;
+
+    out << "\n[完整性] 特征数量: " << ids.size() << ", 维度: " << dim << std::endl;
+    out << "维度错误: " << bad_dimension << ", 含非有限数值: " << non_finite << ", 模长不为 1: " << bad_norm << std::endl;
+    if (feature_hub != nullptr) {
+        out << "数据库中的特征数量: " << hub_rows << ", 已核对 " << raw_checked << " 条, 缺失: " << raw_missing << ", 无效: " << raw_bad
+            << ", 与人脸库不一致: " << raw_mismatch << std::endl;
+        out << "原始特征模长范围: [" << raw_norm_min << ", " << raw_norm_max << "]" << std::endl;
+    }
+    out << (ok ? "完整性检查通过" : "错误: 完整性检查未通过") << std::endl;
+
+    std::ostringstream json;
+    json << "{\"ok\": " << (ok ? "true" : "false") << ", \"rows\": " << ids.size() << ", \"dimension\": " << dim
+         << ", \"bad_dimension\": " << bad_dimension << ", \"non_finite\": " << non_finite << ", \"bad_norm\": " << bad_norm;
+    if (feature_hub != nullptr) {
+        json << ", \"hub_rows\": " << hub_rows << ", \"hub_checked\": " << raw_checked << ", \"hub_missing\": " << raw_missing
+             << ", \"hub_invalid\": " << raw_bad << ", \"hub_mismatch\": " << raw_mismatch << ", \"hub_norm_min\": " << raw_norm_min
+             << ", \"hub_norm_max\": " << raw_norm_max;
+    }
+    json << "}";
+    return json.str();
+}
+
+/**
+ * @brief 全量两两比对，找出重复和近似重复的人员
+ *
+ * 特征矩阵按块两两相乘 (CosineSimilarityNxM)，各块分配给所有核心并行计算。同一人员的模板之间只统计相似度达到重复阈值的
+ * 冗余模板；不同人员之间以最相似的一对模板作为两人的相似度。
+ * @return std::string JSON 格式的检查结果
+ */
+std::string FindDuplicates(const gallery::FaceGallery& face_gallery, const gallery::PersonNames& person_names, float duplicate_threshold,
+                           float near_threshold, std::ostream& out) {
+    const Clock::time_point start = Clock::now();
+    const size_t dim = face_gallery.Dimension();
+    std::vector<int64_t> ids;
+    face_gallery.GetExistingIds(ids);
+    const size_t rows = ids.size();
+    std::vector<float> matrix(rows * dim);
+    std::vector<int64_t> persons(rows);
+    inspire::Embedded feature;
+    for (size_t i = 0; i < rows; ++i) {
+        int32_t partition = 0;
+        face_gallery.GetFaceFeature(ids[i], feature);
+        face_gallery.GetFaceLabel(ids[i], persons[i], partition);
+        std::copy(feature.begin(), feature.end(), matrix.begin() + i * dim);
+    }
+
+    // Upper-triangle block pairs are handed out through a counter, so the threads stay balanced
+    const size_t blocks = (rows + kPairBlockRows - 1) / kPairBlockRows;
+    std::vector<std::pair<size_t, size_t>> block_pairs;
+    for (size_t a = 0; a < blocks; ++a) {
+        for (size_t b = a; b < blocks; ++b) {
+            block_pairs.emplace_back(a, b);
+        }
+    }
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> next_pair(0);
+    std::vector<std::map<std::pair<int64_t, int64_t>, SimilarPair>> found(thread_count);
+    std::vector<size_t> redundant(thread_count, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            auto& identity_pairs = found[t];
+            std::vector<float> scores(kPairBlockRows * kPairBlockRows);
+            while (true) {
+                const size_t index = next_pair++;
+                if (index >= block_pairs.size()) {
+                    break;
+                }
+                const size_t a_begin = block_pairs[index].first * kPairBlockRows;
+                const size_t b_begin = block_pairs[index].second * kPairBlockRows;
+                const size_t a_end = std::min(rows, a_begin + kPairBlockRows);
+                const size_t b_end = std::min(rows, b_begin + kPairBlockRows);
+                gallery::CosineSimilarityNxM(matrix.data() + a_begin * dim, a_end - a_begin, dim, matrix.data() + b_begin * dim, b_end - b_begin,
+                                             dim, dim, true, scores.data());
+                for (size_t i = a_begin; i < a_end; ++i) {
+                    const float* row_scores = scores.data() + (i - a_begin) * (b_end - b_begin) - b_begin;
+                    for (size_t j = std::max(b_begin, i + 1); j < b_end; ++j) {
+                        const float similarity = row_scores[j];
+                        if (similarity < near_threshold && similarity < duplicate_threshold) {
+                            continue;
+                        }
+                        if (persons[i] == persons[j]) {
+                            redundant[t] += similarity >= duplicate_threshold ? 1 : 0;
+                            continue;
+                        }
+                        const bool ordered = persons[i] < persons[j];
+                        const std::pair<int64_t, int64_t> key = ordered ? std::make_pair(persons[i], persons[j]) : std::make_pair(persons[j], persons[i]);
+                        auto it = identity_pairs.find(key);
+                        if (it == identity_pairs.end() || it->second.similarity < similarity) {
+                            identity_pairs[key] = SimilarPair{key.first, key.second, ordered ? ids[i] : ids[j], ordered ? ids[j] : ids[i], similarity};
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::map<std::pair<int64_t, int64_t>, SimilarPair> merged;
+    size_t redundant_templates = 0;
+    for (size_t t = 0; t < thread_count; ++t) {
+        redundant_templates += redundant[t];
+        for (const auto& entry : found[t]) {
+            auto it = merged.find(entry.first);
+            if (it == merged.end() || it->second.similarity < entry.second.similarity) {
+                merged[entry.first] = entry.second;
+            }
+        }
+    }
+    std::vector<SimilarPair> pairs;
+    size_t duplicates = 0;
+    size_t near_duplicates = 0;
+    for (const auto& entry : merged) {
+        if (entry.second.similarity >= duplicate_threshold) {
+            ++duplicates;
+        } else if (entry.second.similarity >= near_threshold) {
+            ++near_duplicates;
+        } else {
+            continue;
+        }
+        pairs.push_back(entry.second);
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const SimilarPair& a, const SimilarPair& b) { return a.similarity > b.similarity; });
+    if (pairs.size() > kMaxReportedPairs) {
+        pairs.resize(kMaxReportedPairs);
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto person_label = [&person_names](int64_t person) {
+        const std::string* name = person_names.Name(person);
+        return name != nullptr ? *name : std::to_string(person);
+    };
+    out << "\n[重复检查] 比对 " << rows * (rows > 0 ? rows - 1 : 0) / 2 << " 对模板, 耗时 " << seconds << " 秒" << std::endl;
+    out << "重复人员 (相似度 >= " << duplicate_threshold << "): " << duplicates << " 对, 近似重复人员 (>= " << near_threshold << "): "
+        << near_duplicates << " 对, 同一人员的冗余模板: " << redundant_templates << " 对" << std::endl;
+    for (const auto& pair : pairs) {
+        out << "  人员 " << person_label(pair.person_a) << " (ID " << pair.id_a << ") 与 人员 " << person_label(pair.person_b) << " (ID "
+            << pair.id_b << "): " << pair.similarity << std::endl;
+    }
+
+    std::ostringstream json;
+    json << "{\"duplicate_threshold\": " << duplicate_threshold << ", \"near_threshold\": " << near_threshold << ", \"seconds\": " << seconds
+         << ", \"duplicate_identities\": " << duplicates << ", \"near_duplicate_identities\": " << near_duplicates
+         << ", \"redundant_templates\": " << redundant_templates << ", \"pairs\": [";
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const SimilarPair& pair = pairs[i];
+        json << (i > 0 ? ", " : "") << "{\"person_a\": " << JsonString(person_label(pair.person_a)) << ", \"person_b\": "
+             << JsonString(person_label(pair.person_b)) << ", \"id_a\": " << pair.id_a << ", \"id_b\": " << pair.id_b
+             << ", \"similarity\": " << pair.similarity << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+/**
+ * @brief 从人脸库中均匀抽取查询特征
+ */
+void SampleQueries(const gallery::FaceGallery& face_gallery, size_t count, std::vector<int64_t>& ids, std::vector<inspire::Embedded>& features) {
+    std::vector<int64_t> all_ids;
+    face_gallery.GetExistingIds(all_ids);
+    ids.clear();
+    features.clear();
+    if (all_ids.empty() || count == 0) {
+        return;
+    }
+    count = std::min(count, all_ids.size());
+    for (size_t i = 0; i < count; ++i) {
+        const int64_t id = all_ids[i * all_ids.size() / count];
+        inspire::Embedded feature;
+        if (face_gallery.GetFaceFeature(id, feature) == 0) {
+            ids.push_back(id);
+            features.push_back(std::move(feature));
+        }
+    }
+}
+
+/**
+ * @brief 自检索召回率：库中的特征检索自身，应排在第一位
+ *
+ * 使用与识别程序相同的检索设置，因此能反映哈希预筛选、快速检索等近似检索的召回损失。
+ * 相似度与自身相同的并列结果 (完全重复的模板) 也算作命中。
+ * @return std::string JSON 格式的检查结果
+ */
+std::string MeasureSelfRecall(gallery::FaceGallery& face_gallery, const std::vector<int64_t>& ids, const std::vector<inspire::Embedded>& features,
+                              size_t top_k, std::ostream& out) {
+    const float kTieTolerance = 1e-5f;
+    size_t hits_at_1 = 0;
+    size_t hits_at_k = 0;
+    size_t identity_hits = 0;
+    std::vector<inspire::FaceSearchResult> results;
+    std::vector<gallery::IdentitySearchResult> identities;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        face_gallery.SearchFaceFeatureTopK(features[i], results, top_k);
+        bool found = false;
+        for (size_t r = 0; r < results.size(); ++r) {
+            found = found || results[r].id == ids[i];
+        }
+        if (!results.empty() && (results[0].id == ids[i] || results[0].similarity >= 1.0f - kTieTolerance)) {
+            ++hits_at_1;
+        }
+        hits_at_k += found ? 1 : 0;
+        int64_t person = ids[i];
+        int32_t partition = 0;
+        face_gallery.GetFaceLabel(ids[i], person, partition);
+        face_gallery.SearchIdentityTopK(features[i], identities, 1);
+        identity_hits += !identities.empty() && identities[0].person == person ? 1 : 0;
+    }
+    const double queries = std::max<size_t>(ids.size(), 1);
+    out << "\n[自检索] 查询 " << ids.size() << " 次, Top-1 召回率: " << hits_at_1 / queries << ", Top-" << top_k << " 召回率: " << hits_at_k / queries
+        << ", 人员 Top-1 召回率: " << identity_hits / queries << std::endl;
+
+    std::ostringstream json;
+    json << "{\"queries\": " << ids.size() << ", \"top_k\": " << top_k << ", \"recall_at_1\": " << hits_at_1 / queries
+         << ", \"recall_at_k\": " << hits_at_k / queries << ", \"identity_recall_at_1\": " << identity_hits / queries << "}";
+    return json.str();
+}
+
+/**
+ * @brief 检索耗时基准测试
+ *
+ * 查询为库中特征加上噪声 (与原特征的余弦约 0.8)，模拟同一人的另一张照片。最后把人脸库复制到一个
+ * 不落盘的内存人脸库中，在另一个线程持续插入和删除特征的同时测量检索耗时。
+ * @return std::string JSON 格式的测试结果
+ */
+std::string RunBenchmark(gallery::FaceGallery& face_gallery, const std::vector<inspire::Embedded>& samples, const CheckOptions& options,
+                         std::ostream& out) {
+    const size_t kWarmup = 10;
+    const size_t dim = face_gallery.Dimension();
+    std::mt19937 random(12345);
+    std::normal_distribution<float> noise(0.0f, 0.75f / std::sqrt(static_cast<float>(std::max<size_t>(dim, 1))));
+    std::vector<inspire::Embedded> queries;
+    for (const auto& sample : samples) {
+        inspire::Embedded query = sample;
+        for (float& value : query) {
+            value += noise(random);
+        }
+        queries.push_back(std::move(query));
+    }
+
+    inspire::FaceSearchResult best;
+    std::vector<inspire::FaceSearchResult> results;
+    for (size_t i = 0; i < std::min(kWarmup, queries.size()); ++i) {
+        face_gallery.SearchFaceFeatureTopK(queries[i], results, options.top_k);
+    }
+    std::vector<double> search_latency;
+    std::vector<double> topk_latency;
+    const Clock::time_point start = Clock::now();
+    for (const auto& query : queries) {
+        const Clock::time_point query_start = Clock::now();
+        face_gallery.SearchFaceFeature(query, best);
+        search_latency.push_back(MicrosecondsSince(query_start));
+    }
+    for (const auto& query : queries) {
+        const Clock::time_point query_start = Clock::now();
+        face_gallery.SearchFaceFeatureTopK(query, results, options.top_k);
+        topk_latency.push_back(MicrosecondsSince(query_start));
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const LatencySummary search_summary = Summarize(search_latency);
+    const LatencySummary topk_summary = Summarize(topk_latency);
+
+    // A scratch copy, so the writer never touches the database
+    gallery::FaceGallery scratch(options.gallery_config);
+    std::vector<int64_t> ids;
+    face_gallery.GetExistingIds(ids);
+    scratch.Reserve(ids.size() + 1, dim);
+    std::vector<gallery::GalleryMutation> batch;
+    int64_t max_id = 0;
+    for (int64_t id : ids) {
+        gallery::GalleryMutation mutation;
+        mutation.type = gallery::GalleryMutation::UPSERT;
+        mutation.id = id;
+        face_gallery.GetFaceFeature(id, mutation.feature);
+        face_gallery.GetFaceLabel(id, mutation.person, mutation.partition);
+        batch.push_back(std::move(mutation));
+        max_id = std::max(max_id, id);
+    }
+    scratch.Apply(batch);
+    batch.clear();
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> writes(0);
+    std::thread writer([&]() {
+        std::mt19937 writer_random(54321);
+        std::normal_distribution<float> value(0.0f, 1.0f);
+        inspire::Embedded feature(dim);
+        const int64_t id = max_id + 1;
+        while (!stop) {
+            for (float& v : feature) {
+                v = value(writer_random);
+            }
+            scratch.Insert(id, feature);
+            scratch.Remove(id);
+            writes += 2;
+        }
+    });
+    std::vector<double> concurrent_latency;
+    const Clock::time_point concurrent_start = Clock::now();
+    for (const auto& query : queries) {
+        const Clock::time_point query_start = Clock::now();
+        scratch.SearchFaceFeatureTopK(query, results, options.top_k);
+        concurrent_latency.push_back(MicrosecondsSince(query_start));
+    }
+    stop = true;
+    writer.join();
+    const double concurrent_seconds = std::chrono::duration<double>(Clock::now() - concurrent_start).count();
+    const LatencySummary concurrent_summary = Summarize(concurrent_latency);
+    const double writes_per_second = concurrent_seconds > 0.0 ? writes / concurrent_seconds : 0.0;
+
+    out << "\n[基准测试] 人脸数量: " << face_gallery.Size() << ", 维度: " << dim << ", 查询: " << queries.size() << ", 总耗时 " << seconds << " 秒" << std::endl;
+    PrintLatency(out, "SearchFaceFeature", search_summary);
+    PrintLatency(out, "SearchFaceFeatureTopK (K=" + std::to_string(options.top_k) + ")", topk_summary);
+    PrintLatency(out, "并发写入时 SearchFaceFeatureTopK", concurrent_summary);
+    out << "并发写入速度: " << writes_per_second << " 次/秒" << std::endl;
+
+    std::ostringstream json;
+    json << "{\"rows\": " << face_gallery.Size() << ", \"dimension\": " << dim << ", \"top_k\": " << options.top_k
+         << ", \"search\": " << JsonLatency(search_summary) << ", \"search_topk\": " << JsonLatency(topk_summary)
+         << ", \"search_topk_with_writes\": " << JsonLatency(concurrent_summary) << ", \"writes_per_second\": " << writes_per_second << "}";
+    return json.str();
+}
+
+int main(int argc, char** argv) {
+    CheckOptions options;
+    if (!ParseArguments(argc, argv, options)) {
+        return -1;
+    }
+    std::ostream& out = options.json ? std::cerr : std::cout;
+    if (options.near_threshold < 0.0f) {
+        options.near_threshold = options.gallery_config.recognition_threshold;
+    }
+
+    gallery::FaceGallery face_gallery(options.gallery_config);
+    std::shared_ptr<inspire::FeatureHubDB> feature_hub;
+    std::string names_path = "database/face_persons.txt";
+    if (!options.store_dir.empty()) {
+        int32_t store_result = face_gallery.OpenStoreReadOnly(options.store_dir);
+        if (store_result != 0) {
+            std::cerr << "错误: 无法打开名单库 " << options.store_dir << " (错误代码: " << store_result << ")" << std::endl;
+            return -1;
+        }
+        names_path = options.store_dir + "/persons.txt";
+        out << "已加载名单库: " << options.store_dir << std::endl;
+    } else {
+        feature_hub = LoadMainDatabase(face_gallery, out);
+        if (feature_hub == nullptr) {
+            return -1;
+        }
+    }
+    gallery::PersonNames person_names;
+    if (person_names.Load(names_path) != 0) {
+        std::cerr << "警告: 无法读取人员名称文件 " << names_path << std::endl;
+    }
+    out << "人脸数量: " << face_gallery.Size() << ", 人员数量: " << face_gallery.IdentityCount() << ", 维度: " << face_gallery.Dimension() << std::endl;
+
+    bool ok = true;
+    const std::string integrity = CheckRows(face_gallery, feature_hub, out, ok);
+    std::string duplicates = "null";
+    std::string recall = "null";
+    std::string benchmark = "null";
+    if (face_gallery.Size() > 0) {
+        if (!options.skip_pairs) {
+            duplicates = FindDuplicates(face_gallery, person_names, options.duplicate_threshold, options.near_threshold, out);
+        }
+        std::vector<int64_t> sample_ids;
+        std::vector<inspire::Embedded> samples;
+        SampleQueries(face_gallery, options.queries, sample_ids, samples);
+        recall = MeasureSelfRecall(face_gallery, sample_ids, samples, options.top_k, out);
+        benchmark = RunBenchmark(face_gallery, samples, options, out);
+    }
+
+    if (options.json) {
+        std::cout << "{\"source\": " << JsonString(options.store_dir.empty() ? "database/face_features.db" : options.store_dir)
+                  << ", \"identities\": " << face_gallery.IdentityCount() << ", \"integrity\": " << integrity << ", \"duplicates\": " << duplicates
+                  << ", \"self_recall\": " << recall << ", \"benchmark\": " << benchmark << "}" << std::endl;
+    }
+    if (feature_hub != nullptr) {
+        feature_hub->DisableHub();
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+#include "cosine_similarity.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GALLERY_COSINE_NEON 1
+#endif
+
+namespace gallery {
+
+namespace {
+
+// Bytes of b a block of CosineSimilarityNxM keeps hot: half the 64 KiB L1 of the RK3588 big cores.
+const size_t kBlockBytes = 32 * 1024;
+
+#ifdef GALLERY_COSINE_NEON
+
+inline float32x4_t MultiplyAdd(float32x4_t acc, float32x4_t a, float32x4_t b) {
+#if defined(__aarch64__)
+    return vfmaq_f32(acc, a, b);
+#else
+    return vmlaq_f32(acc, a, b);
+#endif
+}
+
+inline float HorizontalSum(float32x4_t v) {
+#if defined(__aarch64__)
+    return vaddvq_f32(v);
+#else
+    float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#endif
+}
+
+#endif
+
+// Scores q against four rows.
+void Dot1x4(const float* q, const float* const rows[4], size_t dim, float* out) {
+    size_t i = 0;
+#ifdef GALLERY_COSINE_NEON
+    float32x4_t acc[4] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    for (; i + 4 <= dim; i += 4) {
+        const float32x4_t qv = vld1q_f32(q + i);
+        for (int r = 0; r < 4; ++r) {
+            acc[r] = MultiplyAdd(acc[r], qv, vld1q_f32(rows[r] + i));
+        }
+    }
+    for (int r = 0; r < 4; ++r) {
+        out[r] = HorizontalSum(acc[r]);
+    }
+#else
+    for (int r = 0; r < 4; ++r) {
+        out[r] = 0.0f;
+    }
+#endif
+    for (; i < dim; ++i) {
+        for (int r = 0; r < 4; ++r) {
+            out[r] += q[i] * rows[r][i];
+        }
+    }
+}
+
+// Scores four rows of a against four rows of b; out[r * out_stride + c] = a[r] . b[c].
+void Dot4x4(const float* const a[4], const float* const b[4], size_t dim, float* out, size_t out_stride) {
+    float sums[4][4];
+    size_t i = 0;
+#ifdef GALLERY_COSINE_NEON
+    // 16 accumulators + 8 operands fit the 32 NEON registers of AArch64.
+    float32x4_t acc[4][4];
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            acc[r][c] = vdupq_n_f32(0.0f);
+        }
+    }
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t bv[4];
+        for (int c = 0; c < 4; ++c) {
+            bv[c] = vld1q_f32(b[c] + i);
+        }
+        for (int r = 0; r < 4; ++r) {
+            const float32x4_t av = vld1q_f32(a[r] + i);
+            for (int c = 0; c < 4; ++c) {
+                acc[r][c] = MultiplyAdd(acc[r][c], av, bv[c]);
+            }
+        }
+    }
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            sums[r][c] = HorizontalSum(acc[r][c]);
+        }
+    }
+#else
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            sums[r][c] = 0.0f;
+        }
+    }
+#endif
+    for (; i < dim; ++i) {
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                sums[r][c] += a[r][i] * b[c][i];
+            }
+        }
+    }
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            out[r * out_stride + c] = sums[r][c];
+        }
+    }
+}
+
+float InverseNorm(const float* v, size_t dim) {
+    const float norm = std::sqrt(DotProduct(v, v, dim));
+    return norm > 0.0f ? 1.0f / norm : 0.0f;
+}
+
+// Scores rows of a against the block of b rows [b_begin, b_end).
+void ScoreBlock(const float* a, size_t a_count, size_t a_stride, const float* b, size_t b_begin, size_t b_end, size_t b_stride, size_t dim,
+                float* scores, size_t scores_stride) {
+    size_t row = 0;
+    for (; row + 4 <= a_count; row += 4) {
+        const float* a_tile[4] = {a + row * a_stride, a + (row + 1) * a_stride, a + (row + 2) * a_stride, a + (row + 3) * a_stride};
+        size_t col = b_begin;
+        for (; col + 4 <= b_end; col += 4) {
+            const float* b_tile[4] = {b + col * b_stride, b + (col + 1) * b_stride, b + (col + 2) * b_stride, b + (col + 3) * b_stride};
+            Dot4x4(a_tile, b_tile, dim, scores + row * scores_stride + col, scores_stride);
+        }
+        for (; col < b_end; ++col) {
+            for (int r = 0; r < 4; ++r) {
+                scores[(row + r) * scores_stride + col] = DotProduct(a_tile[r], b + col * b_stride, dim);
+            }
+        }
+    }
+    for (; row < a_count; ++row) {
+        CosineSimilarity1xN(a + row * a_stride, b + b_begin * b_stride, b_end - b_begin, dim, b_stride, true,
+                            scores + row * scores_stride + b_begin);
+    }
+}
+
+}  // namespace
+
+float DotProduct(const float* a, const float* b, size_t dim) {
+    size_t i = 0;
+    float sum = 0.0f;
+#ifdef GALLERY_COSINE_NEON
+    // Two accumulators hide the latency of the dependent multiply-adds.
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = MultiplyAdd(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = MultiplyAdd(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    sum = HorizontalSum(vaddq_f32(acc0, acc1));
+#endif
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void CosineSimilarity1xN(const float* query, const float* rows, size_t count, size_t dim, size_t stride, bool normalized, float* scores) {
+    size_t row = 0;
+    for (; row + 4 <= count; row += 4) {
+        const float* tile[4] = {rows + row * stride, rows + (row + 1) * stride, rows + (row + 2) * stride, rows + (row + 3) * stride};
+        Dot1x4(query, tile, dim, scores + row);
+    }
+    for (; row < count; ++row) {
+        scores[row] = DotProduct(query, rows + row * stride, dim);
+    }
+    if (!normalized) {
+        const float query_scale = InverseNorm(query, dim);
+        for (row = 0; row < count; ++row) {
+            scores[row] *= query_scale * InverseNorm(rows + row * stride, dim);
+        }
+    }
+}
+
+void CosineSimilarityNxM(const float* a, size_t a_count, size_t a_stride, const float* b, size_t b_count, size_t b_stride, size_t dim,
+                         bool normalized, float* scores) {
+    // A multiple of the tile width, so only the last block has a ragged edge.
+    const size_t block = std::max<size_t>(4, kBlockBytes / (std::max<size_t>(dim, 1) * sizeof(float)) / 4 * 4);
+    for (size_t begin = 0; begin < b_count; begin += block) {
+        ScoreBlock(a, a_count, a_stride, b, begin, std::min(b_count, begin + block), b_stride, dim, scores, b_count);
+    }
+    if (!normalized) {
+        // Scale rows by the norms of a, then columns by the norms of b; no scratch needed.
+        for (size_t row = 0; row < a_count; ++row) {
+            const float scale = InverseNorm(a + row * a_stride, dim);
+            for (size_t col = 0; col < b_count; ++col) {
+                scores[row * b_count + col] *= scale;
+            }
+        }
+        for (size_t col = 0; col < b_count; ++col) {
+            const float scale = InverseNorm(b + col * b_stride, dim);
+            for (size_t row = 0; row < a_count; ++row) {
+                scores[row * b_count + col] *= scale;
+            }
+        }
+    }
+}
+
+}  // namespace gallery
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef GALLERY_COSINE_SIMILARITY_H
+#define GALLERY_COSINE_SIMILARITY_H
+
+#include <cstddef>
+
+namespace gallery {
+
+/**
+ * @brief Dot product of two vectors of dim floats.
+ */
+float DotProduct(const float* a, const float* b, size_t dim);
+
+/**
+ * @brief Cosine similarity of one query against count rows.
+ *
+ * Rows are scored four at a time so each load of the query feeds four accumulators
+ * (NEON on ARM, a scalar tile elsewhere).
+ *
+ * @param query Query of dim floats.
+ * @param rows First row; row i starts at rows + i * stride.
+ * @param count Number of rows.
+ * @param dim Embedding dimension.
+ * @param stride Distance between consecutive rows in floats, at least dim.
+ * @param normalized Query and rows are already unit length; skips the norms.
+ * @param scores Caller buffer of count scores.
+ */
+void CosineSimilarity1xN(const float* query, const float* rows, size_t count, size_t dim, size_t stride, bool normalized, float* scores);
+
+/**
+ * @brief Cosine similarity of every row of a against every row of b.
+ *
+ * Rows of b are processed in blocks that stay in the L1 cache while every row of a is
+ * scored against them, in 4x4 register tiles.
+ *
+ * @param a First row of a; row i starts at a + i * a_stride.
+ * @param a_count Number of rows of a.
+ * @param a_stride Distance between consecutive rows of a in floats, at least dim.
+ * @param b First row of b; row j starts at b + j * b_stride.
+ * @param b_count Number of rows of b.
+ * @param b_stride Distance between consecutive rows of b in floats, at least dim.
+ * @param dim Embedding dimension.
+ * @param normalized All rows are already unit length; skips the norms.
+ * @param scores Caller buffer of a_count x b_count scores, row-major.
+ */
+void CosineSimilarityNxM(const float* a, size_t a_count, size_t a_stride, const float* b, size_t b_count, size_t b_stride, size_t dim,
+                         bool normalized, float* scores);
+
+}  // namespace gallery
+
+#endif  // GALLERY_COSINE_SIMILARITY_H
@@ -0,0 +1,93 @@
+#include "directory_walker.h"
+
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <inspireface/herror.h>
+
+namespace gallery {
+
+bool DirectoryWalker::IsImageFile(const std::string& name) {
+    const size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp";
+}
+
+bool DirectoryWalker::ReadFrame(Frame& frame) {
+    DIR* dir = opendir(frame.path.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        bool directory = entry->d_type == DT_DIR;
+        bool file = entry->d_type == DT_REG;
+        bool link = entry->d_type == DT_LNK;
+        const std::string full_path = frame.path + "/" + name;
+        struct stat info;
+        if (entry->d_type == DT_UNKNOWN && lstat(full_path.c_str(), &info) == 0) {
+            // Some file systems leave d_type unset
+            directory = S_ISDIR(info.st_mode);
+            file = S_ISREG(info.st_mode);
+            link = S_ISLNK(info.st_mode);
+        }
+        if (link) {
+            // Links are followed to files only
+            file = stat(full_path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+        }
+        if (directory || (file && IsImageFile(name))) {
+            frame.entries.push_back(Entry{name, directory});
+        }
+    }
+    closedir(dir);
+    std::sort(frame.entries.begin(), frame.entries.end());
+    return true;
+}
+
+int32_t DirectoryWalker::Open(const std::string& root) {
+    stack_.clear();
+    skipped_ = 0;
+    Frame frame;
+    frame.path = root;
+    if (!ReadFrame(frame)) {
+        return HERR_INVALID_PARAM;
+    }
+    stack_.push_back(std::move(frame));
+    return HSUCCEED;
+}
+
+bool DirectoryWalker::Next(std::string& path, std::string& folder) {
+    while (!stack_.empty()) {
+        Frame& top = stack_.back();
+        if (top.next == top.entries.size()) {
+            stack_.pop_back();
+            continue;
+        }
+        const Entry& entry = top.entries[top.next++];
+        if (!entry.directory) {
+            path = top.path + "/" + entry.name;
+            folder = top.folder;
+            return true;
+        }
+        Frame child;
+        child.path = top.path + "/" + entry.name;
+        child.folder = top.folder.empty() ? entry.name : top.folder + "/" + entry.name;
+        if (ReadFrame(child)) {
+            stack_.push_back(std::move(child));
+        } else {
+            ++skipped_;
+        }
+    }
+    return false;
+}
+
+}  // namespace gallery
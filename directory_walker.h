@@ -0,0 +1,76 @@
+#pragma once
+#ifndef GALLERY_DIRECTORY_WALKER_H
+#define GALLERY_DIRECTORY_WALKER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @class DirectoryWalker
+ * @brief Lists the image files under a directory tree one at a time.
+ *
+ * The tree is walked depth first with the entries of each directory in name order, so the
+ * same tree always yields the same sequence. Only the directories on the current path are
+ * held in memory, so memory is bounded by the largest directory and the depth of the tree,
+ * not by the number of files, and the first file is returned as soon as its directory has
+ * been read. Symbolic links to directories are not followed, which rules out cycles.
+ */
+class DirectoryWalker {
+public:
+    /**
+     * @brief Starts a walk at root.
+     * @return int32_t Status code; HERR_INVALID_PARAM if root cannot be opened.
+     */
+    int32_t Open(const std::string& root);
+
+    /**
+     * @brief Returns the next image file.
+     * @param path Output path of the file, below the root.
+     * @param folder Output path of its directory relative to the root; empty for files directly in it.
+     * @return false once the tree is exhausted.
+     */
+    bool Next(std::string& path, std::string& folder);
+
+    /**
+     * @brief Number of subdirectories that could not be opened and were skipped.
+     */
+    size_t SkippedDirectories() const {
+        return skipped_;
+    }
+
+    /**
+     * @brief Checks the extension of a file name (jpg, jpeg, png or bmp, any case).
+     */
+    static bool IsImageFile(const std::string& name);
+
+private:
+    struct Entry {
+        std::string name;
+        bool directory;
+
+        bool operator<(const Entry& other) const {
+            return name < other.name;
+        }
+    };
+
+    // One open directory on the current path.
+    struct Frame {
+        std::string path;    ///< Path on disk
+        std::string folder;  ///< Path relative to the root
+        std::vector<Entry> entries;
+        size_t next = 0;
+    };
+
+    // Reads and sorts the entries of a directory; false if it cannot be opened.
+    static bool ReadFrame(Frame& frame);
+
+    std::vector<Frame> stack_;
+    size_t skipped_ = 0;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_DIRECTORY_WALKER_H
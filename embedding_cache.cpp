@@ -0,0 +1,236 @@
+#include "embedding_cache.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <inspireface/herror.h>
+#include <inspireface/meta.h>
+#include "gallery_snapshot.h"
+
+namespace gallery {
+
+namespace {
+
+const char kCacheMagic[8] = {'I', 'F', 'E', 'M', 'B', 'C', 'A', 'C'};
+const uint32_t kRecordMagic = 0x43424D45;  // "EMBC"
+// Upper bound on the embedding dimension, rejects garbage headers.
+const uint32_t kMaxRecordDim = 65536;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t dim;
+    uint64_t key;
+    uint64_t checksum;  ///< Checksum64 of the fields above and the payload
+};
+
+uint64_t RecordChecksum(const RecordHeader& header, const float* payload) {
+    return Checksum64(payload, header.dim * sizeof(float), Checksum64(&header, offsetof(RecordHeader, checksum)));
+}
+
+bool PreadAll(int fd, void* data, size_t size, uint64_t offset) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t done = pread(fd, bytes, size, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+bool PwriteAll(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t done = pwrite(fd, bytes, size, static_cast<off_t>(offset));
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+}  // namespace
+
+uint64_t ModelFingerprint(const std::string& model_path) {
+    // The backend is part of it: the same pack gives slightly different embeddings on the NPU and the CPU.
+    const inspire::SDKInfo& info = inspire::GetSDKInfo();
+    const std::string sdk = info.GetVersionString() + " " + info.series + " " + info.inference_backend;
+    uint64_t hash = Checksum64(sdk.data(), sdk.size());
+    int fd = open(model_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    std::vector<char> chunk(1 << 20);
+    while (true) {
+        ssize_t done = read(fd, chunk.data(), chunk.size());
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done < 0) {
+            close(fd);
+            return 0;
+        }
+        if (done == 0) {
+            break;
+        }
+        hash = Checksum64(chunk.data(), static_cast<size_t>(done), hash);
+    }
+    close(fd);
+    return hash != 0 ? hash : 1;
+}
+
+EmbeddingCache::~EmbeddingCache() {
+    Close();
+}
+
+int32_t EmbeddingCache::Open(const std::string& path, uint64_t model) {
+    Close();
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_ = model;
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    struct stat info;
+    if (fstat(fd_, &info) != 0) {
+        close(fd_);
+        fd_ = -1;
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    const uint64_t size = static_cast<uint64_t>(info.st_size);
+    FileHeader file_header;
+    if (size == 0) {
+        std::memset(&file_header, 0, sizeof(file_header));
+        std::memcpy(file_header.magic, kCacheMagic, sizeof(kCacheMagic));
+        file_header.version = 1;
+        if (!PwriteAll(fd_, &file_header, sizeof(file_header), 0)) {
+            close(fd_);
+            fd_ = -1;
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        end_ = sizeof(file_header);
+        return HSUCCEED;
+    }
+    if (!PreadAll(fd_, &file_header, sizeof(file_header), 0) || std::memcmp(file_header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+        file_header.version != 1) {
+        close(fd_);
+        fd_ = -1;
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    // Only the record headers are read here; a payload is checked against its checksum when it is used.
+    uint64_t offset = sizeof(file_header);
+    while (offset + sizeof(RecordHeader) <= size) {
+        RecordHeader header;
+        if (!PreadAll(fd_, &header, sizeof(header), offset) || header.magic != kRecordMagic || header.dim > kMaxRecordDim ||
+            offset + sizeof(header) + header.dim * sizeof(float) > size) {
+            break;
+        }
+        slots_[header.key] = Slot{offset + sizeof(header), header.dim};
+        offset += sizeof(header) + header.dim * sizeof(float);
+    }
+    // Drop a record cut short by a crash, so new records do not follow garbage.
+    if (offset < size && ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+        close(fd_);
+        fd_ = -1;
+        slots_.clear();
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    end_ = offset;
+    return HSUCCEED;
+}
+
+void EmbeddingCache::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    slots_.clear();
+    end_ = 0;
+}
+
+uint64_t EmbeddingCache::Key(const inspirecv::Image& crop) const {
+    const int32_t shape[3] = {crop.Width(), crop.Height(), crop.Channels()};
+    const size_t size = static_cast<size_t>(shape[0]) * shape[1] * shape[2];
+    return Checksum64(crop.Data(), size, Checksum64(shape, sizeof(shape), model_));
+}
+
+bool EmbeddingCache::Find(uint64_t key, std::vector<float>& embedding) const {
+    Slot slot;
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = slots_.find(key);
+        if (fd_ < 0 || it == slots_.end()) {
+            return false;
+        }
+        slot = it->second;
+        fd = fd_;
+    }
+    // pread needs no lock; records are never rewritten once they are in the map.
+    RecordHeader header;
+    std::vector<float> payload(slot.dim);
+    if (!PreadAll(fd, &header, sizeof(header), slot.offset - sizeof(header)) ||
+        !PreadAll(fd, payload.data(), payload.size() * sizeof(float), slot.offset) || header.key != key || header.dim != slot.dim ||
+        header.checksum != RecordChecksum(header, payload.data())) {
+        return false;
+    }
+    embedding.swap(payload);
+    return true;
+}
+
+int32_t EmbeddingCache::Insert(uint64_t key, const std::vector<float>& embedding) {
+    if (embedding.empty() || embedding.size() > kMaxRecordDim) {
+        return HERR_INVALID_PARAM;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    if (slots_.count(key) != 0) {
+        return HSUCCEED;
+    }
+    RecordHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kRecordMagic;
+    header.dim = static_cast<uint32_t>(embedding.size());
+    header.key = key;
+    header.checksum = RecordChecksum(header, embedding.data());
+    std::vector<char> record(sizeof(header) + header.dim * sizeof(float));
+    std::memcpy(record.data(), &header, sizeof(header));
+    std::memcpy(record.data() + sizeof(header), embedding.data(), header.dim * sizeof(float));
+    if (!PwriteAll(fd_, record.data(), record.size(), end_)) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    slots_[key] = Slot{end_ + sizeof(header), header.dim};
+    end_ += record.size();
+    return HSUCCEED;
+}
+
+size_t EmbeddingCache::Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slots_.size();
+}
+
+}  // namespace gallery
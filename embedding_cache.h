@@ -0,0 +1,86 @@
+#pragma once
+#ifndef GALLERY_EMBEDDING_CACHE_H
+#define GALLERY_EMBEDDING_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <inspirecv/inspirecv.h>
+
+namespace gallery {
+
+/**
+ * @brief Identifies the recognition model: the SDK version and the content of the model pack.
+ *
+ * Embeddings of different models are not comparable, so it is part of every cache key.
+ * @return 0 if the model pack cannot be read.
+ */
+uint64_t ModelFingerprint(const std::string& model_path);
+
+/**
+ * @class EmbeddingCache
+ * @brief Persistent map from aligned face crops to the embeddings extracted from them.
+ *
+ * The key is a hash of the crop pixels and the model fingerprint, so re-enrolling the same
+ * images (into a new gallery, a store, or after a schema change) finds every embedding
+ * without running the recognition model, while a different model never hits. Only the keys
+ * and file offsets are kept in memory; an embedding is read from the file on a hit.
+ *
+ * The file is a header followed by append-only records, each with its own checksum. A record
+ * cut short by a crash is dropped, together with anything after it, when the cache is next
+ * opened. The methods may be called from several threads.
+ */
+class EmbeddingCache {
+public:
+    EmbeddingCache() = default;
+    ~EmbeddingCache();
+
+    EmbeddingCache(const EmbeddingCache&) = delete;
+    EmbeddingCache& operator=(const EmbeddingCache&) = delete;
+
+    /**
+     * @brief Opens or creates a cache file for one model.
+     * @param model Fingerprint of the model, from ModelFingerprint.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED if the file is not a cache.
+     */
+    int32_t Open(const std::string& path, uint64_t model);
+
+    void Close();
+
+    /**
+     * @brief Key of an aligned face crop under the model of this cache.
+     */
+    uint64_t Key(const inspirecv::Image& crop) const;
+
+    /**
+     * @brief Looks up the embedding of a key.
+     * @return false on a miss, or if the record cannot be read back.
+     */
+    bool Find(uint64_t key, std::vector<float>& embedding) const;
+
+    /**
+     * @brief Appends the embedding of a key; a key already present is kept as it is.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Insert(uint64_t key, const std::vector<float>& embedding);
+
+    size_t Size() const;
+
+private:
+    struct Slot {
+        uint64_t offset;  ///< File offset of the embedding
+        uint32_t dim;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Slot> slots_;
+    int fd_ = -1;
+    uint64_t end_ = 0;  ///< File size, where the next record goes
+    uint64_t model_ = 0;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_EMBEDDING_CACHE_H
@@ -0,0 +1,180 @@
+#include "enrollment_manifest.h"
+
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <inspireface/herror.h>
+
+namespace gallery {
+
+namespace {
+
+bool WriteEntry(std::FILE* file, const std::string& path, const ManifestEntry& entry) {
+    return std::fprintf(file, "+ %lld %llu %lld %llu %s\n", static_cast<long long>(entry.id), static_cast<unsigned long long>(entry.size),
+                        static_cast<long long>(entry.mtime), static_cast<unsigned long long>(entry.hash), path.c_str()) > 0;
+}
+
+bool SyncFile(std::FILE* file) {
+    return std::fflush(file) == 0 && fdatasync(fileno(file)) == 0;
+}
+
+}  // namespace
+
+EnrollmentManifest::~EnrollmentManifest() {
+    if (journal_ != nullptr) {
+        std::fclose(journal_);
+    }
+}
+
+int32_t EnrollmentManifest::Open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_ != nullptr) {
+        std::fclose(journal_);
+        journal_ = nullptr;
+    }
+    items_.clear();
+    path_ = path;
+    std::ifstream file(path);
+    std::streamoff complete = 0;  // End of the last complete line
+    if (file.is_open()) {
+        std::string line;
+        while (std::getline(file, line)) {
+            if (file.eof()) {
+                break;  // No line break: the write of this line was cut short
+            }
+            std::istringstream fields(line);
+            char op = 0;
+            ManifestEntry entry;
+            fields >> op;
+            if (op == '+') {
+                fields >> entry.id >> entry.size >> entry.mtime >> entry.hash;
+            }
+            std::string name;
+            if (!fields || fields.get() != ' ' || !std::getline(fields, name) || name.empty() || (op != '+' && op != '-')) {
+                return HERR_INVALID_SERIALIZATION_FAILED;
+            }
+            if (op == '+') {
+                items_[name] = Item{entry, false};
+            } else {
+                items_.erase(name);
+            }
+            complete = file.tellg();
+        }
+    }
+    journal_ = std::fopen(path.c_str(), "a");
+    if (journal_ == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    // Drop a line cut short by a crash, so the next record does not continue it.
+    std::fseek(journal_, 0, SEEK_END);
+    if (std::ftell(journal_) > complete && ftruncate(fileno(journal_), static_cast<off_t>(complete)) != 0) {
+        std::fclose(journal_);
+        journal_ = nullptr;
+        items_.clear();
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+int32_t EnrollmentManifest::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_ == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    int32_t ret = Compact();
+    std::fclose(journal_);
+    journal_ = nullptr;
+    return ret;
+}
+
+int32_t EnrollmentManifest::Compact() {
+    const std::string temp_path = path_ + ".tmp";
+    std::FILE* file = std::fopen(temp_path.c_str(), "w");
+    if (file == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    bool ok = true;
+    for (const auto& item : items_) {
+        ok = ok && WriteEntry(file, item.first, item.second.entry);
+    }
+    ok = SyncFile(file) && ok;
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    // The old journal was replaced; later appends go to the compacted file.
+    std::fclose(journal_);
+    journal_ = std::fopen(path_.c_str(), "a");
+    return journal_ != nullptr ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+bool EnrollmentManifest::Visit(const std::string& path, uint64_t size, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = items_.find(path);
+    if (it == items_.end()) {
+        return false;
+    }
+    it->second.visited = true;
+    return it->second.entry.size == size && it->second.entry.mtime == mtime;
+}
+
+bool EnrollmentManifest::Find(const std::string& path, ManifestEntry& entry) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = items_.find(path);
+    if (it == items_.end()) {
+        return false;
+    }
+    entry = it->second.entry;
+    return true;
+}
+
+int32_t EnrollmentManifest::Record(const std::string& path, const ManifestEntry& entry) {
+    if (path.empty() || path.find('\n') != std::string::npos) {
+        return HERR_INVALID_PARAM;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_ == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    items_[path] = Item{entry, true};
+    return WriteEntry(journal_, path, entry) ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+int32_t EnrollmentManifest::Erase(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_ == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    if (items_.erase(path) == 0) {
+        return HSUCCEED;
+    }
+    return std::fprintf(journal_, "- %s\n", path.c_str()) > 0 ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+int32_t EnrollmentManifest::Checkpoint() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_ == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    return SyncFile(journal_) ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+std::vector<std::pair<std::string, ManifestEntry>> EnrollmentManifest::Unvisited(const std::string& directory) const {
+    const std::string prefix = directory + "/";
+    std::vector<std::pair<std::string, ManifestEntry>> result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& item : items_) {
+        if (!item.second.visited && item.first.compare(0, prefix.size(), prefix) == 0) {
+            result.emplace_back(item.first, item.second.entry);
+        }
+    }
+    return result;
+}
+
+size_t EnrollmentManifest::Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+}
+
+}  // namespace gallery
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef GALLERY_ENROLLMENT_MANIFEST_H
+#define GALLERY_ENROLLMENT_MANIFEST_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @struct ManifestEntry
+ * @brief What an earlier enrollment run made of one image file.
+ */
+struct ManifestEntry {
+    int64_t id = -1;    ///< Feature enrolled from the file, or -1 if it yielded none (no face, or a skipped duplicate)
+    uint64_t size = 0;  ///< File size in bytes
+    int64_t mtime = 0;  ///< Modification time in nanoseconds
+    uint64_t hash = 0;  ///< Checksum64 of the content
+};
+
+/**
+ * @class EnrollmentManifest
+ * @brief Remembers which image files have been enrolled, so a rerun only processes changes.
+ *
+ * The manifest is a text journal of "+ id size mtime hash path" and "- path" lines, the last
+ * line of a path winning. Record and Erase append to it and Checkpoint makes the appended
+ * lines durable, so a run that is interrupted resumes from its last checkpoint. A partial
+ * last line, left by a crash in the middle of a write, is dropped when the journal is opened.
+ * Close rewrites the journal with one line per file.
+ *
+ * A file whose size and modification time match its entry is unchanged without being read;
+ * one whose content hash matches despite a new modification time (a copy, a touch) is
+ * unchanged without being decoded. The methods may be called from several threads.
+ */
+class EnrollmentManifest {
+public:
+    EnrollmentManifest() = default;
+    ~EnrollmentManifest();
+
+    EnrollmentManifest(const EnrollmentManifest&) = delete;
+    EnrollmentManifest& operator=(const EnrollmentManifest&) = delete;
+
+    /**
+     * @brief Loads a manifest, or starts an empty one if the file is missing, and opens it for appending.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED on a malformed line.
+     */
+    int32_t Open(const std::string& path);
+
+    /**
+     * @brief Compacts the journal and closes it.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Close();
+
+    /**
+     * @brief Marks a file as still present and checks it against its entry.
+     * @return true if the file has an entry with this size and modification time.
+     */
+    bool Visit(const std::string& path, uint64_t size, int64_t mtime);
+
+    /**
+     * @brief Looks up the entry of a file.
+     * @return false if the file has none.
+     */
+    bool Find(const std::string& path, ManifestEntry& entry) const;
+
+    /**
+     * @brief Sets the entry of a file.
+     * @return int32_t Status code; HERR_INVALID_PARAM for a path with a line break.
+     */
+    int32_t Record(const std::string& path, const ManifestEntry& entry);
+
+    /**
+     * @brief Removes the entry of a file.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Erase(const std::string& path);
+
+    /**
+     * @brief Makes every line appended so far durable.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Checkpoint();
+
+    /**
+     * @brief Entries below a directory that Visit has not seen since Open, i.e. of files deleted since the last run.
+     */
+    std::vector<std::pair<std::string, ManifestEntry>> Unvisited(const std::string& directory) const;
+
+    size_t Size() const;
+
+private:
+    struct Item {
+        ManifestEntry entry;
+        bool visited;
+    };
+
+    // Writes one line per entry to a temporary file and moves it over the journal.
+    int32_t Compact();
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Item> items_;
+    std::string path_;
+    std::FILE* journal_ = nullptr;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_ENROLLMENT_MANIFEST_H
@@ -0,0 +1,495 @@
+#include "enrollment_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <opencv2/opencv.hpp>
+#include <inspirecv/inspirecv.h>
+#include <inspireface/herror.h>
+#include "gallery_snapshot.h"
+
+namespace gallery {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double Seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+struct DecodedImage {
+    size_t index;
+    EnrollmentResult result;            ///< Path and label; the worker fills in the rest
+    cv::Mat image;
+    int32_t scale;                      ///< DCT scale image was decoded at
+    std::vector<unsigned char> buffer;  ///< File content of a reduced decode, for decoding it again at full size
+};
+
+// State shared by the threads of one Run; every field below source_mutex is guarded by mutex.
+struct RunState {
+    const EnrollmentPipeline::Source* source = nullptr;
+    const EnrollmentPipeline::Screen* screen = nullptr;
+    const EnrollmentConfiguration* config = nullptr;
+    EmbeddingCache* cache = nullptr;
+    size_t window = 0;
+    std::mutex source_mutex;             ///< Serializes the source calls and the numbering of their files
+    std::mutex mutex;
+    std::condition_variable input_cv;    ///< A decoder may pull the next file
+    std::condition_variable decoded_cv;  ///< A decoded image is waiting, or the decoders are done
+    std::condition_variable result_cv;   ///< The next result for the sink may be ready, or the input is done
+    size_t next_input = 0;               ///< Files pulled from the source
+    bool input_done = false;             ///< The source is exhausted
+    size_t sunk = 0;                     ///< Results handed to the sink
+    int32_t decoders_running = 0;
+    std::deque<DecodedImage> decoded;
+    std::map<size_t, EnrollmentResult> results;  ///< Finished out of order, waiting for the sink
+    Clock::duration decode_busy = Clock::duration::zero();
+    Clock::duration extract_busy = Clock::duration::zero();
+    size_t reduced_decodes = 0;
+    size_t full_redecodes = 0;
+    size_t cache_hits = 0;
+};
+
+// Reads a whole file into buffer and fills in its size, modification time and hash.
+bool ReadImageFile(EnrollmentResult& result, std::vector<unsigned char>& buffer) {
+    const int fd = open(result.path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    if (ok) {
+        buffer.resize(static_cast<size_t>(info.st_size));
+        size_t done = 0;
+        while (done < buffer.size()) {
+            const ssize_t n = read(fd, buffer.data() + done, buffer.size() - done);
+            if (n <= 0) {
+                break;  // A file truncated under us is a read failure, not a short image
+            }
+            done += static_cast<size_t>(n);
+        }
+        ok = done == buffer.size();
+    }
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+    result.file_size = buffer.size();
+    result.file_mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    result.content_hash = Checksum64(buffer.data(), buffer.size());
+    return true;
+}
+
+// Reads the dimensions from the frame header of a JPEG; false for other formats.
+bool ReadJpegSize(const std::vector<unsigned char>& buffer, int32_t& width, int32_t& height) {
+    const size_t size = buffer.size();
+    if (size < 4 || buffer[0] != 0xFF || buffer[1] != 0xD8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (buffer[pos] != 0xFF) {
+            return false;
+        }
+        const unsigned char marker = buffer[pos + 1];
+        if (marker == 0xFF) {
+            ++pos;  // Fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;  // Markers without a segment
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;  // Scan data before any frame header
+        }
+        const size_t length = (static_cast<size_t>(buffer[pos + 2]) << 8) | buffer[pos + 3];
+        // SOF0 to SOF15, except DHT (C4), JPG (C8) and DAC (CC), which share the range
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (length < 7 || pos + 9 > size) {
+                return false;
+            }
+            height = (buffer[pos + 5] << 8) | buffer[pos + 6];
+            width = (buffer[pos + 7] << 8) | buffer[pos + 8];
+            return width > 0 && height > 0;
+        }
+        if (length < 2) {
+            return false;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// The coarsest DCT scale that keeps the shorter side of the image at least min_side.
+int32_t ChooseDecodeScale(const std::vector<unsigned char>& buffer, int32_t min_side) {
+    int32_t width = 0;
+    int32_t height = 0;
+    if (!ReadJpegSize(buffer, width, height)) {
+        return 1;
+    }
+    const int32_t shorter = std::min(width, height);
+    int32_t scale = 8;
+    while (scale > 1 && shorter / scale < min_side) {
+        scale /= 2;
+    }
+    return scale;
+}
+
+cv::Mat DecodeImage(const std::vector<unsigned char>& buffer, int32_t scale) {
+    if (buffer.empty()) {
+        return cv::Mat();
+    }
+    int flags = cv::IMREAD_COLOR;
+    if (scale == 2) {
+        flags = cv::IMREAD_REDUCED_COLOR_2;
+    } else if (scale == 4) {
+        flags = cv::IMREAD_REDUCED_COLOR_4;
+    } else if (scale == 8) {
+        flags = cv::IMREAD_REDUCED_COLOR_8;
+    }
+    try {
+        return cv::imdecode(buffer, flags);
+    } catch (const cv::Exception&) {
+        return cv::Mat();  // A corrupt file is reported like an undecodable one
+    }
+}
+
+void DecoderLoop(RunState& state) {
+    Clock::duration busy = Clock::duration::zero();
+    // The file is read once, for the hash and the decoder; the buffer is reused across files.
+    std::vector<unsigned char> buffer;
+    while (true) {
+        EnrollmentResult result;
+        size_t index = 0;
+        {
+            // Holding source_mutex across the pull keeps the numbering in source order.
+            std::lock_guard<std::mutex> source_lock(state.source_mutex);
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.input_cv.wait(lock, [&state] { return state.input_done || state.next_input < state.sunk + state.window; });
+                if (state.input_done) {
+                    break;
+                }
+            }
+            const Clock::time_point start = Clock::now();
+            const bool more = (*state.source)(result.path, result.label);
+            busy += Clock::now() - start;
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!more) {
+                state.input_done = true;
+                state.input_cv.notify_all();
+                state.result_cv.notify_one();
+                break;
+            }
+            index = state.next_input++;
+        }
+        const Clock::time_point start = Clock::now();
+        cv::Mat image;
+        int32_t scale = 1;
+        if (!ReadImageFile(result, buffer)) {
+            result.status = ENROLL_READ_FAILED;
+        } else if (!*state.screen || !(*state.screen)(result)) {
+            if (state.config->decode_side > 0) {
+                // Never below what the detector is fed anyway
+                scale = ChooseDecodeScale(buffer, std::max(state.config->decode_side, state.config->detect_level));
+            }
+            image = DecodeImage(buffer, scale);
+            if (image.empty() && scale > 1) {
+                scale = 1;  // A header that promised more than the decoder delivered
+                image = DecodeImage(buffer, scale);
+            }
+            if (image.empty()) {
+                result.status = ENROLL_DECODE_FAILED;
+            }
+        }
+        busy += Clock::now() - start;
+        std::vector<unsigned char> content;
+        if (!image.empty() && scale > 1) {
+            content.swap(buffer);  // The worker may need it again; the next file gets a fresh buffer
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (image.empty()) {
+            state.results.emplace(index, std::move(result));
+            state.result_cv.notify_one();
+        } else {
+            state.reduced_decodes += scale > 1 ? 1 : 0;
+            state.decoded.push_back(DecodedImage{index, std::move(result), std::move(image), scale, std::move(content)});
+            state.decoded_cv.notify_one();
+        }
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.decode_busy += busy;
+    if (--state.decoders_running == 0) {
+        state.decoded_cv.notify_all();
+    }
+}
+
+inspirecv::FrameProcess WrapFrame(const cv::Mat& image) {
+    return inspirecv::FrameProcess::Create(image.data, image.rows, image.cols, inspirecv::BGR, inspirecv::ROTATION_0);
+}
+
+// Detects the faces of a frame and picks the one to enroll into face, filling in the face fields
+// of result. Returns false, with the status set, if there is none.
+bool DetectBestFace(inspire::Session& session, inspirecv::FrameProcess& process, int32_t scale, const EnrollmentConfiguration& config,
+                    EnrollmentResult& result, inspire::FaceTrackWrap& face) {
+    std::vector<inspire::FaceTrackWrap> faces;
+    int32_t detect_result = session.FaceDetectAndTrack(process, faces);
+    if (detect_result != HSUCCEED) {
+        result.status = ENROLL_DETECT_FAILED;
+        result.error_code = detect_result;
+        return false;
+    }
+    result.face_count = faces.size();
+    if (faces.empty()) {
+        result.status = ENROLL_NO_FACE;
+        return false;
+    }
+    // Quality is a small model next to recognition, so every candidate gets it
+    inspire::CustomPipelineParameter quality_param;
+    quality_param.enable_face_quality = true;
+    std::vector<float> quality;
+    int32_t quality_result = session.MultipleFacePipelineProcess(process, quality_param, faces);
+    if (quality_result == HSUCCEED) {
+        quality = session.GetFaceQualityConfidence();
+    }
+    if (config.min_quality > 0.0f && quality.size() < faces.size()) {
+        // An unmeasured face must not pass the quality bar
+        result.status = ENROLL_QUALITY_FAILED;
+        result.error_code = quality_result;
+        return false;
+    }
+    int32_t largest = 1;
+    for (const auto& candidate : faces) {
+        largest = std::max(largest, std::min(candidate.rect.width, candidate.rect.height));
+    }
+    // Size relative to the largest face, times frontalness, times quality; the product favours
+    // the subject of the photo over a sharp but small face in the background.
+    size_t best = 0;
+    float best_score = -1.0f;
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const auto& candidate = faces[i];
+        const float side = static_cast<float>(std::min(candidate.rect.width, candidate.rect.height));
+        const float pose = std::max(std::abs(candidate.face3DAngle.yaw), std::abs(candidate.face3DAngle.pitch));
+        const float frontal = std::max(0.0f, 1.0f - pose / 90.0f);
+        const float score = side / largest * frontal * (i < quality.size() ? std::max(0.0f, std::min(1.0f, quality[i])) : 1.0f);
+        if (score > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    face = faces[best];
+    result.face_side = std::min(face.rect.width, face.rect.height) * scale;
+    result.quality = best < quality.size() ? quality[best] : 1.0f;
+    result.yaw = face.face3DAngle.yaw;
+    result.pitch = face.face3DAngle.pitch;
+    result.roll = face.face3DAngle.roll;
+    return true;
+}
+
+// Applies the enrollment bar to the picked face. Only that face is judged: a background face that
+// passes is never enrolled in place of a subject that fails.
+bool PassesBar(const EnrollmentConfiguration& config, EnrollmentResult& result) {
+    if (result.face_side < config.min_enroll_side) {
+        result.status = ENROLL_FACE_TOO_SMALL;
+    } else if (config.max_pose > 0.0f && std::max(std::abs(result.yaw), std::abs(result.pitch)) > config.max_pose) {
+        result.status = ENROLL_POSE_REJECTED;
+    } else if (result.quality < config.min_quality) {
+        result.status = ENROLL_LOW_QUALITY;
+    } else {
+        return true;
+    }
+    return false;
+}
+
+// Extracts the feature of face into result; sets cached to whether it came from cache.
+void ExtractFace(inspire::Session& session, inspirecv::FrameProcess& process, inspire::FaceTrackWrap& face, EmbeddingCache* cache,
+                 EnrollmentResult& result, bool& cached) {
+    cached = false;
+    inspire::FaceEmbedding feature;
+    int32_t extract_result;
+    if (cache != nullptr) {
+        // Aligning is cheap next to the recognition model, which a cached crop skips
+        inspirecv::Image crop;
+        session.GetFaceAlignmentImage(process, face, crop);
+        const uint64_t key = cache->Key(crop);
+        if (cache->Find(key, result.embedding)) {
+            result.status = ENROLL_OK;
+            cached = true;
+            return;
+        }
+        extract_result = session.FaceFeatureExtractWithAlignmentImage(crop, feature);
+        if (extract_result == HSUCCEED) {
+            cache->Insert(key, feature.embedding);
+        }
+    } else {
+        extract_result = session.FaceFeatureExtract(process, face, feature);
+    }
+    if (extract_result != HSUCCEED) {
+        result.status = ENROLL_EXTRACT_FAILED;
+        result.error_code = extract_result;
+        return;
+    }
+    result.status = ENROLL_OK;
+    result.embedding = std::move(feature.embedding);
+}
+
+void WorkerLoop(RunState& state, inspire::Session& session) {
+    Clock::duration busy = Clock::duration::zero();
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (true) {
+        state.decoded_cv.wait(lock, [&state] { return !state.decoded.empty() || state.decoders_running == 0; });
+        if (state.decoded.empty()) {
+            break;
+        }
+        DecodedImage item = std::move(state.decoded.front());
+        state.decoded.pop_front();
+        lock.unlock();
+        const Clock::time_point start = Clock::now();
+        const EnrollmentConfiguration& config = *state.config;
+        inspirecv::FrameProcess process = WrapFrame(item.image);
+        inspire::FaceTrackWrap face;
+        bool found = DetectBestFace(session, process, item.scale, config, item.result, face);
+        bool redecoded = false;
+        if (found && item.scale > 1 && item.result.face_side < config.min_face_side * item.scale &&
+            item.result.face_side >= config.min_enroll_side) {
+            // Too few pixels to align; the full resolution has scale times more across the face
+            cv::Mat full = DecodeImage(item.buffer, 1);
+            if (!full.empty()) {
+                item.image = full;
+                item.scale = 1;
+                process = WrapFrame(item.image);
+                found = DetectBestFace(session, process, item.scale, config, item.result, face);
+                redecoded = true;
+            }
+        }
+        bool cached = false;
+        if (found && PassesBar(config, item.result)) {
+            ExtractFace(session, process, face, state.cache, item.result, cached);
+        }
+        item.image.release();
+        item.buffer.clear();
+        busy += Clock::now() - start;
+        lock.lock();
+        state.full_redecodes += redecoded ? 1 : 0;
+        state.cache_hits += cached ? 1 : 0;
+        state.results.emplace(item.index, std::move(item.result));
+        state.result_cv.notify_one();
+    }
+    state.extract_busy += busy;
+}
+
+}  // namespace
+
+EnrollmentPipeline::EnrollmentPipeline(const EnrollmentConfiguration& config) : config_(config) {}
+
+int32_t EnrollmentPipeline::Initialize() {
+    sessions_.clear();
+    if (config_.decoders < 1 || config_.workers < 1) {
+        return HERR_INVALID_PARAM;
+    }
+    // Create session with face detection and recognition enabled
+    inspire::CustomPipelineParameter param;
+    param.enable_recognition = true;
+    param.enable_face_quality = true;
+    for (int32_t i = 0; i < config_.workers; ++i) {
+        std::shared_ptr<inspire::Session> session(
+            inspire::Session::CreatePtr(inspire::DETECT_MODE_ALWAYS_DETECT, std::max(1, config_.max_faces), param, config_.detect_level));
+        if (session == nullptr) {
+            sessions_.clear();
+            return HERR_SESS_PIPELINE_FAILURE;
+        }
+        sessions_.push_back(session);
+    }
+    return HSUCCEED;
+}
+
+int32_t EnrollmentPipeline::Run(const Source& source, const Sink& sink, EnrollmentStatistics* statistics) {
+    if (sessions_.empty()) {
+        return HERR_INVALID_PARAM;
+    }
+    const Clock::time_point start = Clock::now();
+    RunState state;
+    state.source = &source;
+    state.screen = &screen_;
+    state.config = &config_;
+    state.cache = cache_;
+    state.window = config_.window > 0 ? config_.window : 4 * static_cast<size_t>(config_.decoders + config_.workers);
+    state.decoders_running = config_.decoders;
+
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i < config_.decoders; ++i) {
+        threads.emplace_back(DecoderLoop, std::ref(state));
+    }
+    for (size_t i = 0; i < sessions_.size(); ++i) {
+        threads.emplace_back(WorkerLoop, std::ref(state), std::ref(*sessions_[i]));
+    }
+
+    // The calling thread is the single consumer, so results leave in input order.
+    Clock::duration sink_busy = Clock::duration::zero();
+    size_t enrolled = 0;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (true) {
+        const size_t index = state.sunk;
+        state.result_cv.wait(lock, [&state, index] { return state.results.count(index) != 0 || (state.input_done && index == state.next_input); });
+        std::map<size_t, EnrollmentResult>::iterator it = state.results.find(index);
+        if (it == state.results.end()) {
+            break;
+        }
+        EnrollmentResult result = std::move(it->second);
+        state.results.erase(it);
+        lock.unlock();
+        enrolled += result.status == ENROLL_OK ? 1 : 0;
+        const Clock::time_point sink_start = Clock::now();
+        sink(result);
+        sink_busy += Clock::now() - sink_start;
+        lock.lock();
+        ++state.sunk;
+        state.input_cv.notify_all();
+    }
+    const size_t images = state.sunk;
+    lock.unlock();
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    if (statistics != nullptr) {
+        statistics->images = images;
+        statistics->enrolled = enrolled;
+        statistics->wall_seconds = Seconds(Clock::now() - start);
+        statistics->decode_seconds = Seconds(state.decode_busy);
+        statistics->extract_seconds = Seconds(state.extract_busy);
+        statistics->sink_seconds = Seconds(sink_busy);
+        statistics->reduced_decodes = state.reduced_decodes;
+        statistics->full_redecodes = state.full_redecodes;
+        statistics->cache_hits = state.cache_hits;
+        statistics->decoders = config_.decoders;
+        statistics->workers = config_.workers;
+    }
+    return HSUCCEED;
+}
+
+int32_t EnrollmentPipeline::Run(const std::vector<std::string>& paths, const Sink& sink, EnrollmentStatistics* statistics) {
+    size_t next = 0;
+    auto source = [&paths, &next](std::string& path, std::string& label) {
+        if (next == paths.size()) {
+            return false;
+        }
+        path = paths[next++];
+        label.clear();
+        return true;
+    };
+    return Run(Source(source), sink, statistics);
+}
+
+}  // namespace gallery
@@ -0,0 +1,198 @@
+#pragma once
+#ifndef GALLERY_ENROLLMENT_PIPELINE_H
+#define GALLERY_ENROLLMENT_PIPELINE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <inspireface/inspireface.hpp>
+#include "embedding_cache.h"
+
+namespace gallery {
+
+/**
+ * @struct EnrollmentConfiguration
+ * @brief Thread counts and buffering of an EnrollmentPipeline.
+ */
+struct EnrollmentConfiguration {
+    int32_t decoders = 1;          ///< Threads decoding image files
+    int32_t workers = 1;           ///< Threads detecting faces and extracting features, each with its own Session
+    size_t window = 0;             ///< Images in flight between decoding and the sink; 0 means 4 per thread
+    int32_t detect_level = 320;    ///< Detector input size of the worker sessions
+    int32_t decode_side = 640;     ///< Shorter side a JPEG is at least decoded at when reduced; 0 always decodes at full size
+    int32_t min_face_side = 112;   ///< Faces found in a reduced decode smaller than this are redone at full size
+    int32_t max_faces = 8;         ///< Faces detected per image, of which the best is enrolled
+    int32_t min_enroll_side = 64;  ///< Faces smaller than this at full resolution are rejected
+    float max_pose = 30.0f;        ///< Faces turned further than this in yaw or pitch, in degrees, are rejected (0: no pose bar)
+    float min_quality = 0.5f;      ///< Faces below this quality confidence are rejected (0: no quality bar)
+};
+
+/**
+ * @brief Outcome of one image.
+ */
+enum EnrollmentStatus {
+    ENROLL_OK = 0,               ///< A feature was extracted from the best face
+    ENROLL_DECODE_FAILED = 1,    ///< The file was read but could not be decoded
+    ENROLL_DETECT_FAILED = 2,    ///< Face detection returned an error
+    ENROLL_NO_FACE = 3,          ///< No face was detected
+    ENROLL_EXTRACT_FAILED = 4,   ///< Feature extraction returned an error
+    ENROLL_SKIPPED = 5,          ///< The screen settled the file without extraction
+    ENROLL_READ_FAILED = 6,      ///< The file could not be read
+    ENROLL_FACE_TOO_SMALL = 7,   ///< The best face is smaller than min_enroll_side
+    ENROLL_POSE_REJECTED = 8,    ///< The best face is turned further than max_pose
+    ENROLL_LOW_QUALITY = 9,      ///< The quality of the best face is below min_quality
+    ENROLL_QUALITY_FAILED = 10,  ///< Quality scoring returned an error while min_quality is set
+};
+
+/**
+ * @struct EnrollmentResult
+ * @brief Feature extracted from one image, handed to the sink in input order.
+ */
+struct EnrollmentResult {
+    std::string path;             ///< Image file
+    std::string label;            ///< Label the source gave the file, such as its folder
+    uint64_t file_size = 0;       ///< Size of the file in bytes, once read
+    int64_t file_mtime = 0;       ///< Modification time of the file in nanoseconds, once read
+    uint64_t content_hash = 0;    ///< Checksum64 of the file content, once read
+    EnrollmentStatus status = ENROLL_OK;
+    int32_t error_code = 0;       ///< SDK error of ENROLL_DETECT_FAILED, ENROLL_QUALITY_FAILED and ENROLL_EXTRACT_FAILED
+    size_t face_count = 0;        ///< Faces detected in the image
+    int32_t face_side = 0;        ///< Shorter side of the best face in full-resolution pixels
+    float quality = 0.0f;         ///< Quality confidence of the best face
+    float yaw = 0.0f;             ///< Head pose of the best face, in degrees
+    float pitch = 0.0f;
+    float roll = 0.0f;
+    inspire::Embedded embedding;  ///< Feature of the best face, if status is ENROLL_OK
+};
+
+/**
+ * @struct EnrollmentStatistics
+ * @brief Throughput and busy time of each stage of one EnrollmentPipeline::Run.
+ *
+ * Utilization of a stage is its busy time over wall time times its thread count; a stage
+ * close to 1 is the bottleneck, one well below 1 has threads to spare.
+ */
+struct EnrollmentStatistics {
+    size_t images = 0;             ///< Images handed to the sink
+    size_t enrolled = 0;           ///< Of which ENROLL_OK
+    double wall_seconds = 0.0;
+    double decode_seconds = 0.0;   ///< Busy time summed over the decoder threads, including the source
+    double extract_seconds = 0.0;  ///< Busy time summed over the worker threads
+    double sink_seconds = 0.0;     ///< Time spent in the sink, on the calling thread
+    size_t reduced_decodes = 0;    ///< JPEGs decoded at a reduced size
+    size_t full_redecodes = 0;     ///< Of which decoded again at full size because the face was small
+    size_t cache_hits = 0;         ///< Embeddings found in the embedding cache instead of extracted
+    int32_t decoders = 0;
+    int32_t workers = 0;
+
+    double ImagesPerSecond() const {
+        return wall_seconds > 0.0 ? images / wall_seconds : 0.0;
+    }
+    double DecodeUtilization() const {
+        return wall_seconds > 0.0 && decoders > 0 ? decode_seconds / (wall_seconds * decoders) : 0.0;
+    }
+    double ExtractUtilization() const {
+        return wall_seconds > 0.0 && workers > 0 ? extract_seconds / (wall_seconds * workers) : 0.0;
+    }
+    double SinkUtilization() const {
+        return wall_seconds > 0.0 ? sink_seconds / wall_seconds : 0.0;
+    }
+};
+
+/**
+ * @class EnrollmentPipeline
+ * @brief Extracts face features from a list of image files on several threads.
+ *
+ * Decoder threads pull files from a source, read and hash them and decode them, worker threads detect the faces
+ * and extract the feature of the best one, each with a Session of its own, and the calling
+ * thread hands the results to a sink strictly in input order. A sink that inserts into the
+ * gallery therefore assigns the same ids for the same input as a sequential loop would,
+ * whatever the thread counts. The source is pulled only while fewer than window images are
+ * in flight, so a source that lists files lazily keeps the whole run in bounded memory and
+ * the first result reaches the sink before the listing is complete. The models must already
+ * be loaded through inspire::Launch.
+ *
+ * The detector sees every image at detect_level pixels, so a large JPEG is decoded at the
+ * coarsest DCT scale (1/2, 1/4 or 1/8, read from its frame header) that keeps the shorter
+ * side at least decode_side. If the face found in it is smaller than min_face_side, too
+ * small to align well, the image is decoded again at full size and extracted once more.
+ *
+ * Of up to max_faces detected faces the one with the best product of size (relative to the
+ * largest face), frontalness and quality confidence is enrolled. An image whose best face is
+ * too small, turned too far or of too low quality, or whose quality cannot be measured while
+ * min_quality is set, is rejected before the recognition model runs; a smaller face that
+ * would pass is not taken instead, it is rarely the subject.
+ */
+class EnrollmentPipeline {
+public:
+    /**
+     * @brief Receives each result in input order, on the thread that called Run.
+     */
+    typedef std::function<void(EnrollmentResult& result)> Sink;
+
+    /**
+     * @brief Produces the next file and its label; returns false once there are no more.
+     *
+     * Called from the decoder threads, one call at a time.
+     */
+    typedef std::function<bool(std::string& path, std::string& label)> Source;
+
+    /**
+     * @brief Looks at a file after it has been read and before it is decoded.
+     *
+     * Returns true if it settled the file itself, for example as unchanged since an earlier
+     * run; the result then goes to the sink as the screen left it, without decoding or
+     * extraction. Called from the decoder threads, possibly concurrently.
+     */
+    typedef std::function<bool(EnrollmentResult& result)> Screen;
+
+    explicit EnrollmentPipeline(const EnrollmentConfiguration& config = EnrollmentConfiguration());
+
+    /**
+     * @brief Creates the worker sessions.
+     * @return int32_t Status code; HERR_SESS_PIPELINE_FAILURE if a session cannot be created.
+     */
+    int32_t Initialize();
+
+    /**
+     * @brief Installs a screen applied to every file of the following runs; an empty one screens nothing.
+     */
+    void SetScreen(const Screen& screen) {
+        screen_ = screen;
+    }
+
+    /**
+     * @brief Looks up the aligned crop of every face in cache before extracting it, and stores new embeddings in it.
+     * @param cache Open cache that outlives the following runs, or nullptr to extract every face.
+     */
+    void SetEmbeddingCache(EmbeddingCache* cache) {
+        cache_ = cache;
+    }
+
+    /**
+     * @brief Processes every file of source and returns once each result has been handed to sink.
+     * @param source Image files, in the order their results reach the sink.
+     * @param sink Called once per file.
+     * @param statistics Optional output of the stage timings.
+     * @return int32_t Status code; HERR_INVALID_PARAM if Initialize has not succeeded.
+     */
+    int32_t Run(const Source& source, const Sink& sink, EnrollmentStatistics* statistics = nullptr);
+
+    /**
+     * @brief Processes a list of unlabelled files.
+     * @see Run
+     */
+    int32_t Run(const std::vector<std::string>& paths, const Sink& sink, EnrollmentStatistics* statistics = nullptr);
+
+private:
+    EnrollmentConfiguration config_;
+    Screen screen_;
+    EmbeddingCache* cache_ = nullptr;
+    std::vector<std::shared_ptr<inspire::Session>> sessions_;  ///< One per worker
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_ENROLLMENT_PIPELINE_H
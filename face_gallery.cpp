@@ -0,0 +1,1969 @@
+#include "face_gallery.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cosine_similarity.h"
+#include "gallery_export.h"
+
+namespace gallery {
+
+namespace {
+
+// Shards smaller than this cost more in hand-off than they save in scan time.
+const size_t kMinRowsPerShard = 1024;
+// Rows a shard scores per kernel call; an eager shard checks the shared hit count between blocks.
+const size_t kEagerCheckRows = 64;
+// Rows a batched nearest-neighbour shard scores against all queries per kernel call.
+const size_t kNearestBlockRows = 256;
+
+typedef std::pair<float, size_t> ScoredRow;  // (cosine, row)
+
+// Appends lines to a text file and syncs them. A line cut short by a crash during an earlier
+// append is dropped first, so the new lines do not continue it.
+int32_t AppendLinesDurably(const std::string& path, const std::string& text) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    off_t end = ok ? info.st_size : 0;
+    bool complete = end == 0;
+    char tail[256];
+    while (ok && !complete && end > 0) {
+        const off_t begin = std::max<off_t>(0, end - static_cast<off_t>(sizeof(tail)));
+        ok = pread(fd, tail, end - begin, begin) == end - begin;
+        for (off_t i = end - begin; ok && i > 0 && !complete; --i) {
+            if (tail[i - 1] == '\n') {
+                complete = true;
+            } else {
+                --end;
+            }
+        }
+    }
+    ok = ok && (end == info.st_size || ftruncate(fd, end) == 0);
+    for (size_t done = 0; ok && done < text.size();) {
+        const ssize_t written = pwrite(fd, text.data() + done, text.size() - done, end + static_cast<off_t>(done));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = written > 0;
+        done += ok ? static_cast<size_t>(written) : 0;
+    }
+    ok = ok && fdatasync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    return ok ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+bool ScoreGreater(const ScoredRow& a, const ScoredRow& b) {
+    return a.first > b.first;
+}
+
+void Normalize(const float* src, float* dst, size_t dim) {
+    const float norm = std::sqrt(DotProduct(src, src, dim));
+    float scale = norm > 0.0f ? 1.0f / norm : 0.0f;
+    for (size_t i = 0; i < dim; ++i) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+// Seed of the sign-hash rotation; fixed so codes built by different galleries agree.
+const uint32_t kSignHashSeed = 0x5EED5A17;
+
+// Files of a store opened with OpenStore.
+const char kStoreSnapshotFile[] = "gallery.snapshot";
+const char kStoreLogFile[] = "gallery.wal";
+// A store's snapshot is its own storage of record, not derived from another file.
+const uint64_t kStoreSnapshotStamp = 0;
+// A store checkpoint only syncs its log until the log holds this many records, or a quarter of the
+// rows if that is more; then it compacts the gallery into a new snapshot. Rewrites stay amortized O(N).
+const size_t kStoreCompactionRecords = 1024;
+
+// Context of the overloads that do not take one.
+SearchContext& ThreadSearchContext() {
+    thread_local SearchContext context;
+    return context;
+}
+
+}  // namespace
+
+SearchContext::SearchContext(size_t max_top_k) {
+    merged_.reserve(max_top_k * 4);
+    hot_heap_.reserve(max_top_k);
+    results_.reserve(max_top_k);
+    cached_.reserve(max_top_k);
+}
+
+FaceGallery::FaceGallery(const GalleryConfiguration& configuration)
+    : configuration_(configuration), threshold_(configuration.recognition_threshold), front_(0), version_(0), next_id_(1),
+      hot_cursor_(0), queries_(0), comparisons_(0), cache_lookups_(0), cache_hits_(0), cache_saved_ns_(0) {
+    readers_[0] = 0;
+    readers_[1] = 0;
+    hot_capacity_ = static_cast<size_t>(std::max(0, configuration.hot_ids));
+    hot_.reset(new std::atomic<int64_t>[hot_capacity_]);
+    for (size_t i = 0; i < hot_capacity_; ++i) {
+        hot_[i] = INSPIRE_INVALID_ID;
+    }
+    cache_.resize(static_cast<size_t>(std::max(0, configuration.query_cache_tracks)));
+    std::vector<int32_t> affinity;
+    int32_t threads = configuration_.search_threads;
+    if (configuration_.big_cores_only) {
+        affinity = ThreadPool::BigCoreIds();
+        if (threads <= 0) {
+            threads = static_cast<int32_t>(affinity.size());
+        }
+    }
+    pool_.reset(new ThreadPool(threads, affinity));
+}
+
+FaceGallery::~FaceGallery() {
+    DisableWriteBehind();
+}
+
+int FaceGallery::AcquireRead() const {
+    while (true) {
+        int side = front_.load();
+        readers_[side].fetch_add(1);
+        // A writer may have flipped the copies between the load and the increment; if so,
+        // it may already be modifying this side, so back off and pin the new front.
+        if (front_.load() == side) {
+            return side;
+        }
+        readers_[side].fetch_sub(1);
+    }
+}
+
+void FaceGallery::ReleaseRead(int side) const {
+    readers_[side].fetch_sub(1);
+}
+
+void FaceGallery::PublishAndDrain() {
+    int old_front = front_.load();
+    front_.store(1 - old_front);
+    version_.fetch_add(1);
+    while (readers_[old_front].load() != 0) {
+        std::this_thread::yield();
+    }
+}
+
+int32_t FaceGallery::LoadFromHub(const std::shared_ptr<inspire::FeatureHubDB>& hub) {
+    if (hub == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    int32_t ret = hub->GetAllIds();
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    std::vector<int64_t> ids = hub->GetExistingIds();
+
+    Data loaded;
+    loaded.ids.reserve(ids.size());
+    loaded.index.Reserve(ids.size());
+    std::vector<float> feature;
+    for (auto id : ids) {
+        ret = hub->GetFaceFeature(static_cast<int32_t>(id), feature);
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+        if (loaded.dim == 0) {
+            loaded.dim = feature.size();
+            loaded.matrix.reserve(ids.size() * loaded.dim);
+        }
+        if (feature.size() != loaded.dim || loaded.dim == 0) {
+            return HERR_INVALID_FACE_FEATURE;
+        }
+        loaded.index.Set(id, loaded.ids.size());
+        loaded.ids.push_back(id);
+        ReserveId(id);
+        loaded.matrix.resize(loaded.matrix.size() + loaded.dim);
+        Normalize(feature.data(), loaded.matrix.data() + loaded.matrix.size() - loaded.dim, loaded.dim);
+    }
+    // Without labels every row is its own person, so the centroids are the rows themselves.
+    loaded.persons = loaded.ids;
+    loaded.partitions.assign(loaded.ids.size(), 0);
+    IndexPartitions(loaded);
+    loaded.centroids = loaded.matrix;
+    loaded.centroid_persons = loaded.ids;
+    loaded.identities.reserve(loaded.ids.size());
+    for (size_t row = 0; row < loaded.ids.size(); ++row) {
+        Identity& identity = loaded.identities[loaded.ids[row]];
+        identity.members.push_back(loaded.ids[row]);
+        identity.row = row;
+    }
+    EncodeRows(loaded);
+
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    int back = 1 - front_.load();
+    data_[back] = loaded;
+    PublishAndDrain();
+    data_[1 - back] = std::move(loaded);
+    hub_ = hub;
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::LoadFromSnapshot(const std::string& path, uint64_t expected_stamp, bool verify_payload) {
+    std::shared_ptr<MappedGallerySnapshot> snapshot;
+    int32_t ret = MappedGallerySnapshot::Open(path, false, snapshot);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    const auto& header = snapshot->Header();
+    // A stale snapshot is rejected on its header alone, before the payload pass reads the file.
+    if (header.source_stamp != expected_stamp || (verify_payload && !snapshot->VerifyPayload())) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+
+    Data loaded;
+    loaded.dim = header.dim;
+    loaded.mapped = snapshot;
+    loaded.ids.assign(snapshot->Ids(), snapshot->Ids() + header.count);
+    loaded.persons.assign(snapshot->Persons(), snapshot->Persons() + header.count);
+    loaded.partitions.assign(snapshot->Partitions(), snapshot->Partitions() + header.count);
+    if (!IndexPartitions(loaded)) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    loaded.index.Reserve(header.count);
+    for (size_t row = 0; row < loaded.ids.size(); ++row) {
+        loaded.index.Set(loaded.ids[row], row);
+        ReserveId(loaded.ids[row]);
+    }
+    // Centroids are small next to the rows; keep them on the heap so mutations can update them in place.
+    loaded.centroid_persons.assign(snapshot->Identities(), snapshot->Identities() + header.identity_count);
+    loaded.centroids.assign(snapshot->Centroids(), snapshot->Centroids() + header.identity_count * header.dim);
+    loaded.identities.reserve(header.identity_count);
+    for (size_t row = 0; row < loaded.centroid_persons.size(); ++row) {
+        loaded.identities[loaded.centroid_persons[row]].row = row;
+    }
+    for (size_t row = 0; row < loaded.ids.size(); ++row) {
+        auto it = loaded.identities.find(loaded.persons[row]);
+        if (it == loaded.identities.end()) {
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        it->second.members.push_back(loaded.ids[row]);
+    }
+    // Codes depend on the configuration, so they are not part of the snapshot; this pass reads every row once.
+    EncodeRows(loaded);
+
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    int back = 1 - front_.load();
+    data_[back] = loaded;
+    PublishAndDrain();
+    data_[1 - back] = std::move(loaded);
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::LoadIdentityLabels(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return HSUCCEED;
+    }
+    std::vector<GalleryMutation> batch;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (file.eof()) {
+            break;  // No line break: an append was cut short, and the line may end mid-number
+        }
+        std::istringstream fields(line);
+        GalleryMutation mutation;
+        mutation.type = GalleryMutation::LABEL;
+        if (!(fields >> mutation.id >> mutation.person)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        batch.push_back(mutation);
+        // The partition column is optional: files written before partitions existed have two.
+        if (fields >> mutation.partition) {
+            mutation.type = GalleryMutation::PARTITION;
+            batch.push_back(mutation);
+        }
+    }
+    int32_t ret = Apply(batch);
+    // Labels of ids that were removed from the hub in the meantime are stale, not an error.
+    return ret == HERR_FT_HUB_NOT_FOUND_FEATURE ? HSUCCEED : ret;
+}
+
+int32_t FaceGallery::SaveIdentityLabels(const std::string& path) const {
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::trunc);
+    if (!file.is_open()) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    // Copy the labels out first so writers are not held up by the file I/O.
+    struct Label {
+        int64_t id;
+        int64_t person;
+        int32_t partition;
+    };
+    std::vector<Label> labels;
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    for (size_t row = 0; row < data.ids.size(); ++row) {
+        if (data.persons[row] != data.ids[row] || data.partitions[row] != 0) {
+            labels.push_back(Label{data.ids[row], data.persons[row], data.partitions[row]});
+        }
+    }
+    ReleaseRead(side);
+    for (const auto& label : labels) {
+        file << label.id << " " << label.person;
+        if (label.partition != 0) {
+            file << " " << label.partition;
+        }
+        file << "\n";
+    }
+    file.close();
+    if (file.fail() || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::AppendIdentityLabels(const std::string& path, const std::vector<int64_t>& ids) const {
+    std::ostringstream lines;
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    for (auto id : ids) {
+        const size_t row = data.index.Find(id);
+        if (row == IdIndex::kNotFound) {
+            continue;
+        }
+        // Written in full even for defaults, so the line overrides any stale one of a reused id.
+        lines << id << " " << data.persons[row] << " " << data.partitions[row] << "\n";
+    }
+    ReleaseRead(side);
+    const std::string text = lines.str();
+    return text.empty() ? HSUCCEED : AppendLinesDurably(path, text);
+}
+
+int32_t FaceGallery::SaveSnapshot(const std::string& path, uint64_t source_stamp) const {
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    int32_t ret = WriteGallerySnapshot(path, static_cast<uint32_t>(data.dim), data.ids, data.persons, data.partitions, data.Rows(),
+                                       data.centroid_persons, data.centroids.data(), source_stamp);
+    ReleaseRead(side);
+    return ret;
+}
+
+int32_t FaceGallery::ExportSnapshot(const std::string& path, bool fp16) const {
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    GalleryExportWriter writer;
+    int32_t ret = writer.Open(path, static_cast<uint32_t>(data.dim), data.ids.size(), fp16 ? GALLERY_EXPORT_FP16 : GALLERY_EXPORT_FP32);
+    for (size_t begin = 0; ret == HSUCCEED && begin < data.ids.size(); begin += kGalleryExportChunkRows) {
+        const size_t count = std::min(kGalleryExportChunkRows, data.ids.size() - begin);
+        ret = writer.WriteChunk(data.ids.data() + begin, data.persons.data() + begin, data.partitions.data() + begin,
+                                data.Rows() + begin * data.dim, count);
+    }
+    ReleaseRead(side);
+    return ret == HSUCCEED ? writer.Close() : ret;
+}
+
+int32_t FaceGallery::ImportSnapshot(const std::string& path, size_t* imported) {
+    if (imported != nullptr) {
+        *imported = 0;
+    }
+    GalleryExportReader reader;
+    int32_t ret = reader.Open(path);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    const size_t dim = reader.Header().dim;
+    const size_t existing_dim = Dimension();
+    if (dim != 0 && existing_dim != 0 && existing_dim != dim) {
+        return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+    }
+    Reserve(Size() + reader.Header().count, dim);
+    std::vector<int64_t> ids;
+    std::vector<int64_t> persons;
+    std::vector<int32_t> partitions;
+    std::vector<float> rows;
+    std::vector<GalleryMutation> batch;
+    while (true) {
+        ret = reader.ReadChunk(ids, persons, partitions, rows);
+        if (ret != HSUCCEED || ids.empty()) {
+            return ret;
+        }
+        // Mutations are reused across chunks, so their feature buffers are allocated once.
+        batch.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            batch[i].type = GalleryMutation::UPSERT;
+            batch[i].id = ids[i];
+            batch[i].person = persons[i];
+            batch[i].partition = partitions[i];
+            batch[i].feature.assign(rows.begin() + i * dim, rows.begin() + (i + 1) * dim);
+        }
+        {
+            std::lock_guard<std::mutex> lock(log_mutex_);
+            if (wal_ != nullptr) {
+                ret = LogMutations(batch);
+            } else {
+                ret = hub_ != nullptr ? ApplyToHub(batch) : HSUCCEED;
+                if (ret == HSUCCEED) {
+                    ret = Apply(batch);
+                }
+            }
+        }
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+        if (imported != nullptr) {
+            *imported += ids.size();
+        }
+    }
+}
+
+void FaceGallery::EncodeRows(Data& data) const {
+    if (!configuration_.hash_prefilter || data.dim == 0) {
+        return;
+    }
+    data.hasher = std::make_shared<SignHash>(data.dim, configuration_.hash_rotation, kSignHashSeed);
+    const size_t words = data.hasher->Words();
+    data.codes.resize(data.ids.size() * words);
+    std::vector<float> scratch;
+    for (size_t row = 0; row < data.ids.size(); ++row) {
+        data.hasher->Encode(data.Rows() + row * data.dim, data.codes.data() + row * words, scratch);
+    }
+}
+
+int32_t FaceGallery::ApplyMutation(Data& data, const GalleryMutation& mutation) const {
+    if (data.mapped) {
+        // First write to a mapped copy: move the rows to the heap so they can be modified.
+        const float* rows = data.mapped->Matrix();
+        data.matrix.assign(rows, rows + data.ids.size() * data.dim);
+        data.mapped.reset();
+    }
+    const size_t found = data.index.Find(mutation.id);
+    if (mutation.type == GalleryMutation::REMOVE) {
+        if (found == IdIndex::kNotFound) {
+            return HERR_FT_HUB_NOT_FOUND_FEATURE;
+        }
+        const int64_t person = data.persons[found];
+        data.index.Erase(mutation.id);
+        EraseRow(data, found);
+        UnlinkIdentity(data, person, mutation.id);
+        return HSUCCEED;
+    }
+    if (mutation.type == GalleryMutation::PARTITION) {
+        if (found == IdIndex::kNotFound) {
+            return HERR_FT_HUB_NOT_FOUND_FEATURE;
+        }
+        if (mutation.partition < 0) {
+            return HERR_INVALID_PARAM;
+        }
+        if (data.partitions[found] != mutation.partition) {
+            RelocateRow(data, found, mutation.partition);
+        }
+        return HSUCCEED;
+    }
+    if (mutation.type == GalleryMutation::LABEL) {
+        if (found == IdIndex::kNotFound) {
+            return HERR_FT_HUB_NOT_FOUND_FEATURE;
+        }
+        if (mutation.person < 0) {
+            return HERR_INVALID_PARAM;
+        }
+        const int64_t person = data.persons[found];
+        if (person != mutation.person) {
+            data.persons[found] = mutation.person;
+            UnlinkIdentity(data, person, mutation.id);
+            LinkIdentity(data, mutation.person, mutation.id);
+        }
+        return HSUCCEED;
+    }
+
+    const auto& feature = mutation.feature;
+    if (feature.empty() || (data.dim != 0 && feature.size() != data.dim)) {
+        return HERR_INVALID_FACE_FEATURE;
+    }
+    data.dim = feature.size();
+    size_t row;
+    int64_t old_person = INSPIRE_INVALID_ID;
+    if (found != IdIndex::kNotFound) {
+        row = found;
+        old_person = data.persons[row];
+        if (mutation.partition >= 0 && mutation.partition != data.partitions[row]) {
+            row = RelocateRow(data, row, mutation.partition);
+        }
+    } else {
+        row = InsertRow(data, std::max(mutation.partition, 0));
+        data.ids[row] = mutation.id;
+        data.index.Set(mutation.id, row);
+    }
+    Normalize(feature.data(), data.matrix.data() + row * data.dim, data.dim);
+    if (configuration_.hash_prefilter) {
+        if (!data.hasher) {
+            data.hasher = std::make_shared<SignHash>(data.dim, configuration_.hash_rotation, kSignHashSeed);
+        }
+        const size_t words = data.hasher->Words();
+        data.codes.resize(data.ids.size() * words);
+        std::vector<float> scratch;
+        data.hasher->Encode(data.matrix.data() + row * data.dim, data.codes.data() + row * words, scratch);
+    }
+    int64_t person = mutation.person >= 0 ? mutation.person : old_person;
+    if (person < 0) {
+        person = mutation.id;
+    }
+    data.persons[row] = person;
+    if (old_person != person && old_person >= 0) {
+        UnlinkIdentity(data, old_person, mutation.id);
+    }
+    if (old_person != person) {
+        LinkIdentity(data, person, mutation.id);
+    } else {
+        RefreshCentroid(data, person);
+    }
+    return HSUCCEED;
+}
+
+size_t FaceGallery::InsertRow(Data& data, int32_t partition) {
+    auto& ranges = data.partition_ranges;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), partition,
+                               [](const PartitionRange& range, int32_t key) { return range.partition < key; });
+    if (it == ranges.end() || it->partition != partition) {
+        PartitionRange range;
+        range.partition = partition;
+        range.begin = range.end = it == ranges.end() ? data.ids.size() : it->begin;
+        it = ranges.insert(it, range);
+    }
+    const size_t index = it - ranges.begin();
+    data.ids.push_back(INSPIRE_INVALID_ID);
+    data.persons.push_back(INSPIRE_INVALID_ID);
+    data.partitions.push_back(partition);
+    data.matrix.resize(data.matrix.size() + data.dim);
+    if (data.hasher) {
+        data.codes.resize(data.codes.size() + data.hasher->Words());
+    }
+    // The free row starts past the end; each later partition moves its first row to its end,
+    // which shifts the partition up by one and leaves the free row right behind the previous one.
+    size_t free_row = data.ids.size() - 1;
+    for (size_t i = ranges.size() - 1; i > index; --i) {
+        MoveRow(data, ranges[i].begin, free_row);
+        free_row = ranges[i].begin;
+        ++ranges[i].begin;
+        ++ranges[i].end;
+    }
+    ++ranges[index].end;
+    data.ids[free_row] = INSPIRE_INVALID_ID;
+    data.persons[free_row] = INSPIRE_INVALID_ID;
+    data.partitions[free_row] = partition;
+    return free_row;
+}
+
+void FaceGallery::EraseRow(Data& data, size_t row) {
+    auto& ranges = data.partition_ranges;
+    const size_t index = std::lower_bound(ranges.begin(), ranges.end(), data.partitions[row],
+                                          [](const PartitionRange& range, int32_t key) { return range.partition < key; }) -
+                         ranges.begin();
+    // The last row of the partition fills the hole, then each later partition moves its last
+    // row into the hole in front of it. With one partition this is a plain swap-remove.
+    size_t hole = row;
+    for (size_t i = index; i < ranges.size(); ++i) {
+        const size_t last = ranges[i].end - 1;
+        if (last != hole) {
+            MoveRow(data, last, hole);
+        }
+        hole = last;
+        if (i > index) {
+            --ranges[i].begin;
+        }
+        --ranges[i].end;
+    }
+    if (ranges[index].begin == ranges[index].end) {
+        ranges.erase(ranges.begin() + index);
+    }
+    const size_t last = data.ids.size() - 1;
+    data.ids.pop_back();
+    data.persons.pop_back();
+    data.partitions.pop_back();
+    data.matrix.resize(last * data.dim);
+    if (data.hasher) {
+        data.codes.resize(last * data.hasher->Words());
+    }
+}
+
+void FaceGallery::MoveRow(Data& data, size_t from, size_t to) {
+    data.ids[to] = data.ids[from];
+    data.persons[to] = data.persons[from];
+    data.partitions[to] = data.partitions[from];
+    std::copy(data.matrix.begin() + from * data.dim, data.matrix.begin() + (from + 1) * data.dim, data.matrix.begin() + to * data.dim);
+    if (data.hasher) {
+        const size_t words = data.hasher->Words();
+        std::copy(data.codes.begin() + from * words, data.codes.begin() + (from + 1) * words, data.codes.begin() + to * words);
+    }
+    data.index.Set(data.ids[to], to);
+}
+
+size_t FaceGallery::RelocateRow(Data& data, size_t row, int32_t partition) {
+    const int64_t id = data.ids[row];
+    const int64_t person = data.persons[row];
+    std::vector<float> feature(data.matrix.begin() + row * data.dim, data.matrix.begin() + (row + 1) * data.dim);
+    std::vector<uint64_t> code;
+    if (data.hasher) {
+        const size_t words = data.hasher->Words();
+        code.assign(data.codes.begin() + row * words, data.codes.begin() + (row + 1) * words);
+    }
+    data.index.Erase(id);
+    EraseRow(data, row);
+    const size_t moved = InsertRow(data, partition);
+    data.ids[moved] = id;
+    data.persons[moved] = person;
+    data.index.Set(id, moved);
+    std::copy(feature.begin(), feature.end(), data.matrix.begin() + moved * data.dim);
+    std::copy(code.begin(), code.end(), data.codes.begin() + moved * code.size());
+    return moved;
+}
+
+bool FaceGallery::IndexPartitions(Data& data) {
+    auto& ranges = data.partition_ranges;
+    ranges.clear();
+    for (size_t row = 0; row < data.partitions.size(); ++row) {
+        const int32_t partition = data.partitions[row];
+        if (!ranges.empty() && ranges.back().partition == partition) {
+            ++ranges.back().end;
+            continue;
+        }
+        if (partition < 0 || (!ranges.empty() && partition < ranges.back().partition)) {
+            return false;
+        }
+        PartitionRange range;
+        range.partition = partition;
+        range.begin = row;
+        range.end = row + 1;
+        ranges.push_back(range);
+    }
+    return true;
+}
+
+void FaceGallery::LinkIdentity(Data& data, int64_t person, int64_t id) {
+    auto inserted = data.identities.emplace(person, Identity());
+    Identity& identity = inserted.first->second;
+    if (inserted.second) {
+        identity.row = data.centroid_persons.size();
+        data.centroid_persons.push_back(person);
+        data.centroids.resize(data.centroids.size() + data.dim);
+    }
+    identity.members.push_back(id);
+    RefreshCentroid(data, person);
+}
+
+void FaceGallery::UnlinkIdentity(Data& data, int64_t person, int64_t id) {
+    auto it = data.identities.find(person);
+    if (it == data.identities.end()) {
+        return;
+    }
+    auto& members = it->second.members;
+    members.erase(std::remove(members.begin(), members.end(), id), members.end());
+    if (!members.empty()) {
+        RefreshCentroid(data, person);
+        return;
+    }
+    // Last template gone: move the last centroid into the freed row.
+    const size_t row = it->second.row;
+    const size_t last = data.centroid_persons.size() - 1;
+    if (row != last) {
+        std::copy(data.centroids.begin() + last * data.dim, data.centroids.begin() + (last + 1) * data.dim,
+                  data.centroids.begin() + row * data.dim);
+        data.centroid_persons[row] = data.centroid_persons[last];
+        data.identities[data.centroid_persons[row]].row = row;
+    }
+    data.centroid_persons.pop_back();
+    data.centroids.resize(last * data.dim);
+    data.identities.erase(it);
+}
+
+void FaceGallery::RefreshCentroid(Data& data, int64_t person) {
+    auto it = data.identities.find(person);
+    if (it == data.identities.end()) {
+        return;
+    }
+    float* centroid = data.centroids.data() + it->second.row * data.dim;
+    if (it->second.members.size() == 1) {
+        // The common single-template person: its row is already the normalized mean.
+        const float* vec = data.Rows() + data.index.Find(it->second.members[0]) * data.dim;
+        std::copy(vec, vec + data.dim, centroid);
+        return;
+    }
+    // A person has a handful of templates, so recomputing the mean beats keeping running sums.
+    std::vector<float> sum(data.dim, 0.0f);
+    for (auto id : it->second.members) {
+        const float* vec = data.Rows() + data.index.Find(id) * data.dim;
+        for (size_t i = 0; i < data.dim; ++i) {
+            sum[i] += vec[i];
+        }
+    }
+    Normalize(sum.data(), centroid, data.dim);
+}
+
+int32_t FaceGallery::Apply(const std::vector<GalleryMutation>& batch) {
+    if (batch.empty()) {
+        return HSUCCEED;
+    }
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    int back = 1 - front_.load();
+    int32_t ret = HSUCCEED;
+    for (const auto& mutation : batch) {
+        int32_t status = ApplyMutation(data_[back], mutation);
+        if (status != HSUCCEED) {
+            ret = status;
+        } else if (mutation.type == GalleryMutation::UPSERT) {
+            ReserveId(mutation.id);
+        }
+    }
+    PublishAndDrain();
+    // The old copy is unused now; replaying the batch makes both copies identical again.
+    for (const auto& mutation : batch) {
+        ApplyMutation(data_[1 - back], mutation);
+    }
+    return ret;
+}
+
+void FaceGallery::Reserve(size_t rows, size_t dim) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    // Only the back copy is free of readers: reserve it, swap, and reserve the other one.
+    for (int pass = 0; pass < 2; ++pass) {
+        Data& data = data_[1 - front_.load()];
+        data.ids.reserve(rows);
+        data.persons.reserve(rows);
+        data.partitions.reserve(rows);
+        data.index.Reserve(rows);
+        data.matrix.reserve(rows * dim);
+        if (pass == 0) {
+            PublishAndDrain();
+        }
+    }
+}
+
+void FaceGallery::ReserveId(int64_t id) {
+    int64_t current = next_id_.load();
+    while (id >= current && !next_id_.compare_exchange_weak(current, id + 1)) {
+    }
+}
+
+int32_t FaceGallery::FaceFeatureInsert(const std::vector<float>& feature, int32_t id, int64_t& result_id) {
+    std::vector<int64_t> ids(1, id);
+    int32_t ret = FaceFeatureInsertBatch(std::vector<inspire::Embedded>(1, feature), ids);
+    if (ret == HSUCCEED) {
+        result_id = ids[0];
+    }
+    return ret;
+}
+
+int32_t FaceGallery::FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids) {
+    return FaceFeatureInsertBatch(features, ids, std::vector<int64_t>());
+}
+
+int32_t FaceGallery::FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids,
+                                            const std::vector<int64_t>& persons) {
+    return FaceFeatureInsertBatch(features, ids, persons, std::vector<int32_t>());
+}
+
+int32_t FaceGallery::FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids,
+                                            const std::vector<int64_t>& persons, const std::vector<int32_t>& partitions) {
+    if (hub_ == nullptr && store_directory_.empty()) {
+        return HERR_FT_HUB_DISABLE;
+    }
+    if ((!ids.empty() && ids.size() != features.size()) || (!persons.empty() && persons.size() != features.size()) ||
+        (!partitions.empty() && partitions.size() != features.size())) {
+        return HERR_INVALID_PARAM;
+    }
+    for (auto partition : partitions) {
+        if (partition < 0) {
+            return HERR_INVALID_PARAM;
+        }
+    }
+    // An auto-increment hub ignores caller ids; the log must not take them either.
+    const bool custom_ids = !ids.empty() && configuration_.primary_key_mode == inspire::PrimaryKeyMode::MANUAL_INPUT;
+    std::vector<GalleryMutation> batch(features.size());
+    {
+        std::lock_guard<std::mutex> lock(log_mutex_);
+        if (wal_ != nullptr) {
+            for (size_t i = 0; i < features.size(); ++i) {
+                batch[i].type = GalleryMutation::UPSERT;
+                batch[i].id = custom_ids && ids[i] >= 0 ? ids[i] : next_id_.fetch_add(1);
+                batch[i].feature = features[i];
+                batch[i].person = persons.empty() ? INSPIRE_INVALID_ID : persons[i];
+                batch[i].partition = partitions.empty() ? -1 : partitions[i];
+            }
+            int32_t ret = LogMutations(batch);
+            ids.clear();
+            if (ret == HSUCCEED) {
+                for (const auto& mutation : batch) {
+                    ids.push_back(mutation.id);
+                }
+            }
+            return ret;
+        }
+    }
+
+    batch.clear();
+    int32_t ret = HSUCCEED;
+    for (size_t i = 0; i < features.size(); ++i) {
+        int64_t result_id = INSPIRE_INVALID_ID;
+        ret = hub_->FaceFeatureInsert(features[i], custom_ids ? static_cast<int32_t>(ids[i]) : -1, result_id);
+        if (ret != HSUCCEED) {
+            break;
+        }
+        batch.emplace_back();
+        batch.back().type = GalleryMutation::UPSERT;
+        batch.back().id = result_id;
+        batch.back().feature = features[i];
+        batch.back().person = persons.empty() ? INSPIRE_INVALID_ID : persons[i];
+        batch.back().partition = partitions.empty() ? -1 : partitions[i];
+    }
+    ids.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        ids[i] = batch[i].id;
+    }
+    int32_t apply_ret = Apply(batch);
+    return ret != HSUCCEED ? ret : apply_ret;
+}
+
+int32_t FaceGallery::FaceFeatureUpdate(const std::vector<float>& feature, int32_t customId) {
+    if (hub_ == nullptr && store_directory_.empty()) {
+        return HERR_FT_HUB_DISABLE;
+    }
+    std::vector<GalleryMutation> batch(1);
+    batch[0].type = GalleryMutation::UPSERT;
+    batch[0].id = customId;
+    batch[0].feature = feature;
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if (wal_ != nullptr) {
+        return LogMutations(batch);
+    }
+    int32_t ret = hub_->FaceFeatureUpdate(feature, customId);
+    return ret != HSUCCEED ? ret : Apply(batch);
+}
+
+int32_t FaceGallery::FaceFeatureRemove(int32_t id) {
+    if (hub_ == nullptr && store_directory_.empty()) {
+        return HERR_FT_HUB_DISABLE;
+    }
+    std::vector<GalleryMutation> batch(1);
+    batch[0].type = GalleryMutation::REMOVE;
+    batch[0].id = id;
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if (wal_ != nullptr) {
+        return LogMutations(batch);
+    }
+    int32_t ret = hub_->FaceFeatureRemove(id);
+    return ret != HSUCCEED ? ret : Apply(batch);
+}
+
+int32_t FaceGallery::FaceFeatureSetPartition(int32_t id, int32_t partition) {
+    if (hub_ == nullptr && store_directory_.empty()) {
+        return HERR_FT_HUB_DISABLE;
+    }
+    if (partition < 0) {
+        return HERR_INVALID_PARAM;
+    }
+    std::vector<GalleryMutation> batch(1);
+    batch[0].type = GalleryMutation::PARTITION;
+    batch[0].id = id;
+    batch[0].partition = partition;
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if (wal_ != nullptr) {
+        return LogMutations(batch);
+    }
+    return Apply(batch);
+}
+
+int32_t FaceGallery::ApplyToHub(const std::vector<GalleryMutation>& mutations) {
+    std::vector<float> existing;
+    for (const auto& mutation : mutations) {
+        if (mutation.type == GalleryMutation::LABEL || mutation.type == GalleryMutation::PARTITION) {
+            continue;  // Person labels and partitions are not stored in the hub, see SaveIdentityLabels
+        }
+        const int32_t id = static_cast<int32_t>(mutation.id);
+        const bool exists = hub_->GetFaceFeature(id, existing) == HSUCCEED;
+        int32_t ret = HSUCCEED;
+        if (mutation.type == GalleryMutation::REMOVE) {
+            ret = exists ? hub_->FaceFeatureRemove(id) : HSUCCEED;
+        } else if (exists) {
+            ret = hub_->FaceFeatureUpdate(mutation.feature, id);
+        } else {
+            int64_t result_id = INSPIRE_INVALID_ID;
+            ret = hub_->FaceFeatureInsert(mutation.feature, id, result_id);
+            if (ret == HSUCCEED && result_id != mutation.id) {
+                // The hub assigned its own id: it is not in manual primary key mode.
+                ret = HERR_FT_HUB_INSERT_FAILURE;
+            }
+        }
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::LogMutations(const std::vector<GalleryMutation>& mutations) {
+    int32_t ret = wal_->Append(mutations);
+    if (ret == HSUCCEED && write_behind_.strict) {
+        ret = wal_->Sync();
+    }
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    // Mutations this gallery rejects (e.g. removing an unknown id) are still logged; replaying them is a no-op.
+    ret = Apply(mutations);
+    pending_.insert(pending_.end(), mutations.begin(), mutations.end());
+    if (write_behind_.checkpoint_ops > 0 && pending_.size() >= static_cast<size_t>(write_behind_.checkpoint_ops)) {
+        checkpoint_cv_.notify_one();
+    }
+    return ret;
+}
+
+int32_t FaceGallery::EnableWriteBehind(const WriteBehindConfiguration& configuration) {
+    if (hub_ == nullptr) {
+        return HERR_FT_HUB_DISABLE;
+    }
+    if (configuration.wal_path.empty() || configuration.labels_path.empty()) {
+        return HERR_INVALID_PARAM;
+    }
+    DisableWriteBehind();
+    return StartWriteBehind(configuration);
+}
+
+int32_t FaceGallery::OpenStore(const std::string& directory, const WriteBehindConfiguration& configuration) {
+    if (hub_ != nullptr || directory.empty()) {
+        return HERR_INVALID_PARAM;
+    }
+    DisableWriteBehind();
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    int32_t ret = LoadStoreSnapshot(directory);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    WriteBehindConfiguration store = configuration;
+    store.wal_path = directory + "/" + kStoreLogFile;
+    store_directory_ = directory;
+    ret = StartWriteBehind(store);
+    if (ret != HSUCCEED) {
+        store_directory_.clear();
+    }
+    return ret;
+}
+
+int32_t FaceGallery::OpenStoreReadOnly(const std::string& directory) {
+    if (hub_ != nullptr || directory.empty()) {
+        return HERR_INVALID_PARAM;
+    }
+    DisableWriteBehind();
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return HERR_INVALID_PARAM;
+    }
+    int32_t ret = LoadStoreSnapshot(directory);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    // The same records OpenStore would recover, applied to memory only; the files are left as they are.
+    const std::string wal_path = directory + "/" + kStoreLogFile;
+    std::vector<GalleryMutation> recovered;
+    ret = WriteAheadLog::Replay(wal_path + ".old", recovered);
+    if (ret == HSUCCEED) {
+        ret = WriteAheadLog::Replay(wal_path, recovered);
+    }
+    if (ret == HSUCCEED) {
+        Apply(recovered);
+    }
+    return ret;
+}
+
+int32_t FaceGallery::LoadStoreSnapshot(const std::string& directory) {
+    const std::string snapshot_path = directory + "/" + kStoreSnapshotFile;
+    if (FileSourceStamp(snapshot_path) != 0) {
+        return LoadFromSnapshot(snapshot_path, kStoreSnapshotStamp);
+    }
+    // A new store starts empty, whatever the gallery held before.
+    Data empty;
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    data_[1 - front_.load()] = empty;
+    PublishAndDrain();
+    data_[1 - front_.load()] = std::move(empty);
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::StoreMutations(const std::vector<GalleryMutation>& mutations) {
+    if (store_directory_.empty()) {
+        int32_t ret = ApplyToHub(mutations);
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+        // The hub keeps features only: the persons and partitions of the batch must be on disk
+        // before the log records that carry them are dropped.
+        std::vector<int64_t> ids;
+        for (const auto& mutation : mutations) {
+            if (mutation.type != GalleryMutation::REMOVE) {
+                ids.push_back(mutation.id);
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return AppendIdentityLabels(write_behind_.labels_path, ids);
+    }
+    // The mutations are already in memory, so compacting the published contents stores them.
+    return SaveSnapshot(store_directory_ + "/" + kStoreSnapshotFile, kStoreSnapshotStamp);
+}
+
+int32_t FaceGallery::StartWriteBehind(const WriteBehindConfiguration& configuration) {
+    {
+        // Recovery stores through StoreMutations, which reads the label path.
+        std::lock_guard<std::mutex> lock(log_mutex_);
+        write_behind_ = configuration;
+        // Whatever an earlier session left unfinished is replayed below.
+        inflight_.clear();
+        rotated_ = false;
+        store_logged_ = 0;
+    }
+    // Recovery: records of an interrupted checkpoint (.old) come before the live log.
+    const std::string old_path = configuration.wal_path + ".old";
+    std::vector<GalleryMutation> recovered;
+    int32_t ret = WriteAheadLog::Replay(old_path, recovered);
+    if (ret == HSUCCEED) {
+        ret = WriteAheadLog::Replay(configuration.wal_path, recovered);
+    }
+    if (ret == HSUCCEED && !recovered.empty()) {
+        Apply(recovered);
+        ret = StoreMutations(recovered);
+    }
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    std::remove(old_path.c_str());
+
+    std::unique_ptr<WriteAheadLog> wal(new WriteAheadLog());
+    // The recovered records are stored now, so the log starts empty.
+    std::remove(configuration.wal_path.c_str());
+    ret = wal->Open(configuration.wal_path);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    wal_ = std::move(wal);
+    checkpoint_stop_ = false;
+    checkpoint_thread_ = std::thread(&FaceGallery::CheckpointLoop, this);
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::Checkpoint(bool compact) {
+    std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex_);
+    const std::string old_path = write_behind_.wal_path + ".old";
+    if (!rotated_) {
+        std::lock_guard<std::mutex> lock(log_mutex_);
+        if (wal_ == nullptr || (pending_.empty() && (store_logged_ == 0 || !compact))) {
+            return HSUCCEED;
+        }
+        int32_t ret = wal_->Sync();
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+        if (!store_directory_.empty() && !compact) {
+            // A synced store log is replayed by OpenStore, so the records may stay in it until the
+            // log is long enough to be worth a new snapshot.
+            int side = AcquireRead();
+            size_t rows = data_[side].ids.size();
+            ReleaseRead(side);
+            if (store_logged_ + pending_.size() < std::max(kStoreCompactionRecords, rows / 4)) {
+                store_logged_ += pending_.size();
+                pending_.clear();
+                return HSUCCEED;
+            }
+        }
+        // Rotate the log: everything in .old is exactly what this checkpoint stores.
+        wal_->Close();
+        if (std::rename(write_behind_.wal_path.c_str(), old_path.c_str()) != 0) {
+            wal_->Open(write_behind_.wal_path);
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        ret = wal_->Open(write_behind_.wal_path);
+        if (ret != HSUCCEED) {
+            return ret;
+        }
+        inflight_.swap(pending_);
+        store_logged_ = 0;
+        rotated_ = true;
+    }
+    // A failed checkpoint keeps inflight_ and .old, and the next one retries them before rotating again.
+    int32_t ret = StoreMutations(inflight_);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    inflight_.clear();
+    rotated_ = false;
+    std::remove(old_path.c_str());
+    return HSUCCEED;
+}
+
+void FaceGallery::CheckpointLoop() {
+    std::unique_lock<std::mutex> lock(log_mutex_);
+    while (!checkpoint_stop_) {
+        auto due = [this] {
+            return checkpoint_stop_ ||
+                   (write_behind_.checkpoint_ops > 0 && pending_.size() >= static_cast<size_t>(write_behind_.checkpoint_ops));
+        };
+        if (write_behind_.checkpoint_interval_ms > 0) {
+            checkpoint_cv_.wait_for(lock, std::chrono::milliseconds(write_behind_.checkpoint_interval_ms), due);
+        } else {
+            checkpoint_cv_.wait(lock, due);
+        }
+        if (checkpoint_stop_) {
+            break;
+        }
+        lock.unlock();
+        Checkpoint(false);
+        lock.lock();
+    }
+}
+
+int32_t FaceGallery::Flush() {
+    // Two rounds: a checkpoint left over from a failure, then everything pending now.
+    int32_t ret = Checkpoint(true);
+    if (ret == HSUCCEED) {
+        ret = Checkpoint(true);
+    }
+    return ret;
+}
+
+int32_t FaceGallery::DisableWriteBehind() {
+    {
+        std::lock_guard<std::mutex> lock(log_mutex_);
+        if (wal_ == nullptr) {
+            return HSUCCEED;
+        }
+        checkpoint_stop_ = true;
+    }
+    checkpoint_cv_.notify_all();
+    checkpoint_thread_.join();
+    int32_t ret = Flush();
+    if (ret == HSUCCEED && store_directory_.empty()) {
+        // Checkpoints only append to the label file; compact it once at the end.
+        ret = SaveIdentityLabels(write_behind_.labels_path);
+    }
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if (ret == HSUCCEED) {
+        wal_->Close();
+        wal_.reset();
+        // A store cannot be written without its log.
+        store_directory_.clear();
+    }
+    return ret;
+}
+
+int32_t FaceGallery::Insert(int64_t id, const inspire::Embedded& feature) {
+    GalleryMutation mutation;
+    mutation.type = GalleryMutation::UPSERT;
+    mutation.id = id;
+    mutation.feature = feature;
+    return Apply(std::vector<GalleryMutation>(1, mutation));
+}
+
+int32_t FaceGallery::Remove(int64_t id) {
+    GalleryMutation mutation;
+    mutation.type = GalleryMutation::REMOVE;
+    mutation.id = id;
+    return Apply(std::vector<GalleryMutation>(1, mutation));
+}
+
+size_t FaceGallery::ScanShard(const float* rows, size_t dim, const float* query, size_t begin, size_t end, size_t topK, float threshold,
+                              std::vector<ScoredRow>& heap, std::atomic<size_t>* hits) const {
+    heap.reserve(topK);
+    float scores[kEagerCheckRows];
+    for (size_t block = begin; block < end; block += kEagerCheckRows) {
+        if (hits != nullptr && hits->load(std::memory_order_relaxed) >= topK) {
+            return block - begin;
+        }
+        const size_t block_rows = std::min(kEagerCheckRows, end - block);
+        CosineSimilarity1xN(query, rows + block * dim, block_rows, dim, dim, true, scores);
+        for (size_t i = 0; i < block_rows; ++i) {
+            const float score = scores[i];
+            if (score < threshold) {
+                continue;
+            }
+            if (hits != nullptr) {
+                hits->fetch_add(1, std::memory_order_relaxed);
+            }
+            if (heap.size() < topK) {
+                heap.emplace_back(score, block + i);
+                std::push_heap(heap.begin(), heap.end(), ScoreGreater);
+            } else if (score > heap.front().first) {
+                std::pop_heap(heap.begin(), heap.end(), ScoreGreater);
+                heap.back() = ScoredRow(score, block + i);
+                std::push_heap(heap.begin(), heap.end(), ScoreGreater);
+            }
+        }
+    }
+    return end - begin;
+}
+
+void FaceGallery::ScanCodeShard(const Data& data, const uint64_t* code, size_t begin, size_t end, size_t keep,
+                                std::vector<ScoredRow>& heap) const {
+    heap.clear();
+    heap.reserve(keep);
+    const size_t words = data.hasher->Words();
+    const uint64_t* codes = data.codes.data();
+    for (size_t row = begin; row < end; ++row) {
+        // Negated so the same min-heap of scores keeps the smallest distances.
+        const float score = -static_cast<float>(SignHash::Distance(code, codes + row * words, words));
+        if (heap.size() < keep) {
+            heap.emplace_back(score, row);
+            std::push_heap(heap.begin(), heap.end(), ScoreGreater);
+        } else if (score > heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), ScoreGreater);
+            heap.back() = ScoredRow(score, row);
+            std::push_heap(heap.begin(), heap.end(), ScoreGreater);
+        }
+    }
+}
+
+void FaceGallery::ShortlistRows(const Data& data, const uint64_t* code, size_t candidates, SearchContext& context) const {
+    const size_t count = data.ids.size();
+    size_t shards = configuration_.search_shards > 0 ? static_cast<size_t>(configuration_.search_shards) : pool_->Size();
+    // Codes are 16x smaller than rows, so a shard needs proportionally more of them to pay off.
+    shards = std::max<size_t>(1, std::min(shards, count / (kMinRowsPerShard * 16)));
+    if (context.heaps_.size() < shards) {
+        context.heaps_.resize(shards);
+    }
+    if (shards == 1) {
+        ScanCodeShard(data, code, 0, count, candidates, context.heaps_[0]);
+    } else {
+        struct CodeScan {
+            const Data* data;
+            const uint64_t* code;
+            size_t count;
+            size_t candidates;
+            size_t rows_per_shard;
+            SearchContext* context;
+        } scan = {&data, code, count, candidates, (count + shards - 1) / shards, &context};
+        pool_->ParallelFor(shards, [this, &scan](size_t shard) {
+            size_t begin = shard * scan.rows_per_shard;
+            size_t end = std::min(scan.count, begin + scan.rows_per_shard);
+            ScanCodeShard(*scan.data, scan.code, begin, end, scan.candidates, scan.context->heaps_[shard]);
+        });
+    }
+    std::vector<ScoredRow>& merged = context.merged_;
+    for (size_t shard = 0; shard < shards; ++shard) {
+        merged.insert(merged.end(), context.heaps_[shard].begin(), context.heaps_[shard].end());
+    }
+    if (merged.size() > candidates) {
+        std::nth_element(merged.begin(), merged.begin() + candidates, merged.end(), ScoreGreater);
+        merged.resize(candidates);
+    }
+}
+
+size_t FaceGallery::ScanRows(const float* rows, size_t count, size_t dim, const float* query, size_t topK, float threshold,
+                             std::atomic<size_t>* hits, SearchContext& context) const {
+    const RowRange all(0, count);
+    return ScanRanges(rows, &all, 1, dim, query, topK, threshold, hits, context);
+}
+
+size_t FaceGallery::ScanRanges(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* query, size_t topK,
+                               float threshold, std::atomic<size_t>* hits, SearchContext& context) const {
+    size_t count = 0;
+    for (size_t i = 0; i < range_count; ++i) {
+        count += ranges[i].second - ranges[i].first;
+    }
+    size_t shards = configuration_.search_shards > 0 ? static_cast<size_t>(configuration_.search_shards) : pool_->Size();
+    shards = std::max<size_t>(1, std::min(shards, count / kMinRowsPerShard));
+    // Grow only: shrinking would free the heaps of the shards beyond this query.
+    if (context.heaps_.size() < shards) {
+        context.heaps_.resize(shards);
+    }
+    context.compared_.assign(shards, 0);
+
+    if (shards == 1) {
+        context.compared_[0] = ScanWindow(rows, ranges, range_count, dim, query, 0, count, topK, threshold, context.heaps_[0], hits);
+    } else {
+        struct ShardScan {
+            const float* rows;
+            const RowRange* ranges;
+            size_t range_count;
+            size_t count;
+            size_t dim;
+            const float* query;
+            size_t topK;
+            float threshold;
+            std::atomic<size_t>* hits;
+            size_t rows_per_shard;
+            SearchContext* context;
+        } scan = {rows, ranges, range_count, count, dim, query, topK, threshold, hits, (count + shards - 1) / shards, &context};
+        // Two pointers of capture fit std::function's inline buffer, so no allocation per query.
+        pool_->ParallelFor(shards, [this, &scan](size_t shard) {
+            size_t begin = shard * scan.rows_per_shard;
+            size_t end = std::min(scan.count, begin + scan.rows_per_shard);
+            scan.context->compared_[shard] = ScanWindow(scan.rows, scan.ranges, scan.range_count, scan.dim, scan.query, begin, end, scan.topK,
+                                                        scan.threshold, scan.context->heaps_[shard], scan.hits);
+        });
+    }
+    size_t compared = 0;
+    for (size_t shard = 0; shard < shards; ++shard) {
+        context.merged_.insert(context.merged_.end(), context.heaps_[shard].begin(), context.heaps_[shard].end());
+        compared += context.compared_[shard];
+    }
+    return compared;
+}
+
+size_t FaceGallery::ScanWindow(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* query, size_t begin,
+                               size_t end, size_t topK, float threshold, std::vector<ScoredRow>& heap, std::atomic<size_t>* hits) const {
+    heap.clear();
+    size_t compared = 0;
+    size_t offset = 0;  // Position of the current range in the concatenation
+    for (size_t i = 0; i < range_count && offset < end; ++i) {
+        const size_t length = ranges[i].second - ranges[i].first;
+        const size_t low = std::max(begin, offset);
+        const size_t high = std::min(end, offset + length);
+        if (low < high) {
+            compared += ScanShard(rows, dim, query, ranges[i].first + (low - offset), ranges[i].first + (high - offset), topK, threshold,
+                                  heap, hits);
+        }
+        offset += length;
+    }
+    return compared;
+}
+
+void FaceGallery::SelectPartitions(const Data& data, const std::vector<int32_t>& partitions, SearchContext& context) {
+    std::vector<RowRange>& ranges = context.ranges_;
+    ranges.clear();
+    const auto& existing = data.partition_ranges;
+    for (auto partition : partitions) {
+        auto it = std::lower_bound(existing.begin(), existing.end(), partition,
+                                   [](const PartitionRange& range, int32_t key) { return range.partition < key; });
+        if (it != existing.end() && it->partition == partition) {
+            ranges.emplace_back(it->begin, it->end);
+        }
+    }
+    // In row order the scan stays sequential, and a partition listed twice is scanned once.
+    std::sort(ranges.begin(), ranges.end());
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+}
+
+int32_t FaceGallery::SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                                           size_t topK) {
+    return SearchFaceFeatureTopK(queryFeature, searchResult, topK, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                                           size_t topK, SearchContext& context) {
+    searchResult.clear();
+    if (topK == 0) {
+        return HERR_INVALID_PARAM;
+    }
+    const int side = AcquireRead();
+    const Data& data = data_[side];
+    if (data.ids.empty()) {
+        ReleaseRead(side);
+        return HSUCCEED;
+    }
+    if (queryFeature.size() != data.dim) {
+        ReleaseRead(side);
+        return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+    }
+    std::vector<float>& query = context.query_;
+    query.resize(data.dim);
+    Normalize(queryFeature.data(), query.data(), data.dim);
+    const float threshold = threshold_.load();
+    const bool eager = configuration_.search_mode == inspire::SEARCH_MODE_EAGER;
+
+    std::vector<ScoredRow>& merged = context.merged_;
+    merged.clear();
+    size_t compared = 0;
+    std::atomic<size_t> hits(0);
+    const size_t candidates = std::max(topK, static_cast<size_t>(std::max(1, configuration_.prefilter_candidates)));
+    if (data.hasher && data.ids.size() > candidates) {
+        // Hash pass over every row, then the exact cosine of the shortlist only.
+        context.code_.resize(data.hasher->Words());
+        data.hasher->Encode(query.data(), context.code_.data(), context.hash_scratch_);
+        ShortlistRows(data, context.code_.data(), candidates, context);
+        size_t kept = 0;
+        for (const auto& candidate : merged) {
+            const float score = DotProduct(query.data(), data.Rows() + candidate.second * data.dim, data.dim);
+            if (score >= threshold) {
+                merged[kept++] = ScoredRow(score, candidate.second);
+            }
+        }
+        compared = merged.size();
+        merged.resize(kept);
+    } else if (eager) {
+        // Recently matched ids first: a returning face usually stops the search here.
+        for (size_t i = 0; i < hot_capacity_ && hits.load() < topK; ++i) {
+            const size_t row = data.index.Find(hot_[i].load(std::memory_order_relaxed));
+            // An id can sit twice in the ring; its row counts as one hit.
+            if (row != IdIndex::kNotFound && std::find_if(merged.begin(), merged.end(), [row](const ScoredRow& hot) {
+                                                 return hot.second == row;
+                                             }) == merged.end()) {
+                context.hot_heap_.clear();
+                compared += ScanShard(data.Rows(), data.dim, query.data(), row, row + 1, topK, threshold, context.hot_heap_, &hits);
+                merged.insert(merged.end(), context.hot_heap_.begin(), context.hot_heap_.end());
+            }
+        }
+    }
+
+    if (!data.hasher || data.ids.size() <= candidates) {
+        if (!eager || hits.load() < topK) {
+            // The full scan compares the hot rows again, so it counts its own hits: carrying the hot
+            // ones over would count those rows twice and stop before topK distinct rows match.
+            hits.store(0);
+            compared += ScanRows(data.Rows(), data.ids.size(), data.dim, query.data(), topK, threshold, eager ? &hits : nullptr, context);
+        }
+    }
+    if (eager) {
+        // A hot row can be compared twice (or sit twice in the ring); keep one entry per row.
+        std::sort(merged.begin(), merged.end(), [](const ScoredRow& a, const ScoredRow& b) { return a.second < b.second; });
+        merged.erase(std::unique(merged.begin(), merged.end(), [](const ScoredRow& a, const ScoredRow& b) { return a.second == b.second; }),
+                     merged.end());
+    }
+
+    size_t count = std::min(topK, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + count, merged.end(), ScoreGreater);
+    searchResult.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        searchResult[i].id = data.ids[merged[i].second];
+        searchResult[i].similarity = merged[i].first;
+    }
+    ReleaseRead(side);
+    queries_.fetch_add(1, std::memory_order_relaxed);
+    comparisons_.fetch_add(compared, std::memory_order_relaxed);
+    if (count > 0) {
+        MarkHot(searchResult[0].id);
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                                           size_t topK, const std::vector<int32_t>& partitions) {
+    return SearchFaceFeatureTopK(queryFeature, searchResult, topK, partitions, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                                           size_t topK, const std::vector<int32_t>& partitions, SearchContext& context) {
+    searchResult.clear();
+    if (topK == 0) {
+        return HERR_INVALID_PARAM;
+    }
+    const int side = AcquireRead();
+    const Data& data = data_[side];
+    if (data.ids.empty()) {
+        ReleaseRead(side);
+        return HSUCCEED;
+    }
+    if (queryFeature.size() != data.dim) {
+        ReleaseRead(side);
+        return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+    }
+    std::vector<float>& query = context.query_;
+    query.resize(data.dim);
+    Normalize(queryFeature.data(), query.data(), data.dim);
+    const float threshold = threshold_.load();
+
+    std::vector<ScoredRow>& merged = context.merged_;
+    merged.clear();
+    SelectPartitions(data, partitions, context);
+    const size_t compared = ScanRanges(data.Rows(), context.ranges_.data(), context.ranges_.size(), data.dim, query.data(), topK,
+                                       threshold, nullptr, context);
+
+    size_t count = std::min(topK, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + count, merged.end(), ScoreGreater);
+    searchResult.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        searchResult[i].id = data.ids[merged[i].second];
+        searchResult[i].similarity = merged[i].first;
+    }
+    ReleaseRead(side);
+    queries_.fetch_add(1, std::memory_order_relaxed);
+    comparisons_.fetch_add(compared, std::memory_order_relaxed);
+    if (count > 0) {
+        MarkHot(searchResult[0].id);
+    }
+    return HSUCCEED;
+}
+
+size_t FaceGallery::ScanNearest(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* queries,
+                                size_t query_count, std::vector<ScoredRow>& best) const {
+    const ScoredRow none(-std::numeric_limits<float>::infinity(), std::numeric_limits<size_t>::max());
+    best.assign(query_count, none);
+    size_t count = 0;
+    for (size_t i = 0; i < range_count; ++i) {
+        count += ranges[i].second - ranges[i].first;
+    }
+    if (count == 0 || query_count == 0) {
+        return 0;
+    }
+    size_t shards = configuration_.search_shards > 0 ? static_cast<size_t>(configuration_.search_shards) : pool_->Size();
+    shards = std::max<size_t>(1, std::min(shards, count / kMinRowsPerShard));
+    const size_t rows_per_shard = (count + shards - 1) / shards;
+    std::vector<std::vector<ScoredRow>> shard_best(shards);
+    auto scan = [&](size_t shard) {
+        std::vector<ScoredRow>& mine = shard_best[shard];
+        mine.assign(query_count, none);
+        std::vector<float> scores(query_count * kNearestBlockRows);
+        const size_t begin = shard * rows_per_shard;
+        const size_t end = std::min(count, begin + rows_per_shard);
+        size_t offset = 0;  // Position of the current range in the concatenation
+        for (size_t i = 0; i < range_count && offset < end; ++i) {
+            const size_t length = ranges[i].second - ranges[i].first;
+            const size_t low = ranges[i].first + (std::max(begin, offset) - offset);
+            const size_t high = ranges[i].first + (std::min(end, offset + length) - offset);
+            for (size_t row = low; row < high; row += kNearestBlockRows) {
+                const size_t block = std::min(kNearestBlockRows, high - row);
+                CosineSimilarityNxM(queries, query_count, dim, rows + row * dim, block, dim, dim, true, scores.data());
+                for (size_t q = 0; q < query_count; ++q) {
+                    const float* row_scores = scores.data() + q * block;
+                    for (size_t j = 0; j < block; ++j) {
+                        if (row_scores[j] > mine[q].first) {
+                            mine[q] = ScoredRow(row_scores[j], row + j);
+                        }
+                    }
+                }
+            }
+            offset += length;
+        }
+    };
+    if (shards == 1) {
+        scan(0);
+    } else {
+        pool_->ParallelFor(shards, scan);
+    }
+    // Shards are in row order and only a strictly better score replaces, so ties go to the lowest row.
+    for (size_t shard = 0; shard < shards; ++shard) {
+        for (size_t q = 0; q < query_count; ++q) {
+            if (shard_best[shard][q].first > best[q].first) {
+                best[q] = shard_best[shard][q];
+            }
+        }
+    }
+    return count * query_count;
+}
+
+int32_t FaceGallery::SearchNearestBatch(const std::vector<inspire::Embedded>& queries, std::vector<inspire::FaceSearchResult>& nearest) {
+    return SearchNearest(queries, nullptr, nearest);
+}
+
+int32_t FaceGallery::SearchNearestBatch(const std::vector<inspire::Embedded>& queries, const std::vector<int32_t>& partitions,
+                                        std::vector<inspire::FaceSearchResult>& nearest) {
+    return SearchNearest(queries, &partitions, nearest);
+}
+
+int32_t FaceGallery::SearchNearest(const std::vector<inspire::Embedded>& queries, const std::vector<int32_t>* partitions,
+                                   std::vector<inspire::FaceSearchResult>& nearest) {
+    nearest.assign(queries.size(), inspire::FaceSearchResult{-1, -1.0, {}});
+    if (queries.empty()) {
+        return HSUCCEED;
+    }
+    const int side = AcquireRead();
+    const Data& data = data_[side];
+    if (data.ids.empty()) {
+        ReleaseRead(side);
+        return HSUCCEED;
+    }
+    std::vector<float> matrix(queries.size() * data.dim);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        if (queries[q].size() != data.dim) {
+            ReleaseRead(side);
+            return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+        }
+        Normalize(queries[q].data(), matrix.data() + q * data.dim, data.dim);
+    }
+    std::vector<RowRange> all(1, RowRange(0, data.ids.size()));
+    const std::vector<RowRange>* ranges = &all;
+    SearchContext& context = ThreadSearchContext();
+    if (partitions != nullptr) {
+        SelectPartitions(data, *partitions, context);
+        ranges = &context.ranges_;
+    }
+    std::vector<ScoredRow> best;
+    const size_t compared = ScanNearest(data.Rows(), ranges->data(), ranges->size(), data.dim, matrix.data(), queries.size(), best);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        if (best[q].second != std::numeric_limits<size_t>::max()) {
+            nearest[q].id = data.ids[best[q].second];
+            nearest[q].similarity = best[q].first;
+        }
+    }
+    ReleaseRead(side);
+    queries_.fetch_add(queries.size(), std::memory_order_relaxed);
+    comparisons_.fetch_add(compared, std::memory_order_relaxed);
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                        size_t topK) {
+    return SearchIdentityTopK(queryFeature, searchResult, topK, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                        size_t topK, SearchContext& context) {
+    searchResult.clear();
+    if (topK == 0) {
+        return HERR_INVALID_PARAM;
+    }
+    const int side = AcquireRead();
+    const Data& data = data_[side];
+    if (data.ids.empty()) {
+        ReleaseRead(side);
+        return HSUCCEED;
+    }
+    if (queryFeature.size() != data.dim) {
+        ReleaseRead(side);
+        return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+    }
+    std::vector<float>& query = context.query_;
+    query.resize(data.dim);
+    Normalize(queryFeature.data(), query.data(), data.dim);
+    const float threshold = threshold_.load();
+
+    // Stage 1: closest centroids. No threshold here, a person's mean can sit below it while a template does not.
+    const size_t candidates = std::max(topK, static_cast<size_t>(std::max(1, configuration_.identity_candidates)));
+    std::vector<ScoredRow>& merged = context.merged_;
+    merged.clear();
+    size_t compared = ScanRows(data.centroids.data(), data.centroid_persons.size(), data.dim, query.data(), candidates,
+                               -std::numeric_limits<float>::infinity(), nullptr, context);
+    const size_t count = std::min(candidates, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + count, merged.end(), ScoreGreater);
+
+    // Stage 2: re-score the templates of the candidates.
+    for (size_t i = 0; i < count; ++i) {
+        IdentitySearchResult best;
+        best.person = data.centroid_persons[merged[i].second];
+        best.similarity = -std::numeric_limits<float>::infinity();
+        for (auto id : data.identities.at(best.person).members) {
+            const float score = DotProduct(query.data(), data.Rows() + data.index.Find(id) * data.dim, data.dim);
+            ++compared;
+            if (score > best.similarity) {
+                best.similarity = score;
+                best.id = id;
+            }
+        }
+        if (best.similarity >= threshold) {
+            searchResult.push_back(best);
+        }
+    }
+    ReleaseRead(side);
+
+    std::sort(searchResult.begin(), searchResult.end(),
+              [](const IdentitySearchResult& a, const IdentitySearchResult& b) { return a.similarity > b.similarity; });
+    if (searchResult.size() > topK) {
+        searchResult.resize(topK);
+    }
+    queries_.fetch_add(1, std::memory_order_relaxed);
+    comparisons_.fetch_add(compared, std::memory_order_relaxed);
+    if (!searchResult.empty()) {
+        MarkHot(searchResult[0].id);
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                        size_t topK, const std::vector<int32_t>& partitions) {
+    return SearchIdentityTopK(queryFeature, searchResult, topK, partitions, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                        size_t topK, const std::vector<int32_t>& partitions, SearchContext& context) {
+    searchResult.clear();
+    if (topK == 0) {
+        return HERR_INVALID_PARAM;
+    }
+    const int side = AcquireRead();
+    const Data& data = data_[side];
+    if (data.ids.empty()) {
+        ReleaseRead(side);
+        return HSUCCEED;
+    }
+    if (queryFeature.size() != data.dim) {
+        ReleaseRead(side);
+        return HERR_SESS_REC_CONTRAST_FEAT_ERR;
+    }
+    std::vector<float>& query = context.query_;
+    query.resize(data.dim);
+    Normalize(queryFeature.data(), query.data(), data.dim);
+    const float threshold = threshold_.load();
+
+    // A person scores as its best template, so templates below the threshold can be dropped during the scan.
+    const size_t candidates = std::max(topK, static_cast<size_t>(std::max(1, configuration_.identity_candidates)));
+    std::vector<ScoredRow>& merged = context.merged_;
+    merged.clear();
+    SelectPartitions(data, partitions, context);
+    const size_t compared = ScanRanges(data.Rows(), context.ranges_.data(), context.ranges_.size(), data.dim, query.data(), candidates,
+                                       threshold, nullptr, context);
+    const size_t count = std::min(candidates, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + count, merged.end(), ScoreGreater);
+    // Best first, so the first template of each person is its best one.
+    for (size_t i = 0; i < count && searchResult.size() < topK; ++i) {
+        const int64_t person = data.persons[merged[i].second];
+        bool seen = false;
+        for (const auto& result : searchResult) {
+            seen = seen || result.person == person;
+        }
+        if (!seen) {
+            IdentitySearchResult result;
+            result.person = person;
+            result.id = data.ids[merged[i].second];
+            result.similarity = merged[i].first;
+            searchResult.push_back(result);
+        }
+    }
+    ReleaseRead(side);
+    queries_.fetch_add(1, std::memory_order_relaxed);
+    comparisons_.fetch_add(compared, std::memory_order_relaxed);
+    if (!searchResult.empty()) {
+        MarkHot(searchResult[0].id);
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::SearchFaceFeature(const inspire::Embedded& queryFeature, inspire::FaceSearchResult& searchResult) {
+    return SearchFaceFeature(queryFeature, searchResult, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchFaceFeature(const inspire::Embedded& queryFeature, inspire::FaceSearchResult& searchResult,
+                                       SearchContext& context) {
+    std::vector<inspire::FaceSearchResult>& results = context.results_;
+    int32_t ret = SearchFaceFeatureTopK(queryFeature, results, 1, context);
+    if (ret != HSUCCEED) {
+        return ret;
+    }
+    if (results.empty()) {
+        searchResult.id = INSPIRE_INVALID_ID;
+        searchResult.similarity = 0.0;
+        searchResult.feature.clear();
+    } else {
+        searchResult = results[0];
+    }
+    return HSUCCEED;
+}
+
+int32_t FaceGallery::SearchTrackTopK(int64_t track, const inspire::Embedded& queryFeature,
+                                     std::vector<inspire::FaceSearchResult>& searchResult, size_t topK) {
+    return SearchTrackTopK(track, queryFeature, searchResult, topK, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchTrackTopK(int64_t track, const inspire::Embedded& queryFeature,
+                                     std::vector<inspire::FaceSearchResult>& searchResult, size_t topK, SearchContext& context) {
+    if (track < 0 || cache_.empty()) {
+        return SearchFaceFeatureTopK(queryFeature, searchResult, topK, context);
+    }
+    // Read before searching: a publish racing with the search leaves the entry on the older version, which only costs a miss.
+    const uint64_t version = version_.load();
+    const float threshold = threshold_.load();
+    std::vector<IdentitySearchResult>& cached = context.cached_;
+    if (LookupCachedQuery(track, false, topK, version, threshold, queryFeature, cached)) {
+        searchResult.resize(cached.size());
+        for (size_t i = 0; i < cached.size(); ++i) {
+            searchResult[i].id = cached[i].id;
+            searchResult[i].similarity = cached[i].similarity;
+        }
+        return HSUCCEED;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    int32_t ret = SearchFaceFeatureTopK(queryFeature, searchResult, topK, context);
+    if (ret == HSUCCEED) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        cached.resize(searchResult.size());
+        for (size_t i = 0; i < searchResult.size(); ++i) {
+            cached[i].person = INSPIRE_INVALID_ID;
+            cached[i].id = searchResult[i].id;
+            cached[i].similarity = searchResult[i].similarity;
+        }
+        StoreCachedQuery(track, false, topK, version, threshold, queryFeature, cached, elapsed.count());
+    }
+    return ret;
+}
+
+int32_t FaceGallery::SearchTrackIdentityTopK(int64_t track, const inspire::Embedded& queryFeature,
+                                             std::vector<IdentitySearchResult>& searchResult, size_t topK) {
+    return SearchTrackIdentityTopK(track, queryFeature, searchResult, topK, ThreadSearchContext());
+}
+
+int32_t FaceGallery::SearchTrackIdentityTopK(int64_t track, const inspire::Embedded& queryFeature,
+                                             std::vector<IdentitySearchResult>& searchResult, size_t topK, SearchContext& context) {
+    if (track < 0 || cache_.empty()) {
+        return SearchIdentityTopK(queryFeature, searchResult, topK, context);
+    }
+    const uint64_t version = version_.load();
+    const float threshold = threshold_.load();
+    if (LookupCachedQuery(track, true, topK, version, threshold, queryFeature, searchResult)) {
+        return HSUCCEED;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    int32_t ret = SearchIdentityTopK(queryFeature, searchResult, topK, context);
+    if (ret == HSUCCEED) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        StoreCachedQuery(track, true, topK, version, threshold, queryFeature, searchResult, elapsed.count());
+    }
+    return ret;
+}
+
+bool FaceGallery::LookupCachedQuery(int64_t track, bool identity, size_t topK, uint64_t version, float threshold,
+                                    const inspire::Embedded& query, std::vector<IdentitySearchResult>& results) {
+    const auto start = std::chrono::steady_clock::now();
+    cache_lookups_.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    for (auto& entry : cache_) {
+        if (entry.track != track) {
+            continue;
+        }
+        if (entry.identity != identity || entry.topK != topK || entry.version != version || entry.threshold != threshold ||
+            entry.query.size() != query.size()) {
+            return false;
+        }
+        // cos(query, entry.query) >= 1 - epsilon, with entry.query already unit length.
+        const float norm = std::sqrt(DotProduct(query.data(), query.data(), query.size()));
+        const float dot = DotProduct(query.data(), entry.query.data(), query.size());
+        if (norm <= 0.0f || dot < (1.0f - configuration_.query_cache_epsilon) * norm) {
+            return false;
+        }
+        results.assign(entry.results.begin(), entry.results.end());
+        entry.last_use = ++cache_clock_;
+        const uint64_t own_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        cache_hits_.fetch_add(1, std::memory_order_relaxed);
+        cache_saved_ns_.fetch_add(entry.search_ns > own_ns ? entry.search_ns - own_ns : 0, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void FaceGallery::StoreCachedQuery(int64_t track, bool identity, size_t topK, uint64_t version, float threshold,
+                                   const inspire::Embedded& query, const std::vector<IdentitySearchResult>& results, uint64_t search_ns) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    CachedQuery* slot = nullptr;
+    for (auto& entry : cache_) {
+        if (entry.track == track) {
+            slot = &entry;
+            break;
+        }
+        if (slot == nullptr || entry.last_use < slot->last_use) {
+            slot = &entry;
+        }
+    }
+    slot->track = track;
+    slot->identity = identity;
+    slot->topK = topK;
+    slot->version = version;
+    slot->threshold = threshold;
+    slot->query.resize(query.size());
+    Normalize(query.data(), slot->query.data(), query.size());
+    slot->results.assign(results.begin(), results.end());
+    slot->search_ns = search_ns;
+    slot->last_use = ++cache_clock_;
+}
+
+void FaceGallery::MarkHot(int64_t id) {
+    if (hot_capacity_ == 0) {
+        return;
+    }
+    for (size_t i = 0; i < hot_capacity_; ++i) {
+        if (hot_[i].load(std::memory_order_relaxed) == id) {
+            return;
+        }
+    }
+    // Overwrite the oldest slot; concurrent callers may race for a slot, which only costs a hot entry.
+    hot_[hot_cursor_.fetch_add(1, std::memory_order_relaxed) % hot_capacity_].store(id, std::memory_order_relaxed);
+}
+
+SearchStatistics FaceGallery::GetSearchStatistics() const {
+    SearchStatistics statistics;
+    statistics.queries = queries_.load();
+    statistics.comparisons = comparisons_.load();
+    statistics.cache_lookups = cache_lookups_.load();
+    statistics.cache_hits = cache_hits_.load();
+    statistics.cache_saved_ns = cache_saved_ns_.load();
+    return statistics;
+}
+
+void FaceGallery::ResetSearchStatistics() {
+    queries_.store(0);
+    comparisons_.store(0);
+    cache_lookups_.store(0);
+    cache_hits_.store(0);
+    cache_saved_ns_.store(0);
+}
+
+void FaceGallery::SetRecognitionThreshold(float threshold) {
+    threshold_.store(threshold);
+}
+
+size_t FaceGallery::Size() const {
+    int side = AcquireRead();
+    size_t size = data_[side].ids.size();
+    ReleaseRead(side);
+    return size;
+}
+
+int32_t FaceGallery::GetFaceFeature(int64_t id, inspire::Embedded& feature) const {
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    const size_t row = data.index.Find(id);
+    if (row != IdIndex::kNotFound) {
+        feature.assign(data.Rows() + row * data.dim, data.Rows() + (row + 1) * data.dim);
+    }
+    ReleaseRead(side);
+    return row != IdIndex::kNotFound ? HSUCCEED : HERR_FT_HUB_NOT_FOUND_FEATURE;
+}
+
+int32_t FaceGallery::GetFaceLabel(int64_t id, int64_t& person, int32_t& partition) const {
+    int side = AcquireRead();
+    const Data& data = data_[side];
+    const size_t row = data.index.Find(id);
+    if (row != IdIndex::kNotFound) {
+        person = data.persons[row];
+        partition = data.partitions[row];
+    }
+    ReleaseRead(side);
+    return row != IdIndex::kNotFound ? HSUCCEED : HERR_FT_HUB_NOT_FOUND_FEATURE;
+}
+
+void FaceGallery::GetExistingIds(std::vector<int64_t>& ids) const {
+    int side = AcquireRead();
+    ids = data_[side].ids;
+    ReleaseRead(side);
+}
+
+size_t FaceGallery::PartitionSize(int32_t partition) const {
+    int side = AcquireRead();
+    const auto& ranges = data_[side].partition_ranges;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), partition,
+                               [](const PartitionRange& range, int32_t key) { return range.partition < key; });
+    const size_t size = it != ranges.end() && it->partition == partition ? it->end - it->begin : 0;
+    ReleaseRead(side);
+    return size;
+}
+
+size_t FaceGallery::IdentityCount() const {
+    int side = AcquireRead();
+    size_t count = data_[side].centroid_persons.size();
+    ReleaseRead(side);
+    return count;
+}
+
+int64_t FaceGallery::MaxPerson() const {
+    int side = AcquireRead();
+    const auto& persons = data_[side].centroid_persons;
+    int64_t person = persons.empty() ? -1 : *std::max_element(persons.begin(), persons.end());
+    ReleaseRead(side);
+    return person;
+}
+
+size_t FaceGallery::Dimension() const {
+    int side = AcquireRead();
+    size_t dim = data_[side].dim;
+    ReleaseRead(side);
+    return dim;
+}
+
+uint64_t FaceGallery::Version() const {
+    return version_.load();
+}
+
+}  // namespace gallery
@@ -0,0 +1,753 @@
+#pragma once
+#ifndef GALLERY_FACE_GALLERY_H
+#define GALLERY_FACE_GALLERY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <inspireface/inspireface.hpp>
+#include "gallery_mutation.h"
+#include "id_index.h"
+#include "sign_hash.h"
+#include "gallery_snapshot.h"
+#include "gallery_wal.h"
+#include "thread_pool.h"
+
+namespace gallery {
+
+/**
+ * @struct GalleryConfiguration
+ * @brief Search settings of an in-memory face gallery.
+ */
+struct GalleryConfiguration {
+    float recognition_threshold = 0.48f;  ///< Cosine threshold a match must reach
+    int32_t search_threads = 0;           ///< Worker threads of the sharded scan (0: one per usable core)
+    int32_t search_shards = 0;            ///< Shards a query is split into (0: one per worker thread)
+    bool big_cores_only = false;          ///< Pin search workers to the big cores of a big.LITTLE SoC
+    inspire::SearchMode search_mode = inspire::SEARCH_MODE_EXHAUSTIVE;  ///< EAGER stops once topK rows reach the threshold
+    int32_t hot_ids = 64;                 ///< Recently matched ids an eager search compares first
+    int32_t identity_candidates = 8;      ///< Identities whose templates an identity search re-scores (at least topK)
+    bool hash_prefilter = false;          ///< Shortlist rows by sign-hash Hamming distance before the exact cosine pass (overrides EAGER)
+    int32_t prefilter_candidates = 256;   ///< Rows the hash pass keeps for re-ranking (more: better recall, slower)
+    bool hash_rotation = false;           ///< Randomly rotate embeddings before taking their sign bits
+    int32_t query_cache_tracks = 0;       ///< Tracks whose last result SearchTrackTopK/SearchTrackIdentityTopK cache (0: no cache)
+    float query_cache_epsilon = 0.01f;    ///< A cached result is reused while the query's cosine to the cached query is >= 1 - epsilon
+    inspire::PrimaryKeyMode primary_key_mode = inspire::PrimaryKeyMode::AUTO_INCREMENT;  ///< Mode of the hub; inserts keep caller ids only in MANUAL_INPUT
+};
+
+/**
+ * @struct IdentitySearchResult
+ * @brief Person-level search result.
+ */
+struct IdentitySearchResult {
+    int64_t person = INSPIRE_INVALID_ID;  ///< Person id
+    int64_t id = INSPIRE_INVALID_ID;      ///< Id of the best matching template of the person
+    float similarity = 0.0f;              ///< Cosine similarity of that template
+};
+
+/**
+ * @struct SearchStatistics
+ * @brief Work counters of the searches run on a gallery.
+ */
+struct SearchStatistics {
+    uint64_t queries = 0;      ///< Searches run
+    uint64_t comparisons = 0;  ///< Rows whose exact cosine was computed, summed over all searches (hash-only comparisons excluded)
+    uint64_t cache_lookups = 0;   ///< Track searches that consulted the query cache
+    uint64_t cache_hits = 0;      ///< Track searches answered from the query cache, not counted in queries
+    uint64_t cache_saved_ns = 0;  ///< Time the hits saved: duration of each reused search minus the hit's own
+};
+
+/**
+ * @struct WriteBehindConfiguration
+ * @brief Durability policy of the write-behind mode.
+ *
+ * Mutations are applied to memory and appended to the write-ahead log at once; a background
+ * thread checkpoints them into FeatureHubDB when either trigger fires. The hub stores only
+ * features, so a checkpoint also appends the persons and partitions of its rows to labels_path
+ * and syncs it before the log records are dropped.
+ */
+struct WriteBehindConfiguration {
+    std::string wal_path;                   ///< Write-ahead log file
+    std::string labels_path;                ///< Label file a hub checkpoint appends the persons and partitions of its rows to
+    int32_t checkpoint_interval_ms = 1000;  ///< Checkpoint pending mutations this often (0: no timed checkpoint)
+    int32_t checkpoint_ops = 256;           ///< Checkpoint once this many mutations are pending (0: no count trigger)
+    bool strict = false;                    ///< Sync the log before a write returns, so no acknowledged write is lost on a crash
+};
+
+/**
+ * @class SearchContext
+ * @brief Result buffers and scratch heaps of one search at a time.
+ *
+ * Searches write only to the context and the caller's result vector, so threads that each
+ * pass their own context can search concurrently. The buffers keep their capacity between
+ * searches: after the first few queries a search with a reused context does not allocate.
+ * A context must not be shared by two searches running at the same time.
+ */
+class SearchContext {
+public:
+    /**
+     * @param max_top_k Largest topK the context is sized for up front; it grows if exceeded.
+     */
+    explicit SearchContext(size_t max_top_k = 16);
+
+private:
+    friend class FaceGallery;
+
+    std::vector<float> query_;                                      ///< Normalized query
+    std::vector<std::vector<std::pair<float, size_t>>> heaps_;      ///< Per-shard top-K heaps
+    std::vector<size_t> compared_;                                  ///< Per-shard comparison counts
+    std::vector<std::pair<float, size_t>> hot_heap_;                ///< Heap of one hot row
+    std::vector<std::pair<float, size_t>> merged_;                  ///< Candidates of all shards
+    std::vector<inspire::FaceSearchResult> results_;                ///< Scratch of SearchFaceFeature
+    std::vector<uint64_t> code_;                                    ///< Sign-hash code of the query
+    std::vector<float> hash_scratch_;                               ///< Rotation buffer of the query code
+    std::vector<IdentitySearchResult> cached_;                      ///< Result exchanged with the query cache
+    std::vector<std::pair<size_t, size_t>> ranges_;                 ///< Row ranges a partition-filtered search scans
+};
+
+/**
+ * @class FaceGallery
+ * @brief Dense in-memory copy of the FeatureHubDB features, scanned in parallel.
+ *
+ * FeatureHubDB stays the storage of record; the gallery mirrors its rows into one
+ * contiguous, L2-normalized matrix so a query can be split into shards and scanned by
+ * a persistent thread pool. Each shard keeps its own top-K heap and the heaps are merged.
+ *
+ * Rows are found by id through an open-addressing index, and a removal moves the last
+ * row into the hole, so single-id operations are constant-time and the matrix stays dense.
+ *
+ * With hash_prefilter set, every row also carries a sign-hash code (SignHash). Searches
+ * then rank all codes by Hamming distance and compute the exact cosine for the best
+ * prefilter_candidates rows only; recall versus exhaustive search is tuned by that count.
+ *
+ * Every row is a template of a person (by default its own id). The gallery keeps one
+ * normalized centroid per person, so an identity search can scan the centroids first and
+ * re-score only the templates of the best candidates.
+ *
+ * Every row also belongs to a partition (a site, a group, a validity period; 0 unless set).
+ * Rows of a partition are kept contiguous, in ascending partition order, so a search
+ * restricted to some partitions scans only their row ranges. Keeping them contiguous costs
+ * an insertion or removal one row move per partition behind the row's own.
+ *
+ * Reads never take a lock, and every search has a SearchContext overload for callers
+ * that want allocation-free searches; the other overloads use a per-thread context. The gallery keeps two copies of its data (left-right scheme):
+ * searches pin the published copy with an atomic reader count, while a writer applies its
+ * batch to the other copy, publishes it with one atomic store, waits for the readers of
+ * the old copy to drain and then replays the batch there. Writers are serialized.
+ */
+class FaceGallery {
+public:
+    explicit FaceGallery(const GalleryConfiguration& configuration = GalleryConfiguration());
+    ~FaceGallery();
+
+    FaceGallery(const FaceGallery&) = delete;
+    FaceGallery& operator=(const FaceGallery&) = delete;
+
+    /**
+     * @brief Replaces the gallery contents with every feature stored in the hub.
+     *
+     * The hub becomes the storage the FaceFeature* write methods go through.
+     * @param hub Enabled FeatureHubDB instance.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t LoadFromHub(const std::shared_ptr<inspire::FeatureHubDB>& hub);
+
+    /**
+     * @brief Replaces the gallery contents with a memory-mapped snapshot file.
+     *
+     * The embedding matrix is not copied; searches read the mapping until the first mutation.
+     * The payload checksum is verified by default, so a file torn or corrupted after its header
+     * is never served; the pass reads the whole file once, which also warms the page cache.
+     * @param path Snapshot file written by SaveSnapshot.
+     * @param expected_stamp Stamp the snapshot must have been built from (see FileSourceStamp).
+     * @param verify_payload Verify the payload checksum; only skip it for a file just verified.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED if the snapshot is missing, corrupt or stale.
+     */
+    int32_t LoadFromSnapshot(const std::string& path, uint64_t expected_stamp, bool verify_payload = true);
+
+    /**
+     * @brief Assigns templates to persons from a label file written by SaveIdentityLabels.
+     *
+     * FeatureHubDB only stores features, so person labels live in this side file. Ids that
+     * are not in the gallery are skipped; a missing file leaves every row its own person.
+     * @param path Text file of "id person" lines.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t LoadIdentityLabels(const std::string& path);
+
+    /**
+     * @brief Writes the person of every template that does not form its own person.
+     * @param path Destination file, replaced atomically.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t SaveIdentityLabels(const std::string& path) const;
+
+    /**
+     * @brief Appends the labels of some templates to a label file.
+     *
+     * Later lines of a label file override earlier ones, so appending after each insert batch
+     * keeps the file current without rewriting it; SaveIdentityLabels compacts it again. The
+     * lines are synced before it returns; a line cut short by a crash is dropped, by this
+     * method before it appends and by LoadIdentityLabels when it reads the file.
+     * @param path Label file, created if missing.
+     * @param ids Templates to write; ids not in the gallery are skipped.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t AppendIdentityLabels(const std::string& path, const std::vector<int64_t>& ids) const;
+
+    /**
+     * @brief Writes the published gallery contents to a snapshot file.
+     * @param path Destination file, replaced atomically.
+     * @param source_stamp Stamp of the storage the contents came from.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t SaveSnapshot(const std::string& path, uint64_t source_stamp) const;
+
+    /**
+     * @brief Streams the published gallery contents to a chunked, checksummed export file.
+     *
+     * Unlike a snapshot, an export is not tied to the storage it came from: it is meant to
+     * be copied to other devices and merged into their galleries with ImportSnapshot.
+     * Writers wait until the export is done.
+     * @param path Destination file, replaced atomically.
+     * @param fp16 Store embeddings as float16, halving the file.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t ExportSnapshot(const std::string& path, bool fp16 = false) const;
+
+    /**
+     * @brief Merges an export file into the gallery, one chunk per published batch.
+     *
+     * Every row is upserted with its id and person, through the hub like the FaceFeature*
+     * methods (logged only, in write-behind mode), so rows with new ids are added and rows
+     * with existing ids are replaced. The hub must be in PrimaryKeyMode::MANUAL_INPUT to keep
+     * the exported ids; a gallery without a hub imports into memory only.
+     * @param path Export file written by ExportSnapshot.
+     * @param imported Optional output: number of rows imported, also on failure.
+     * @return int32_t Status code; on a corrupt chunk the chunks before it stay imported.
+     */
+    int32_t ImportSnapshot(const std::string& path, size_t* imported = nullptr);
+
+    /**
+     * @brief Inserts a face feature into the hub and the gallery.
+     * @param feature Vector of floats representing the face feature.
+     * @param id ID for the feature (ignored by auto-increment hubs).
+     * @param result_id Output parameter to store the resulting ID.
+     * @return int32_t Status code of the insertion operation.
+     */
+    int32_t FaceFeatureInsert(const std::vector<float>& feature, int32_t id, int64_t& result_id);
+
+    /**
+     * @brief Inserts many face features into the hub and publishes them to the gallery as one version.
+     *
+     * Search structures are updated once per batch instead of once per feature.
+     * @param features Face features to insert.
+     * @param ids Empty for auto-increment hubs, otherwise the custom id of every feature; ignored
+     *            unless primary_key_mode is MANUAL_INPUT, so a zeroed id never overwrites a row.
+     *            On return, the ids of the features that were inserted, in input order.
+     * @return int32_t Status code; on failure the features before the failing one stay inserted.
+     */
+    int32_t FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids);
+
+    /**
+     * @brief Inserts many face features as templates of the given persons.
+     * @param persons Person of every feature; empty makes each feature its own person.
+     * @see FaceFeatureInsertBatch
+     */
+    int32_t FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids,
+                                   const std::vector<int64_t>& persons);
+
+    /**
+     * @brief Inserts many face features as templates of the given persons into the given partitions.
+     * @param partitions Partition of every feature (non-negative); empty puts every feature in partition 0.
+     * @see FaceFeatureInsertBatch
+     */
+    int32_t FaceFeatureInsertBatch(const std::vector<inspire::Embedded>& features, std::vector<int64_t>& ids,
+                                   const std::vector<int64_t>& persons, const std::vector<int32_t>& partitions);
+
+    /**
+     * @brief Moves a face feature to another partition.
+     *
+     * Partitions are not stored in the hub; like person labels they are saved by SaveIdentityLabels.
+     * @param id ID of the feature to move.
+     * @param partition Destination partition, non-negative.
+     * @return int32_t Status code; HERR_FT_HUB_NOT_FOUND_FEATURE if the id is not in the gallery.
+     */
+    int32_t FaceFeatureSetPartition(int32_t id, int32_t partition);
+
+    /**
+     * @brief Updates a face feature in the hub and the gallery.
+     * @param feature Vector of floats representing the new face feature.
+     * @param customId ID of the feature to update.
+     * @return int32_t Status code of the update operation.
+     */
+    int32_t FaceFeatureUpdate(const std::vector<float>& feature, int32_t customId);
+
+    /**
+     * @brief Removes a face feature from the hub and the gallery.
+     * @param id ID of the feature to remove.
+     * @return int32_t Status code of the removal operation.
+     */
+    int32_t FaceFeatureRemove(int32_t id);
+
+    /**
+     * @brief Switches the FaceFeature* write methods to write-behind mode.
+     *
+     * Records left in the log by a previous run are replayed into the hub first. Because ids
+     * are assigned when a mutation is logged, the hub must be enabled with
+     * PrimaryKeyMode::MANUAL_INPUT. Load the label file with LoadIdentityLabels before this call;
+     * DisableWriteBehind compacts it.
+     * @param configuration Log file, label file and durability policy.
+     * @return int32_t Status code; HERR_INVALID_PARAM if wal_path or labels_path is empty.
+     */
+    int32_t EnableWriteBehind(const WriteBehindConfiguration& configuration);
+
+    /**
+     * @brief Makes a directory the storage of this gallery, in place of the FeatureHubDB.
+     *
+     * FeatureHubDB is a process-wide singleton, so galleries that need storage of their own
+     * (a watchlist per site, a VIP list, a blocklist) keep it in a directory instead: a
+     * snapshot plus a write-ahead log. The gallery contents are replaced with the snapshot,
+     * the log is replayed, and the gallery runs in write-behind mode against the store: the
+     * FaceFeature* methods log and apply mutations at once. A checkpoint syncs the log, and
+     * compacts the gallery into a new snapshot only once the log holds a quarter of the rows,
+     * so snapshot rewrites cost amortized O(1) per mutation. Flush and DisableWriteBehind (or
+     * destruction) always compact; DisableWriteBehind closes the store.
+     * @param directory Store directory, created if missing (its parent must exist).
+     * @param configuration Checkpoint policy; wal_path is ignored.
+     * @return int32_t Status code; HERR_INVALID_PARAM if the gallery is bound to a hub.
+     */
+    int32_t OpenStore(const std::string& directory, const WriteBehindConfiguration& configuration);
+
+    /**
+     * @brief Loads a store into memory for searching only.
+     *
+     * The snapshot is loaded and the log replayed into memory as by OpenStore, but nothing in
+     * the directory is created or changed, no log is opened and no checkpoint thread starts.
+     * The FaceFeature* write methods fail as on a gallery without storage.
+     * @param directory Existing store directory.
+     * @return int32_t Status code; HERR_INVALID_PARAM if the directory does not exist or the gallery is bound to a hub.
+     */
+    int32_t OpenStoreReadOnly(const std::string& directory);
+
+    /**
+     * @brief Checkpoints all pending mutations into the hub (or a new store snapshot) and blocks until they are stored.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Flush();
+
+    /**
+     * @brief Flushes pending mutations, stops the checkpoint thread and returns to write-through mode.
+     * @return int32_t Status code of the final checkpoint.
+     */
+    int32_t DisableWriteBehind();
+
+    /**
+     * @brief Applies a batch of mutations and publishes them as one new gallery version.
+     * @param batch Mutations, applied in order.
+     * @return int32_t HSUCCEED, or the error of the last mutation that could not be applied.
+     */
+    int32_t Apply(const std::vector<GalleryMutation>& batch);
+
+    /**
+     * @brief Reserves room for rows features of dimension dim, so a bulk load grows without reallocating.
+     *
+     * Both copies are reserved, which takes one publish; the contents do not change.
+     */
+    void Reserve(size_t rows, size_t dim);
+
+    /**
+     * @brief Adds a feature, or replaces it when the id already exists.
+     * @param id Custom id of the feature.
+     * @param feature Feature vector, normalized on insertion.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Insert(int64_t id, const inspire::Embedded& feature);
+
+    /**
+     * @brief Removes a feature by its id.
+     * @param id Custom id of the feature.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Remove(int64_t id);
+
+    /**
+     * @brief Searches for the most similar feature above the recognition threshold.
+     * @param queryFeature Embedded feature to search for.
+     * @param searchResult Best match; id is INSPIRE_INVALID_ID when nothing reaches the threshold.
+     * @return int32_t Status code of the search operation.
+     */
+    int32_t SearchFaceFeature(const inspire::Embedded& queryFeature, inspire::FaceSearchResult& searchResult);
+
+    /**
+     * @brief SearchFaceFeature with caller-owned scratch buffers.
+     */
+    int32_t SearchFaceFeature(const inspire::Embedded& queryFeature, inspire::FaceSearchResult& searchResult, SearchContext& context);
+
+    /**
+     * @brief Searches for the top k features above the recognition threshold, best first.
+     * @param queryFeature Embedded feature to search for.
+     * @param searchResult Vector to store search results.
+     * @param topK Maximum number of results to return.
+     * @return int32_t Status code of the search operation.
+     */
+    int32_t SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult, size_t topK);
+
+    /**
+     * @brief SearchFaceFeatureTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult, size_t topK,
+                                  SearchContext& context);
+
+    /**
+     * @brief Searches for the top k features of some partitions above the recognition threshold, best first.
+     *
+     * Only the row ranges of the listed partitions are scanned, exhaustively: the cost is
+     * proportional to their size, not to the gallery's. Partitions that do not exist are skipped.
+     * @param partitions Partitions to search.
+     */
+    int32_t SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult, size_t topK,
+                                  const std::vector<int32_t>& partitions);
+
+    /**
+     * @brief Partition-filtered SearchFaceFeatureTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchFaceFeatureTopK(const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult, size_t topK,
+                                  const std::vector<int32_t>& partitions, SearchContext& context);
+
+    /**
+     * @brief Finds the most similar feature of every query in one pass, regardless of the recognition threshold.
+     *
+     * The queries are scored against blocks of rows with the NxM kernel, so each row is read
+     * once for the whole batch rather than once per query; the blocks are split over the
+     * search pool. Meant for batches of tens to a few hundred queries, such as checking new
+     * embeddings for duplicates before they are inserted.
+     * @param queries Embedded features to search for.
+     * @param nearest Output, one entry per query: the best feature and its cosine, or id -1 if the gallery is empty.
+     * @return int32_t Status code of the search operation.
+     */
+    int32_t SearchNearestBatch(const std::vector<inspire::Embedded>& queries, std::vector<inspire::FaceSearchResult>& nearest);
+
+    /**
+     * @brief SearchNearestBatch over the rows of some partitions only.
+     * @param partitions Partitions to search; id -1 comes back if none of them exists.
+     */
+    int32_t SearchNearestBatch(const std::vector<inspire::Embedded>& queries, const std::vector<int32_t>& partitions,
+                               std::vector<inspire::FaceSearchResult>& nearest);
+
+    /**
+     * @brief Searches for the most similar persons above the recognition threshold, best first.
+     *
+     * Scans the person centroids, then re-scores the templates of the best
+     * identity_candidates persons; a person scores as its best template.
+     * @param queryFeature Embedded feature to search for.
+     * @param searchResult Vector to store search results, one entry per person.
+     * @param topK Maximum number of persons to return.
+     * @return int32_t Status code of the search operation.
+     */
+    int32_t SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult, size_t topK);
+
+    /**
+     * @brief SearchIdentityTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult, size_t topK,
+                               SearchContext& context);
+
+    /**
+     * @brief Searches for the most similar persons among the templates of some partitions, best first.
+     *
+     * Centroids mix the templates of all partitions, so this scans the template rows of the
+     * listed partitions instead, keeps the best identity_candidates (at least topK) of them and
+     * returns one entry per person, scored by its best template in those partitions. Fewer than
+     * topK persons come back only when the kept templates belong to fewer persons.
+     * @param partitions Partitions to search.
+     */
+    int32_t SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult, size_t topK,
+                               const std::vector<int32_t>& partitions);
+
+    /**
+     * @brief Partition-filtered SearchIdentityTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchIdentityTopK(const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult, size_t topK,
+                               const std::vector<int32_t>& partitions, SearchContext& context);
+
+    /**
+     * @brief SearchFaceFeatureTopK for the face of a tracker track, answered from the query cache when possible.
+     *
+     * A still face yields nearly identical embeddings frame after frame. The last result of
+     * each track is cached with its query; it is returned without a scan while the new query
+     * is within query_cache_epsilon of the cached one, topK is the same and neither the gallery
+     * version nor the threshold has changed. Every published mutation bumps the version, so a
+     * cached result never outlives the data it was computed from.
+     * @param track Tracker id of the face; negative ids bypass the cache.
+     */
+    int32_t SearchTrackTopK(int64_t track, const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                            size_t topK);
+
+    /**
+     * @brief SearchTrackTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchTrackTopK(int64_t track, const inspire::Embedded& queryFeature, std::vector<inspire::FaceSearchResult>& searchResult,
+                            size_t topK, SearchContext& context);
+
+    /**
+     * @brief SearchIdentityTopK for the face of a tracker track, answered from the query cache when possible.
+     * @param track Tracker id of the face; negative ids bypass the cache.
+     */
+    int32_t SearchTrackIdentityTopK(int64_t track, const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                    size_t topK);
+
+    /**
+     * @brief SearchTrackIdentityTopK with caller-owned scratch buffers.
+     */
+    int32_t SearchTrackIdentityTopK(int64_t track, const inspire::Embedded& queryFeature, std::vector<IdentitySearchResult>& searchResult,
+                                    size_t topK, SearchContext& context);
+
+    /**
+     * @brief Moves an id to the front of the eager scan order.
+     *
+     * Matched ids are recorded automatically; callers can also promote ids they expect,
+     * such as the identities of faces currently being tracked.
+     * @param id Custom id of the feature.
+     */
+    void MarkHot(int64_t id);
+
+    /**
+     * @brief Counters of the searches run since construction or the last reset.
+     */
+    SearchStatistics GetSearchStatistics() const;
+
+    /**
+     * @brief Resets the search counters.
+     */
+    void ResetSearchStatistics();
+
+    /**
+     * @brief Sets the recognition threshold.
+     * @param threshold Cosine threshold a match must reach.
+     */
+    void SetRecognitionThreshold(float threshold);
+
+    /**
+     * @brief Copies the stored (L2-normalized) feature of an id, in constant time.
+     * @param id Custom id of the feature.
+     * @param feature Output feature.
+     * @return int32_t HSUCCEED, or HERR_FT_HUB_NOT_FOUND_FEATURE if the id is not in the gallery.
+     */
+    int32_t GetFaceFeature(int64_t id, inspire::Embedded& feature) const;
+
+    /**
+     * @brief Gets the person and partition of a feature by its id.
+     * @return int32_t HSUCCEED, or HERR_FT_HUB_NOT_FOUND_FEATURE if the id is not in the gallery.
+     */
+    int32_t GetFaceLabel(int64_t id, int64_t& person, int32_t& partition) const;
+
+    /**
+     * @brief Copies the ids of the published gallery contents, in row order.
+     */
+    void GetExistingIds(std::vector<int64_t>& ids) const;
+
+    /**
+     * @brief Number of features in the gallery.
+     */
+    size_t Size() const;
+
+    /**
+     * @brief Number of features in a partition.
+     */
+    size_t PartitionSize(int32_t partition) const;
+
+    /**
+     * @brief Number of persons in the gallery.
+     */
+    size_t IdentityCount() const;
+
+    /**
+     * @brief Largest person id in the gallery, or -1 while it is empty.
+     */
+    int64_t MaxPerson() const;
+
+    /**
+     * @brief Dimension of the stored features (0 while empty).
+     */
+    size_t Dimension() const;
+
+    /**
+     * @brief Version of the published data, incremented on every published batch.
+     */
+    uint64_t Version() const;
+
+private:
+    struct Identity {
+        std::vector<int64_t> members;  ///< Custom ids of the person's templates
+        size_t row = 0;                ///< Row of the person in the centroid matrix
+    };
+
+    typedef std::pair<size_t, size_t> RowRange;  // [first, second) rows
+
+    struct PartitionRange {
+        int32_t partition = 0;
+        size_t begin = 0;  ///< First row of the partition
+        size_t end = 0;    ///< One past its last row
+    };
+
+    struct Data {
+        size_t dim = 0;
+        std::vector<float> matrix;                      ///< Row-major, one normalized feature per row
+        std::shared_ptr<MappedGallerySnapshot> mapped;  ///< When set, the rows live in this mapping instead
+        std::vector<int64_t> ids;                       ///< Custom id of each row
+        std::vector<int64_t> persons;                   ///< Person of each row
+        std::vector<int32_t> partitions;                ///< Partition of each row
+        std::vector<PartitionRange> partition_ranges;   ///< Rows of each non-empty partition, in ascending partition order
+        IdIndex index;                                  ///< Custom id -> row
+        std::vector<float> centroids;                   ///< Row-major, one normalized mean template per person
+        std::vector<int64_t> centroid_persons;          ///< Person of each centroid row
+        std::unordered_map<int64_t, Identity> identities;  ///< Person -> templates
+        std::shared_ptr<const SignHash> hasher;         ///< Set once the dimension is known when hash_prefilter is on
+        std::vector<uint64_t> codes;                    ///< Sign-hash code of each row, hasher->Words() words per row
+
+        const float* Rows() const {
+            return mapped ? mapped->Matrix() : matrix.data();
+        }
+    };
+
+    struct CachedQuery {
+        int64_t track = -1;                         ///< Negative for a free slot
+        bool identity = false;                      ///< Result of an identity search rather than a feature search
+        size_t topK = 0;
+        uint64_t version = 0;                       ///< Gallery version the result was computed on
+        float threshold = 0.0f;                     ///< Recognition threshold the result was computed with
+        std::vector<float> query;                   ///< Normalized query
+        std::vector<IdentitySearchResult> results;  ///< person is unused for feature searches
+        uint64_t search_ns = 0;                     ///< Duration of the search that produced the result
+        uint64_t last_use = 0;
+    };
+
+    int32_t ApplyMutation(Data& data, const GalleryMutation& mutation) const;
+    // Row-level edits that keep the rows of each partition contiguous. InsertRow opens an empty row at
+    // the end of a partition and returns it; EraseRow closes a row whose id has left the index.
+    static size_t InsertRow(Data& data, int32_t partition);
+    static void EraseRow(Data& data, size_t row);
+    static void MoveRow(Data& data, size_t from, size_t to);
+    // Moves a row to the end of another partition and returns its new row.
+    static size_t RelocateRow(Data& data, size_t row, int32_t partition);
+    // Builds partition_ranges from the partition column; false if the rows are not grouped in ascending order.
+    static bool IndexPartitions(Data& data);
+    // Creates the hasher of data and encodes all of its rows (no-op without hash_prefilter).
+    void EncodeRows(Data& data) const;
+    // Adds or removes a template of a person and recomputes the person's centroid.
+    static void LinkIdentity(Data& data, int64_t person, int64_t id);
+    static void UnlinkIdentity(Data& data, int64_t person, int64_t id);
+    static void RefreshCentroid(Data& data, int64_t person);
+    // Raises next_id_ above id.
+    void ReserveId(int64_t id);
+
+    // Writes mutations to the hub (upsert and remove semantics, so replaying them is harmless).
+    int32_t ApplyToHub(const std::vector<GalleryMutation>& mutations);
+    // Makes mutations already applied to memory durable: into the hub, or a new snapshot of an open store.
+    int32_t StoreMutations(const std::vector<GalleryMutation>& mutations);
+    // Replaces the contents with the snapshot of a store directory, or empties them if it has none.
+    int32_t LoadStoreSnapshot(const std::string& directory);
+    // Replays the log left by a previous run into storage and starts the checkpoint thread.
+    int32_t StartWriteBehind(const WriteBehindConfiguration& configuration);
+    // Logs mutations and applies them to memory; the checkpoint thread stores them later. log_mutex_ must be held.
+    int32_t LogMutations(const std::vector<GalleryMutation>& mutations);
+    // Moves pending mutations into the hub and drops the log records they came from. Without compact a
+    // store only syncs its log until the log is due for a new snapshot.
+    int32_t Checkpoint(bool compact);
+    void CheckpointLoop();
+
+    // Pins the published copy against writers; must be paired with ReleaseRead.
+    int AcquireRead() const;
+    void ReleaseRead(int side) const;
+    // Publishes the back copy and blocks until no reader uses the old one. Writer lock must be held.
+    void PublishAndDrain();
+
+    // Copies the cached result of track into results if it still answers query under version and threshold.
+    bool LookupCachedQuery(int64_t track, bool identity, size_t topK, uint64_t version, float threshold, const inspire::Embedded& query,
+                           std::vector<IdentitySearchResult>& results);
+    // Caches the result of a track search, replacing the track's previous entry or the least recently used one.
+    void StoreCachedQuery(int64_t track, bool identity, size_t topK, uint64_t version, float threshold, const inspire::Embedded& query,
+                          const std::vector<IdentitySearchResult>& results, uint64_t search_ns);
+
+    // Scans rows [begin, end) of data and adds the best topK (score, row) pairs to the min-heap in heap.
+    // With hits set (eager mode) the scan adds its matches to it and stops once it reaches topK.
+    // Returns the number of rows compared.
+    size_t ScanShard(const float* rows, size_t dim, const float* query, size_t begin, size_t end, size_t topK, float threshold,
+                     std::vector<std::pair<float, size_t>>& heap, std::atomic<size_t>* hits) const;
+    // Ranks rows [begin, end) by Hamming distance to code and keeps the closest keep rows as a heap of (-distance, row).
+    void ScanCodeShard(const Data& data, const uint64_t* code, size_t begin, size_t end, size_t keep,
+                       std::vector<std::pair<float, size_t>>& heap) const;
+    // Hash pass over all rows on the pool; leaves the closest candidates in context.merged_.
+    void ShortlistRows(const Data& data, const uint64_t* code, size_t candidates, SearchContext& context) const;
+    // Scans count rows in shards on the pool and appends every shard's best (score, row) pairs to context.merged_.
+    // Returns the number of rows compared.
+    size_t ScanRows(const float* rows, size_t count, size_t dim, const float* query, size_t topK, float threshold,
+                    std::atomic<size_t>* hits, SearchContext& context) const;
+    // ScanRows over the rows of several ranges; the shards split their concatenation evenly.
+    size_t ScanRanges(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* query, size_t topK,
+                      float threshold, std::atomic<size_t>* hits, SearchContext& context) const;
+    // Scans positions [begin, end) of the concatenation of ranges into a cleared heap. Returns the number of rows compared.
+    size_t ScanWindow(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* query, size_t begin,
+                      size_t end, size_t topK, float threshold, std::vector<std::pair<float, size_t>>& heap,
+                      std::atomic<size_t>* hits) const;
+    // Scores every query against the rows of ranges, in shards on the pool, and keeps each query's best (score, row)
+    // in best, (-inf, SIZE_MAX) for all queries if there are no rows. Returns the number of comparisons.
+    size_t ScanNearest(const float* rows, const RowRange* ranges, size_t range_count, size_t dim, const float* queries,
+                       size_t query_count, std::vector<std::pair<float, size_t>>& best) const;
+    // SearchNearestBatch over the listed partitions, or over all rows if partitions is null.
+    int32_t SearchNearest(const std::vector<inspire::Embedded>& queries, const std::vector<int32_t>* partitions,
+                          std::vector<inspire::FaceSearchResult>& nearest);
+    // Collects the row ranges of the listed partitions into context.ranges_, in row order.
+    static void SelectPartitions(const Data& data, const std::vector<int32_t>& partitions, SearchContext& context);
+
+    GalleryConfiguration configuration_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::shared_ptr<inspire::FeatureHubDB> hub_;
+    std::atomic<float> threshold_;
+
+    Data data_[2];
+    std::atomic<int> front_;
+    mutable std::atomic<int32_t> readers_[2];
+    std::atomic<uint64_t> version_;
+    std::atomic<int64_t> next_id_;
+    std::mutex writer_mutex_;
+
+    // Ring of recently matched ids, read by eager searches without a lock.
+    std::unique_ptr<std::atomic<int64_t>[]> hot_;
+    size_t hot_capacity_ = 0;
+    std::atomic<size_t> hot_cursor_;
+
+    std::atomic<uint64_t> queries_;
+    std::atomic<uint64_t> comparisons_;
+
+    // Last result of each recent track, one slot per track, guarded by cache_mutex_.
+    std::mutex cache_mutex_;
+    std::vector<CachedQuery> cache_;
+    uint64_t cache_clock_ = 0;
+    std::atomic<uint64_t> cache_lookups_;
+    std::atomic<uint64_t> cache_hits_;
+    std::atomic<uint64_t> cache_saved_ns_;
+
+    // Write-behind state, guarded by log_mutex_; inflight_ and rotated_ are owned by the checkpoint holding checkpoint_mutex_.
+    std::mutex log_mutex_;
+    std::mutex checkpoint_mutex_;
+    std::condition_variable checkpoint_cv_;
+    std::unique_ptr<WriteAheadLog> wal_;
+    WriteBehindConfiguration write_behind_;
+    std::vector<GalleryMutation> pending_;   ///< Logged, not yet handed to a checkpoint
+    std::vector<GalleryMutation> inflight_;  ///< Taken by a checkpoint that has not finished yet
+    bool rotated_ = false;                   ///< The log was rotated to .old by a checkpoint that has not finished yet
+    std::string store_directory_;            ///< Set while the gallery is backed by a store (OpenStore)
+    size_t store_logged_ = 0;                ///< Records a store keeps in its synced log, not yet in the snapshot
+    std::thread checkpoint_thread_;
+    bool checkpoint_stop_ = false;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_FACE_GALLERY_H
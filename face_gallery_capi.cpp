@@ -0,0 +1,175 @@
+#include "face_gallery_capi.h"
+#include "cosine_similarity.h"
+#include "face_gallery.h"
+
+namespace {
+
+// What an HFGallerySearchContext handle points to: the gallery context plus the arrays the C results point into.
+struct GallerySearchContext {
+    explicit GallerySearchContext(size_t max_top_k) : context(max_top_k) {
+        results.reserve(max_top_k);
+        identities.reserve(max_top_k);
+        confidence.reserve(max_top_k);
+        ids.reserve(max_top_k);
+    }
+
+    gallery::SearchContext context;
+    inspire::Embedded query;
+    std::vector<inspire::FaceSearchResult> results;
+    std::vector<gallery::IdentitySearchResult> identities;
+    std::vector<HFloat> confidence;
+    std::vector<HFaceId> ids;
+};
+
+}  // namespace
+
+HResult HFGalleryCreate(HFGalleryConfiguration configuration, PHFGallery handle) {
+    if (handle == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    gallery::GalleryConfiguration config;
+    config.recognition_threshold = configuration.searchThreshold;
+    config.search_threads = configuration.searchThreads;
+    config.search_shards = configuration.searchShards;
+    config.big_cores_only = configuration.bigCoresOnly != 0;
+    config.search_mode = configuration.searchMode == HF_SEARCH_MODE_EAGER ? inspire::SEARCH_MODE_EAGER : inspire::SEARCH_MODE_EXHAUSTIVE;
+    config.primary_key_mode =
+        configuration.primaryKeyMode == HF_PK_MANUAL_INPUT ? inspire::PrimaryKeyMode::MANUAL_INPUT : inspire::PrimaryKeyMode::AUTO_INCREMENT;
+    *handle = new gallery::FaceGallery(config);
+    return HSUCCEED;
+}
+
+HResult HFGalleryRelease(HFGallery handle) {
+    if (handle == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    delete static_cast<gallery::FaceGallery*>(handle);
+    return HSUCCEED;
+}
+
+HResult HFGalleryLoadFromFeatureHub(HFGallery handle) {
+    if (handle == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    return static_cast<gallery::FaceGallery*>(handle)->LoadFromHub(INSPIREFACE_FEATURE_HUB);
+}
+
+HResult HFGalleryInsertFeatureBatch(HFGallery handle, const HFFaceFeatureIdentity* identities, HInt32 count, HPFaceId allocIds,
+                                    HPInt32 insertedCount) {
+    if (handle == nullptr || count < 0 || (count > 0 && (identities == nullptr || allocIds == nullptr))) {
+        return HERR_INVALID_PARAM;
+    }
+    std::vector<inspire::Embedded> features(count);
+    std::vector<int64_t> ids(count);
+    for (HInt32 i = 0; i < count; ++i) {
+        const PHFFaceFeature feature = identities[i].feature;
+        if (feature == nullptr || feature->data == nullptr || feature->size <= 0) {
+            return HERR_INVALID_FACE_FEATURE;
+        }
+        features[i].assign(feature->data, feature->data + feature->size);
+        ids[i] = identities[i].id;
+    }
+    HResult ret = static_cast<gallery::FaceGallery*>(handle)->FaceFeatureInsertBatch(features, ids);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        allocIds[i] = ids[i];
+    }
+    if (insertedCount != nullptr) {
+        *insertedCount = static_cast<HInt32>(ids.size());
+    }
+    return ret;
+}
+
+HResult HFGalleryGetFaceCount(HFGallery handle, HPInt32 count) {
+    if (handle == nullptr || count == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    *count = static_cast<HInt32>(static_cast<gallery::FaceGallery*>(handle)->Size());
+    return HSUCCEED;
+}
+
+HResult HFGallerySearchContextCreate(HInt32 maxTopK, PHFGallerySearchContext context) {
+    if (context == nullptr || maxTopK < 0) {
+        return HERR_INVALID_PARAM;
+    }
+    *context = new GallerySearchContext(static_cast<size_t>(maxTopK));
+    return HSUCCEED;
+}
+
+HResult HFGallerySearchContextRelease(HFGallerySearchContext context) {
+    if (context == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    delete static_cast<GallerySearchContext*>(context);
+    return HSUCCEED;
+}
+
+HResult HFGalleryFaceSearchTopK(HFGallery handle, HFGallerySearchContext context, HFFaceFeature searchFeature, HInt32 topK,
+                                PHFSearchTopKResults results) {
+    if (handle == nullptr || context == nullptr || results == nullptr || topK <= 0) {
+        return HERR_INVALID_PARAM;
+    }
+    if (searchFeature.data == nullptr || searchFeature.size <= 0) {
+        return HERR_INVALID_FACE_FEATURE;
+    }
+    auto* search = static_cast<GallerySearchContext*>(context);
+    search->query.assign(searchFeature.data, searchFeature.data + searchFeature.size);
+    HResult ret = static_cast<gallery::FaceGallery*>(handle)->SearchFaceFeatureTopK(search->query, search->results, topK, search->context);
+    search->confidence.clear();
+    search->ids.clear();
+    for (const auto& result : search->results) {
+        search->confidence.push_back(result.similarity);
+        search->ids.push_back(result.id);
+    }
+    results->size = static_cast<HInt32>(search->ids.size());
+    results->confidence = search->confidence.data();
+    results->ids = search->ids.data();
+    return ret;
+}
+
+HResult HFGalleryIdentitySearchTopK(HFGallery handle, HFGallerySearchContext context, HFFaceFeature searchFeature, HInt32 topK,
+                                    PHFSearchTopKResults results) {
+    if (handle == nullptr || context == nullptr || results == nullptr || topK <= 0) {
+        return HERR_INVALID_PARAM;
+    }
+    if (searchFeature.data == nullptr || searchFeature.size <= 0) {
+        return HERR_INVALID_FACE_FEATURE;
+    }
+    auto* search = static_cast<GallerySearchContext*>(context);
+    search->query.assign(searchFeature.data, searchFeature.data + searchFeature.size);
+    HResult ret = static_cast<gallery::FaceGallery*>(handle)->SearchIdentityTopK(search->query, search->identities, topK, search->context);
+    search->confidence.clear();
+    search->ids.clear();
+    for (const auto& identity : search->identities) {
+        search->confidence.push_back(identity.similarity);
+        search->ids.push_back(identity.person);
+    }
+    results->size = static_cast<HInt32>(search->ids.size());
+    results->confidence = search->confidence.data();
+    results->ids = search->ids.data();
+    return ret;
+}
+
+HResult HFFaceComparison1xN(HFFaceFeature feature, const HFloat* features, HInt32 count, HInt32 stride, HInt32 normalized,
+                            HPFloat results) {
+    if (feature.data == nullptr || feature.size <= 0) {
+        return HERR_INVALID_FACE_FEATURE;
+    }
+    if (count < 0 || (stride != 0 && stride < feature.size) || (count > 0 && (features == nullptr || results == nullptr))) {
+        return HERR_INVALID_PARAM;
+    }
+    gallery::CosineSimilarity1xN(feature.data, features, count, feature.size, stride != 0 ? stride : feature.size, normalized != 0, results);
+    return HSUCCEED;
+}
+
+HResult HFFaceComparisonNxM(const HFloat* features1, HInt32 count1, HInt32 stride1, const HFloat* features2, HInt32 count2, HInt32 stride2,
+                            HInt32 dim, HInt32 normalized, HPFloat results) {
+    if (dim <= 0 || count1 < 0 || count2 < 0 || (stride1 != 0 && stride1 < dim) || (stride2 != 0 && stride2 < dim)) {
+        return HERR_INVALID_PARAM;
+    }
+    if ((count1 > 0 && features1 == nullptr) || (count2 > 0 && features2 == nullptr) || (count1 > 0 && count2 > 0 && results == nullptr)) {
+        return HERR_INVALID_PARAM;
+    }
+    gallery::CosineSimilarityNxM(features1, count1, stride1 != 0 ? stride1 : dim, features2, count2, stride2 != 0 ? stride2 : dim, dim,
+                                 normalized != 0, results);
+    return HSUCCEED;
+}
@@ -0,0 +1,182 @@
+#ifndef FACE_GALLERY_CAPI_H
+#define FACE_GALLERY_CAPI_H
+
+#include <inspireface.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/************************************************************************
+ * Face Gallery
+ *
+ * C interface of gallery::FaceGallery, the in-memory search gallery that mirrors the
+ * global FeatureHub. Inserts go through to the FeatureHub and are published to the
+ * gallery in batches.
+ ************************************************************************/
+
+typedef void* HFGallery;    ///< Handle for face gallery.
+typedef void** PHFGallery;  ///< Pointer to Handle for face gallery.
+
+typedef void* HFGallerySearchContext;    ///< Handle for gallery search context.
+typedef void** PHFGallerySearchContext;  ///< Pointer to Handle for gallery search context.
+
+/**
+ * @brief Struct for face gallery configuration.
+ */
+typedef struct HFGalleryConfiguration {
+    HFloat searchThreshold;  ///< Cosine threshold a match must reach
+    HInt32 searchThreads;    ///< Worker threads of the sharded scan (0: one per usable core)
+    HInt32 searchShards;     ///< Shards a query is split into (0: one per worker thread)
+    HInt32 bigCoresOnly;     ///< Pin search workers to the big cores of a big.LITTLE SoC
+    HFSearchMode searchMode; ///< EAGER stops once the requested number of matches is found
+    HFPKMode primaryKeyMode; ///< Mode the FeatureHub was enabled with; identity ids are kept only in HF_PK_MANUAL_INPUT
+} HFGalleryConfiguration;
+
+/**
+ * @brief Create a face gallery.
+ *
+ * @param configuration Gallery configuration details.
+ * @param handle Pointer to the output gallery handle.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryCreate(HFGalleryConfiguration configuration, PHFGallery handle);
+
+/**
+ * @brief Release a face gallery.
+ *
+ * @param handle Gallery handle to release.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryRelease(HFGallery handle);
+
+/**
+ * @brief Load every feature of the enabled global FeatureHub into the gallery.
+ *
+ * @param handle Gallery handle.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryLoadFromFeatureHub(HFGallery handle);
+
+/**
+ * @brief Insert a batch of face feature identities into the FeatureHub and the gallery.
+ *
+ * The gallery search structures are updated once for the whole batch.
+ *
+ * @param handle Gallery handle.
+ * @param identities Array of face feature identities (ids are ignored unless the gallery was
+ *                   created with primaryKeyMode HF_PK_MANUAL_INPUT).
+ * @param count Number of identities.
+ * @param allocIds Output array of at least count elements receiving the allocated ids.
+ * @param insertedCount Pointer receiving the number of identities that were inserted.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryInsertFeatureBatch(HFGallery handle, const HFFaceFeatureIdentity* identities, HInt32 count,
+                                                             HPFaceId allocIds, HPInt32 insertedCount);
+
+/**
+ * @brief Get the count of face features in the gallery.
+ *
+ * @param handle Gallery handle.
+ * @param count Pointer to an integer where the count of features will be stored.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryGetFaceCount(HFGallery handle, HPInt32 count);
+
+/**
+ * @brief Create a search context.
+ *
+ * A search context owns the result buffers and scratch memory of one search at a time.
+ * Unlike HFFeatureHubFaceSearchTopK, whose results point into buffers shared by all
+ * callers, results of a gallery search point into its context, so threads using their
+ * own contexts can search the same gallery concurrently.
+ *
+ * @param maxTopK Largest topK the context is sized for up front (it grows if exceeded).
+ * @param context Pointer to the output context handle.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGallerySearchContextCreate(HInt32 maxTopK, PHFGallerySearchContext context);
+
+/**
+ * @brief Release a search context.
+ *
+ * @param context Context handle to release.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGallerySearchContextRelease(HFGallerySearchContext context);
+
+/**
+ * @brief Search the gallery for the top k features above the search threshold.
+ *
+ * @param handle Gallery handle.
+ * @param context Search context; must not be used by another search at the same time.
+ * @param searchFeature Face feature to search for.
+ * @param topK Maximum number of results.
+ * @param results Output results, best first. The arrays belong to the context and stay valid
+ *                until its next search or its release.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryFaceSearchTopK(HFGallery handle, HFGallerySearchContext context, HFFaceFeature searchFeature,
+                                                         HInt32 topK, PHFSearchTopKResults results);
+
+/**
+ * @brief Search the gallery for the top k persons above the search threshold.
+ *
+ * Same as HFGalleryFaceSearchTopK, except that results.ids holds person ids, one per person.
+ *
+ * @param handle Gallery handle.
+ * @param context Search context; must not be used by another search at the same time.
+ * @param searchFeature Face feature to search for.
+ * @param topK Maximum number of persons.
+ * @param results Output results, best first, owned by the context.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFGalleryIdentitySearchTopK(HFGallery handle, HFGallerySearchContext context, HFFaceFeature searchFeature,
+                                                             HInt32 topK, PHFSearchTopKResults results);
+
+/************************************************************************
+ * Batch face comparison
+ *
+ * Batched counterparts of HFFaceComparison for verification jobs that compare many
+ * pairs at once. Features are rows of floats laid out at a fixed stride, and scores
+ * are written to a caller buffer, so no call allocates.
+ ************************************************************************/
+
+/**
+ * @brief Compare one face feature against a set of face features.
+ *  Results are cosine similarity scores, not percentage similarities.
+ *
+ * @param feature Query face feature.
+ * @param features First feature of the set; feature i starts at features + i * stride.
+ * @param count Number of features in the set.
+ * @param stride Distance between consecutive features in floats (0: feature.size).
+ * @param normalized Non-zero if every feature is already unit length, which skips the norms.
+ * @param results Output array of count scores.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFFaceComparison1xN(HFFaceFeature feature, const HFloat* features, HInt32 count, HInt32 stride,
+                                                     HInt32 normalized, HPFloat results);
+
+/**
+ * @brief Compare every face feature of one set against every face feature of another.
+ *  Results are cosine similarity scores, not percentage similarities.
+ *
+ * @param features1 First feature of the first set; feature i starts at features1 + i * stride1.
+ * @param count1 Number of features in the first set.
+ * @param stride1 Distance between consecutive features of the first set in floats (0: dim).
+ * @param features2 First feature of the second set; feature j starts at features2 + j * stride2.
+ * @param count2 Number of features in the second set.
+ * @param stride2 Distance between consecutive features of the second set in floats (0: dim).
+ * @param dim Feature dimension.
+ * @param normalized Non-zero if every feature is already unit length, which skips the norms.
+ * @param results Output array of count1 x count2 scores; results[i * count2 + j] compares feature i with feature j.
+ * @return HResult indicating the success or failure of the operation.
+ */
+HYPER_CAPI_EXPORT extern HResult HFFaceComparisonNxM(const HFloat* features1, HInt32 count1, HInt32 stride1, const HFloat* features2,
+                                                     HInt32 count2, HInt32 stride2, HInt32 dim, HInt32 normalized, HPFloat results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FACE_GALLERY_CAPI_H
@@ -0,0 +1,274 @@
+#include "gallery_export.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
+#include <inspireface/herror.h>
+#include "gallery_snapshot.h"
+
+namespace gallery {
+
+namespace {
+
+const char kExportMagic[8] = {'I', 'F', 'G', 'A', 'L', 'E', 'X', 'P'};
+const uint32_t kChunkMagic = 0x4B4E4843;  // "CHNK"
+// Upper bound on the embedding dimension, rejects garbage headers before allocating.
+const uint32_t kMaxExportDim = 65536;
+
+uint64_t HeaderChecksum(const GalleryExportHeader& header) {
+    return Checksum64(&header, offsetof(GalleryExportHeader, header_checksum));
+}
+
+uint64_t ChunkChecksum(const GalleryExportChunk& chunk, const std::vector<char>& payload) {
+    return Checksum64(payload.data(), payload.size(), Checksum64(&chunk, offsetof(GalleryExportChunk, checksum)));
+}
+
+size_t ElementBytes(uint32_t encoding) {
+    return encoding == GALLERY_EXPORT_FP16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+// Bytes of the partition column of a chunk; version 1 streams have none.
+size_t PartitionColumnBytes(uint32_t version, size_t rows) {
+    return version >= 2 ? rows * sizeof(int32_t) : 0;
+}
+
+// IEEE 754 binary32 -> binary16, rounding to nearest even.
+uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (exponent == 0xFF) {
+        return static_cast<uint16_t>(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0));
+    }
+    const int32_t half_exponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (half_exponent >= 0x1F) {
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (half_exponent <= 0) {
+        // Subnormal half: shift the mantissa, with its implicit bit, below the exponent field.
+        if (half_exponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1FFF;
+    // A carry out of the mantissa correctly bumps the exponent.
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+float HalfToFloat(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1F;
+    const uint32_t mantissa = half & 0x3FF;
+    if (exponent == 0) {
+        const float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign != 0 ? -value : value;
+    }
+    uint32_t bits;
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}  // namespace
+
+GalleryExportWriter::~GalleryExportWriter() {
+    Discard();
+}
+
+void GalleryExportWriter::Discard() {
+    if (file_ != nullptr) {
+        std::fclose(file_);
+        file_ = nullptr;
+        std::remove(temp_path_.c_str());
+    }
+}
+
+int32_t GalleryExportWriter::Open(const std::string& path, uint32_t dim, uint64_t count, GalleryExportEncoding encoding) {
+    Discard();
+    // An empty gallery has no dimension yet; its export is just a header and an end chunk.
+    if (dim > kMaxExportDim || (dim == 0 && count > 0)) {
+        return HERR_INVALID_PARAM;
+    }
+    std::memset(&header_, 0, sizeof(header_));
+    std::memcpy(header_.magic, kExportMagic, sizeof(header_.magic));
+    header_.version = kGalleryExportVersion;
+    header_.dim = dim;
+    header_.encoding = encoding;
+    header_.count = count;
+    header_.header_checksum = HeaderChecksum(header_);
+    path_ = path;
+    temp_path_ = path + ".tmp";
+    written_ = 0;
+    sequence_ = 0;
+    file_ = std::fopen(temp_path_.c_str(), "wb");
+    if (file_ == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    if (std::fwrite(&header_, sizeof(header_), 1, file_) != 1) {
+        Discard();
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+int32_t GalleryExportWriter::WriteChunk(const int64_t* ids, const int64_t* persons, const int32_t* partitions, const float* rows,
+                                        size_t count) {
+    if (file_ == nullptr || count > kGalleryExportChunkRows || written_ + count > header_.count) {
+        return HERR_INVALID_PARAM;
+    }
+    if (count == 0) {
+        return HSUCCEED;  // Zero rows would read as the end of the stream
+    }
+    const size_t column_bytes = count * sizeof(int64_t);
+    const size_t partition_bytes = PartitionColumnBytes(header_.version, count);
+    const size_t values = count * header_.dim;
+    buffer_.resize(2 * column_bytes + partition_bytes + values * ElementBytes(header_.encoding));
+    std::memcpy(buffer_.data(), ids, column_bytes);
+    std::memcpy(buffer_.data() + column_bytes, persons, column_bytes);
+    std::memcpy(buffer_.data() + 2 * column_bytes, partitions, partition_bytes);
+    char* embeddings = buffer_.data() + 2 * column_bytes + partition_bytes;
+    if (header_.encoding == GALLERY_EXPORT_FP16) {
+        for (size_t i = 0; i < values; ++i) {
+            const uint16_t half = FloatToHalf(rows[i]);
+            std::memcpy(embeddings + i * sizeof(half), &half, sizeof(half));
+        }
+    } else {
+        std::memcpy(embeddings, rows, values * sizeof(float));
+    }
+    GalleryExportChunk chunk;
+    std::memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = kChunkMagic;
+    chunk.rows = static_cast<uint32_t>(count);
+    chunk.sequence = sequence_;
+    chunk.checksum = ChunkChecksum(chunk, buffer_);
+    if (std::fwrite(&chunk, sizeof(chunk), 1, file_) != 1 || std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+        Discard();
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    written_ += count;
+    ++sequence_;
+    return HSUCCEED;
+}
+
+int32_t GalleryExportWriter::Close() {
+    if (file_ == nullptr) {
+        return HERR_INVALID_PARAM;
+    }
+    if (written_ != header_.count) {
+        Discard();
+        return HERR_INVALID_PARAM;
+    }
+    GalleryExportChunk end;
+    std::memset(&end, 0, sizeof(end));
+    end.magic = kChunkMagic;
+    end.sequence = sequence_;
+    buffer_.clear();
+    end.checksum = ChunkChecksum(end, buffer_);
+    bool ok = std::fwrite(&end, sizeof(end), 1, file_) == 1;
+    ok = ok && std::fflush(file_) == 0 && fsync(fileno(file_)) == 0;
+    ok = (std::fclose(file_) == 0) && ok;
+    file_ = nullptr;
+    if (!ok || std::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        std::remove(temp_path_.c_str());
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+GalleryExportReader::~GalleryExportReader() {
+    if (file_ != nullptr) {
+        std::fclose(file_);
+    }
+}
+
+int32_t GalleryExportReader::Open(const std::string& path) {
+    if (file_ != nullptr) {
+        std::fclose(file_);
+    }
+    read_ = 0;
+    sequence_ = 0;
+    file_ = std::fopen(path.c_str(), "rb");
+    if (file_ == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    if (std::fread(&header_, sizeof(header_), 1, file_) != 1 || std::memcmp(header_.magic, kExportMagic, sizeof(header_.magic)) != 0 ||
+        header_.version < 1 || header_.version > kGalleryExportVersion || header_.header_checksum != HeaderChecksum(header_) ||
+        header_.dim > kMaxExportDim || (header_.dim == 0 && header_.count > 0) || header_.encoding > GALLERY_EXPORT_FP16) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+int32_t GalleryExportReader::ReadChunk(std::vector<int64_t>& ids, std::vector<int64_t>& persons, std::vector<int32_t>& partitions,
+                                       std::vector<float>& rows) {
+    ids.clear();
+    persons.clear();
+    partitions.clear();
+    rows.clear();
+    if (file_ == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    GalleryExportChunk chunk;
+    if (std::fread(&chunk, sizeof(chunk), 1, file_) != 1 || chunk.magic != kChunkMagic || chunk.rows > kGalleryExportChunkRows ||
+        chunk.sequence != sequence_) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    const size_t count = chunk.rows;
+    const size_t column_bytes = count * sizeof(int64_t);
+    const size_t partition_bytes = PartitionColumnBytes(header_.version, count);
+    const size_t values = count * header_.dim;
+    buffer_.resize(2 * column_bytes + partition_bytes + values * ElementBytes(header_.encoding));
+    if (std::fread(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size() || chunk.checksum != ChunkChecksum(chunk, buffer_)) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    if (count == 0) {
+        // The end chunk must close a stream of exactly the announced size.
+        return read_ == header_.count ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    if (read_ + count > header_.count) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    ids.resize(count);
+    persons.resize(count);
+    partitions.assign(count, 0);
+    rows.resize(values);
+    std::memcpy(ids.data(), buffer_.data(), column_bytes);
+    std::memcpy(persons.data(), buffer_.data() + column_bytes, column_bytes);
+    std::memcpy(partitions.data(), buffer_.data() + 2 * column_bytes, partition_bytes);
+    const char* embeddings = buffer_.data() + 2 * column_bytes + partition_bytes;
+    if (header_.encoding == GALLERY_EXPORT_FP16) {
+        for (size_t i = 0; i < values; ++i) {
+            uint16_t half;
+            std::memcpy(&half, embeddings + i * sizeof(half), sizeof(half));
+            rows[i] = HalfToFloat(half);
+        }
+    } else {
+        std::memcpy(rows.data(), embeddings, values * sizeof(float));
+    }
+    read_ += count;
+    ++sequence_;
+    return HSUCCEED;
+}
+
+}  // namespace gallery
@@ -0,0 +1,156 @@
+#pragma once
+#ifndef GALLERY_EXPORT_H
+#define GALLERY_EXPORT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @brief Version of the export stream layout written by GalleryExportWriter.
+ *
+ * Version 2 added the partition column; GalleryExportReader still reads version 1 streams,
+ * whose rows all belong to partition 0.
+ */
+const uint32_t kGalleryExportVersion = 2;
+
+/**
+ * @brief Rows per chunk of ExportSnapshot: a few MiB per chunk, so memory stays bounded on both ends.
+ */
+const size_t kGalleryExportChunkRows = 4096;
+
+/**
+ * @brief Encoding of the embeddings in an export stream.
+ */
+enum GalleryExportEncoding {
+    GALLERY_EXPORT_FP32 = 0,  ///< Exact copy of the normalized rows
+    GALLERY_EXPORT_FP16 = 1,  ///< Half the size; a decoded row keeps a cosine above 0.99999 with the original
+};
+
+/**
+ * @struct GalleryExportHeader
+ * @brief Fixed-size header at offset 0 of an export stream.
+ *
+ * Layout: header | chunk* | end chunk. Each chunk is a GalleryExportChunk followed by its
+ * id column (rows x int64), person column (rows x int64), partition column (rows x int32)
+ * and embeddings (rows x dim, float32 or float16). The end chunk has rows = 0 and no payload; a stream without it is
+ * truncated. Unlike a snapshot, the stream is read front to back and never mapped, so it
+ * can be piped and merged into a gallery that already has rows. All values are little-endian.
+ */
+struct GalleryExportHeader {
+    char magic[8];             ///< "IFGALEXP"
+    uint32_t version;          ///< kGalleryExportVersion
+    uint32_t dim;              ///< Embedding dimension
+    uint32_t encoding;         ///< GalleryExportEncoding
+    uint32_t reserved;
+    uint64_t count;            ///< Total rows of all chunks
+    uint64_t header_checksum;  ///< Checksum64 of all fields above
+};
+
+/**
+ * @struct GalleryExportChunk
+ * @brief Header of one chunk of an export stream.
+ */
+struct GalleryExportChunk {
+    uint32_t magic;     ///< "CHNK"
+    uint32_t rows;      ///< Rows in the chunk; 0 ends the stream
+    uint64_t sequence;  ///< Position of the chunk in the stream, catches reordered or repeated chunks
+    uint64_t checksum;  ///< Checksum64 of the fields above and the payload
+};
+
+/**
+ * @class GalleryExportWriter
+ * @brief Writes an export stream chunk by chunk.
+ *
+ * The stream goes to a temporary file that Close renames into place, so readers never see
+ * a partial export.
+ */
+class GalleryExportWriter {
+public:
+    GalleryExportWriter() = default;
+    ~GalleryExportWriter();
+
+    GalleryExportWriter(const GalleryExportWriter&) = delete;
+    GalleryExportWriter& operator=(const GalleryExportWriter&) = delete;
+
+    /**
+     * @brief Starts a stream of count rows.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Open(const std::string& path, uint32_t dim, uint64_t count, GalleryExportEncoding encoding);
+
+    /**
+     * @brief Appends a chunk of rows.
+     * @param ids Custom id of each row.
+     * @param persons Person of each row.
+     * @param partitions Partition of each row.
+     * @param rows rows x dim floats, row-major.
+     * @param count Number of rows, at most kGalleryExportChunkRows.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t WriteChunk(const int64_t* ids, const int64_t* persons, const int32_t* partitions, const float* rows, size_t count);
+
+    /**
+     * @brief Ends the stream, syncs it and moves it into place.
+     * @return int32_t Status code; HERR_INVALID_PARAM if fewer or more rows than announced were written.
+     */
+    int32_t Close();
+
+private:
+    void Discard();
+
+    std::FILE* file_ = nullptr;
+    std::string path_;
+    std::string temp_path_;
+    GalleryExportHeader header_;
+    uint64_t written_ = 0;
+    uint64_t sequence_ = 0;
+    std::vector<char> buffer_;  ///< Payload of the chunk being written
+};
+
+/**
+ * @class GalleryExportReader
+ * @brief Reads an export stream chunk by chunk, verifying every checksum.
+ */
+class GalleryExportReader {
+public:
+    GalleryExportReader() = default;
+    ~GalleryExportReader();
+
+    GalleryExportReader(const GalleryExportReader&) = delete;
+    GalleryExportReader& operator=(const GalleryExportReader&) = delete;
+
+    /**
+     * @brief Opens a stream and validates its header.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED if the file is missing or not an export.
+     */
+    int32_t Open(const std::string& path);
+
+    const GalleryExportHeader& Header() const {
+        return header_;
+    }
+
+    /**
+     * @brief Reads the next chunk, decoding its embeddings to float32.
+     * @param ids Output custom ids; empty once the end chunk is reached.
+     * @param persons Output persons.
+     * @param partitions Output partitions.
+     * @param rows Output ids.size() x dim floats.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED on a corrupt or truncated stream.
+     */
+    int32_t ReadChunk(std::vector<int64_t>& ids, std::vector<int64_t>& persons, std::vector<int32_t>& partitions, std::vector<float>& rows);
+
+private:
+    std::FILE* file_ = nullptr;
+    GalleryExportHeader header_;
+    uint64_t read_ = 0;
+    uint64_t sequence_ = 0;
+    std::vector<char> buffer_;  ///< Payload of the chunk being read
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_EXPORT_H
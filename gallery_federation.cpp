@@ -0,0 +1,78 @@
+#include "gallery_federation.h"
+
+#include <algorithm>
+#include <inspireface/herror.h>
+
+namespace gallery {
+
+namespace {
+
+// Buffers of the searches of one calling thread, reused across queries.
+struct FederationScratch {
+    std::vector<SearchContext> contexts;
+    std::vector<std::vector<inspire::FaceSearchResult>> results;
+    std::vector<int32_t> status;
+};
+
+bool SimilarityGreater(const FederatedSearchResult& a, const FederatedSearchResult& b) {
+    return a.similarity > b.similarity;
+}
+
+}  // namespace
+
+GalleryFederation::GalleryFederation(const std::vector<std::shared_ptr<FaceGallery>>& galleries) : galleries_(galleries) {
+    if (galleries_.size() > 1) {
+        // The caller takes one gallery itself.
+        pool_.reset(new ThreadPool(static_cast<int32_t>(galleries_.size() - 1)));
+    }
+}
+
+int32_t GalleryFederation::SearchTopK(const inspire::Embedded& queryFeature, std::vector<FederatedSearchResult>& searchResult,
+                                      size_t topK) {
+    searchResult.clear();
+    if (topK == 0 || galleries_.empty()) {
+        return HSUCCEED;
+    }
+    static thread_local FederationScratch scratch;
+    scratch.contexts.resize(galleries_.size());
+    scratch.results.resize(galleries_.size());
+    scratch.status.assign(galleries_.size(), HSUCCEED);
+
+    struct FederatedScan {
+        GalleryFederation* federation;
+        const inspire::Embedded* query;
+        size_t topK;
+        FederationScratch* scratch;
+    } scan = {this, &queryFeature, topK, &scratch};
+    // One reference of capture fits std::function's inline buffer, so no allocation per query.
+    auto search = [&scan](size_t index) {
+        scan.scratch->status[index] = scan.federation->galleries_[index]->SearchFaceFeatureTopK(
+            *scan.query, scan.scratch->results[index], scan.topK, scan.scratch->contexts[index]);
+    };
+    if (pool_ == nullptr) {
+        search(0);
+    } else {
+        pool_->ParallelFor(galleries_.size(), search);
+    }
+
+    for (size_t index = 0; index < galleries_.size(); ++index) {
+        if (scratch.status[index] != HSUCCEED) {
+            searchResult.clear();
+            return scratch.status[index];
+        }
+        for (const auto& result : scratch.results[index]) {
+            FederatedSearchResult merged;
+            merged.gallery = index;
+            merged.id = result.id;
+            merged.similarity = static_cast<float>(result.similarity);
+            searchResult.push_back(merged);
+        }
+    }
+    // Every gallery returned its results best first; a partial sort is enough to keep the best topK.
+    const size_t kept = std::min(topK, searchResult.size());
+    std::partial_sort(searchResult.begin(), searchResult.begin() + kept, searchResult.end(), SimilarityGreater);
+    searchResult.resize(kept);
+    return HSUCCEED;
+}
+
+}  // namespace gallery
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef GALLERY_FEDERATION_H
+#define GALLERY_FEDERATION_H
+
+#include <memory>
+#include <vector>
+#include "face_gallery.h"
+
+namespace gallery {
+
+/**
+ * @struct FederatedSearchResult
+ * @brief Match of a federated search.
+ */
+struct FederatedSearchResult {
+    size_t gallery = 0;                   ///< Index of the gallery the match came from
+    int64_t id = INSPIRE_INVALID_ID;      ///< Custom id in that gallery
+    float similarity = 0.0f;              ///< Cosine similarity of the match
+};
+
+/**
+ * @class GalleryFederation
+ * @brief Searches several independent galleries with one query and merges their results.
+ *
+ * Each gallery keeps its own configuration: its recognition threshold decides what it
+ * returns, and its own pool scans its shards. The federation runs the gallery searches
+ * concurrently on a pool of its own, one worker per gallery, so a gallery search that
+ * waits on its pool never holds a worker of another gallery's.
+ */
+class GalleryFederation {
+public:
+    /**
+     * @param galleries Galleries to search; the federation shares their ownership.
+     */
+    explicit GalleryFederation(const std::vector<std::shared_ptr<FaceGallery>>& galleries);
+
+    GalleryFederation(const GalleryFederation&) = delete;
+    GalleryFederation& operator=(const GalleryFederation&) = delete;
+
+    /**
+     * @brief Searches every gallery and keeps the topK best matches overall, best first.
+     * @param queryFeature Embedded feature to search for.
+     * @param searchResult Merged results; each gallery contributes only matches above its own threshold.
+     * @param topK Maximum number of results to return.
+     * @return int32_t HSUCCEED, or the error of the first gallery that failed.
+     */
+    int32_t SearchTopK(const inspire::Embedded& queryFeature, std::vector<FederatedSearchResult>& searchResult, size_t topK);
+
+    /**
+     * @brief Gallery at an index, as reported in FederatedSearchResult::gallery.
+     */
+    const std::shared_ptr<FaceGallery>& Gallery(size_t index) const {
+        return galleries_[index];
+    }
+
+    /**
+     * @brief Number of galleries.
+     */
+    size_t Size() const {
+        return galleries_.size();
+    }
+
+private:
+    std::vector<std::shared_ptr<FaceGallery>> galleries_;
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_FEDERATION_H
@@ -0,0 +1,29 @@
+#pragma once
+#ifndef GALLERY_MUTATION_H
+#define GALLERY_MUTATION_H
+
+#include <inspireface/inspireface.hpp>
+
+namespace gallery {
+
+/**
+ * @struct GalleryMutation
+ * @brief One change of a write batch.
+ */
+struct GalleryMutation {
+    enum Type {
+        UPSERT = 0,  ///< Add the feature, or replace it when the id already exists
+        REMOVE,      ///< Remove the feature with this id
+        LABEL,       ///< Move the existing feature with this id to another person
+        PARTITION,   ///< Move the existing feature with this id to another partition
+    };
+    Type type = UPSERT;
+    int64_t id = INSPIRE_INVALID_ID;
+    inspire::Embedded feature;
+    int64_t person = INSPIRE_INVALID_ID;  ///< Person the feature is a template of (UPSERT: unset keeps the current person)
+    int32_t partition = -1;               ///< Partition of the feature (UPSERT: unset keeps the current one, new features go to 0)
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_MUTATION_H
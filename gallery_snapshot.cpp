@@ -0,0 +1,198 @@
+#include "gallery_snapshot.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <inspireface/herror.h>
+
+namespace gallery {
+
+namespace {
+
+const char kSnapshotMagic[8] = {'I', 'F', 'G', 'A', 'L', 'S', 'N', 'P'};
+const uint64_t kMatrixAlignment = 64;
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t HeaderChecksum(const GallerySnapshotHeader& header) {
+    return Checksum64(&header, offsetof(GallerySnapshotHeader, header_checksum));
+}
+
+}  // namespace
+
+uint64_t Checksum64(const void* data, size_t size, uint64_t seed) {
+    const uint64_t kPrime = 0x9E3779B97F4A7C15ULL;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed ^ (size * kPrime);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash ^= word * kPrime;
+        hash = (hash << 31) | (hash >> 33);
+        hash *= 0xC2B2AE3D27D4EB4FULL;
+    }
+    for (; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= kPrime;
+    }
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t FileSourceStamp(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return 0;
+    }
+    uint64_t fields[3] = {static_cast<uint64_t>(info.st_size), static_cast<uint64_t>(info.st_mtim.tv_sec),
+                          static_cast<uint64_t>(info.st_mtim.tv_nsec)};
+    return Checksum64(fields, sizeof(fields));
+}
+
+uint64_t FileSourceStamp(const std::vector<std::string>& paths) {
+    std::vector<uint64_t> stamps;
+    for (const auto& path : paths) {
+        stamps.push_back(FileSourceStamp(path));
+    }
+    if (stamps.empty() || stamps[0] == 0) {
+        return 0;
+    }
+    return Checksum64(stamps.data(), stamps.size() * sizeof(uint64_t));
+}
+
+int32_t WriteGallerySnapshot(const std::string& path, uint32_t dim, const std::vector<int64_t>& ids, const std::vector<int64_t>& persons,
+                             const std::vector<int32_t>& partitions, const float* matrix, const std::vector<int64_t>& identities,
+                             const float* centroids, uint64_t source_stamp) {
+    if (persons.size() != ids.size() || partitions.size() != ids.size()) {
+        return HERR_INVALID_PARAM;
+    }
+    GallerySnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kGallerySnapshotVersion;
+    header.dim = dim;
+    header.count = ids.size();
+    header.identity_count = identities.size();
+    const size_t column_bytes = ids.size() * sizeof(int64_t);
+    const size_t identity_bytes = identities.size() * sizeof(int64_t);
+    const size_t partition_bytes = ids.size() * sizeof(int32_t);
+    const size_t matrix_bytes = ids.size() * dim * sizeof(float);
+    const size_t centroid_bytes = identities.size() * dim * sizeof(float);
+    header.ids_offset = sizeof(GallerySnapshotHeader);
+    header.persons_offset = header.ids_offset + column_bytes;
+    header.identities_offset = header.persons_offset + column_bytes;
+    header.partitions_offset = header.identities_offset + identity_bytes;
+    header.matrix_offset = AlignUp(header.partitions_offset + partition_bytes, kMatrixAlignment);
+    header.centroids_offset = AlignUp(header.matrix_offset + matrix_bytes, kMatrixAlignment);
+    header.source_stamp = source_stamp;
+    uint64_t checksum = Checksum64(ids.data(), column_bytes);
+    checksum = Checksum64(persons.data(), column_bytes, checksum);
+    checksum = Checksum64(identities.data(), identity_bytes, checksum);
+    checksum = Checksum64(partitions.data(), partition_bytes, checksum);
+    checksum = Checksum64(matrix, matrix_bytes, checksum);
+    header.payload_checksum = Checksum64(centroids, centroid_bytes, checksum);
+    header.header_checksum = HeaderChecksum(header);
+
+    const std::string temp_path = path + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    const std::vector<char> padding(kMatrixAlignment, 0);
+    const size_t matrix_padding = header.matrix_offset - header.partitions_offset - partition_bytes;
+    const size_t centroid_padding = header.centroids_offset - header.matrix_offset - matrix_bytes;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(ids.data(), 1, column_bytes, file) == column_bytes;
+    ok = ok && std::fwrite(persons.data(), 1, column_bytes, file) == column_bytes;
+    ok = ok && std::fwrite(identities.data(), 1, identity_bytes, file) == identity_bytes;
+    ok = ok && std::fwrite(partitions.data(), 1, partition_bytes, file) == partition_bytes;
+    ok = ok && std::fwrite(padding.data(), 1, matrix_padding, file) == matrix_padding;
+    ok = ok && std::fwrite(matrix, 1, matrix_bytes, file) == matrix_bytes;
+    ok = ok && std::fwrite(padding.data(), 1, centroid_padding, file) == centroid_padding;
+    ok = ok && std::fwrite(centroids, 1, centroid_bytes, file) == centroid_bytes;
+    ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return HSUCCEED;
+}
+
+MappedGallerySnapshot::~MappedGallerySnapshot() {
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+    }
+}
+
+int32_t MappedGallerySnapshot::Open(const std::string& path, bool verify_payload, std::shared_ptr<MappedGallerySnapshot>& snapshot) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(GallerySnapshotHeader)) {
+        close(fd);
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    void* base = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    std::shared_ptr<MappedGallerySnapshot> mapped(new MappedGallerySnapshot());
+    mapped->base_ = base;
+    mapped->size_ = info.st_size;
+
+    const auto* header = static_cast<const GallerySnapshotHeader*>(base);
+    if (std::memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 || header->version != kGallerySnapshotVersion ||
+        header->header_checksum != HeaderChecksum(*header)) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    const uint64_t column_bytes = header->count * sizeof(int64_t);
+    const uint64_t identity_bytes = header->identity_count * sizeof(int64_t);
+    const uint64_t partition_bytes = header->count * sizeof(int32_t);
+    const uint64_t matrix_bytes = header->count * header->dim * sizeof(float);
+    const uint64_t centroid_bytes = header->identity_count * header->dim * sizeof(float);
+    if (header->persons_offset < header->ids_offset + column_bytes || header->identities_offset < header->persons_offset + column_bytes ||
+        header->partitions_offset < header->identities_offset + identity_bytes ||
+        header->matrix_offset < header->partitions_offset + partition_bytes || header->centroids_offset < header->matrix_offset + matrix_bytes ||
+        header->matrix_offset % kMatrixAlignment != 0 || header->centroids_offset % kMatrixAlignment != 0 ||
+        header->centroids_offset + centroid_bytes > mapped->size_) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    const char* bytes = static_cast<const char*>(base);
+    mapped->header_ = header;
+    mapped->ids_ = reinterpret_cast<const int64_t*>(bytes + header->ids_offset);
+    mapped->persons_ = reinterpret_cast<const int64_t*>(bytes + header->persons_offset);
+    mapped->identities_ = reinterpret_cast<const int64_t*>(bytes + header->identities_offset);
+    mapped->partitions_ = reinterpret_cast<const int32_t*>(bytes + header->partitions_offset);
+    mapped->matrix_ = reinterpret_cast<const float*>(bytes + header->matrix_offset);
+    mapped->centroids_ = reinterpret_cast<const float*>(bytes + header->centroids_offset);
+    if (verify_payload && !mapped->VerifyPayload()) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    snapshot = mapped;
+    return HSUCCEED;
+}
+
+bool MappedGallerySnapshot::VerifyPayload() const {
+    const uint64_t column_bytes = header_->count * sizeof(int64_t);
+    uint64_t checksum = Checksum64(ids_, column_bytes);
+    checksum = Checksum64(persons_, column_bytes, checksum);
+    checksum = Checksum64(identities_, header_->identity_count * sizeof(int64_t), checksum);
+    checksum = Checksum64(partitions_, header_->count * sizeof(int32_t), checksum);
+    checksum = Checksum64(matrix_, header_->count * header_->dim * sizeof(float), checksum);
+    return header_->payload_checksum == Checksum64(centroids_, header_->identity_count * header_->dim * sizeof(float), checksum);
+}
+
+}  // namespace gallery
@@ -0,0 +1,145 @@
+#pragma once
+#ifndef GALLERY_SNAPSHOT_H
+#define GALLERY_SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @brief Version of the on-disk snapshot layout written by WriteGallerySnapshot.
+ */
+const uint32_t kGallerySnapshotVersion = 3;
+
+/**
+ * @struct GallerySnapshotHeader
+ * @brief Fixed-size header at offset 0 of a snapshot file.
+ *
+ * Layout: header | id column (count x int64) | person column (count x int64) | identity
+ * column (identity_count x int64) | partition column (count x int32) | padding to 64 bytes |
+ * embedding matrix (count x dim float32, row-major, L2-normalized) | padding | centroid
+ * matrix (identity_count x dim float32). Rows are grouped by partition in ascending order.
+ * All values are little-endian.
+ */
+struct GallerySnapshotHeader {
+    char magic[8];              ///< "IFGALSNP"
+    uint32_t version;           ///< kGallerySnapshotVersion
+    uint32_t dim;               ///< Embedding dimension
+    uint64_t count;             ///< Number of rows
+    uint64_t identity_count;    ///< Number of identities (persons)
+    uint64_t ids_offset;        ///< Byte offset of the id column
+    uint64_t persons_offset;    ///< Byte offset of the person column
+    uint64_t identities_offset; ///< Byte offset of the person id of each centroid
+    uint64_t partitions_offset; ///< Byte offset of the partition column
+    uint64_t matrix_offset;     ///< Byte offset of the embedding matrix, 64-byte aligned
+    uint64_t centroids_offset;  ///< Byte offset of the centroid matrix, 64-byte aligned
+    uint64_t source_stamp;      ///< Stamp of the storage the snapshot was built from
+    uint64_t payload_checksum;  ///< Checksum64 of the columns and matrices, in file order
+    uint64_t header_checksum;   ///< Checksum64 of all fields above
+};
+
+/**
+ * @brief Fast 64-bit checksum over a byte range (not cryptographic).
+ */
+uint64_t Checksum64(const void* data, size_t size, uint64_t seed = 0);
+
+/**
+ * @brief Stamp identifying the current state of a storage file (size and modification time).
+ * @return 0 if the file does not exist.
+ */
+uint64_t FileSourceStamp(const std::string& path);
+
+/**
+ * @brief Stamp of several files that a snapshot is built from together.
+ * @return 0 if the first file (the storage of record) does not exist; other files may be missing.
+ */
+uint64_t FileSourceStamp(const std::vector<std::string>& paths);
+
+/**
+ * @brief Writes a snapshot atomically (temporary file, then rename).
+ * @param persons Person of each row.
+ * @param partitions Partition of each row.
+ * @param identities Person of each centroid row.
+ * @param centroids identities.size() x dim normalized centroid matrix.
+ * @return int32_t Status code of the operation.
+ */
+int32_t WriteGallerySnapshot(const std::string& path, uint32_t dim, const std::vector<int64_t>& ids, const std::vector<int64_t>& persons,
+                             const std::vector<int32_t>& partitions, const float* matrix, const std::vector<int64_t>& identities, const float* centroids,
+                             uint64_t source_stamp);
+
+/**
+ * @class MappedGallerySnapshot
+ * @brief Read-only memory mapping of a snapshot file.
+ *
+ * The matrix is used in place, so searches run directly on the page cache and opening
+ * a snapshot costs one mmap plus a header check, independent of the gallery size.
+ */
+class MappedGallerySnapshot {
+public:
+    ~MappedGallerySnapshot();
+
+    MappedGallerySnapshot(const MappedGallerySnapshot&) = delete;
+    MappedGallerySnapshot& operator=(const MappedGallerySnapshot&) = delete;
+
+    /**
+     * @brief Maps a snapshot file and validates its header.
+     * @param path Snapshot file.
+     * @param verify_payload Also verify the payload checksum; this touches every page of the file.
+     * @param snapshot Output mapping.
+     * @return int32_t Status code of the operation.
+     */
+    static int32_t Open(const std::string& path, bool verify_payload, std::shared_ptr<MappedGallerySnapshot>& snapshot);
+
+    const GallerySnapshotHeader& Header() const {
+        return *header_;
+    }
+
+    const int64_t* Ids() const {
+        return ids_;
+    }
+
+    const int64_t* Persons() const {
+        return persons_;
+    }
+
+    const int64_t* Identities() const {
+        return identities_;
+    }
+
+    const int32_t* Partitions() const {
+        return partitions_;
+    }
+
+    const float* Centroids() const {
+        return centroids_;
+    }
+
+    const float* Matrix() const {
+        return matrix_;
+    }
+
+    /**
+     * @brief Checks the payload checksum of the header; this touches every page of the file.
+     */
+    bool VerifyPayload() const;
+
+private:
+    MappedGallerySnapshot() = default;
+
+    void* base_ = nullptr;
+    size_t size_ = 0;
+    const GallerySnapshotHeader* header_ = nullptr;
+    const int64_t* ids_ = nullptr;
+    const int64_t* persons_ = nullptr;
+    const int64_t* identities_ = nullptr;
+    const int32_t* partitions_ = nullptr;
+    const float* matrix_ = nullptr;
+    const float* centroids_ = nullptr;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_SNAPSHOT_H
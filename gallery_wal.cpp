@@ -0,0 +1,124 @@
+#include "gallery_wal.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "gallery_snapshot.h"
+
+namespace gallery {
+
+namespace {
+
+const uint32_t kRecordMagic = 0x4C415746;  // "FWAL"
+// Upper bound on the embedding dimension, rejects garbage headers before allocating.
+const uint32_t kMaxRecordDim = 65536;
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t type;
+    int64_t id;
+    int64_t person;
+    uint32_t dim;
+    int32_t partition;  ///< Logs written before partitions existed have 0 here, the only partition back then
+    uint64_t checksum;  ///< Checksum64 of the fields above and the payload
+};
+
+uint64_t RecordChecksum(const RecordHeader& header, const float* payload) {
+    return Checksum64(payload, header.dim * sizeof(float), Checksum64(&header, offsetof(RecordHeader, checksum)));
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+}  // namespace
+
+WriteAheadLog::~WriteAheadLog() {
+    Close();
+}
+
+int32_t WriteAheadLog::Open(const std::string& path) {
+    Close();
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    return fd_ < 0 ? HERR_INVALID_SERIALIZATION_FAILED : HSUCCEED;
+}
+
+void WriteAheadLog::Close() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+int32_t WriteAheadLog::Append(const std::vector<GalleryMutation>& mutations) {
+    if (fd_ < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    std::vector<char> buffer;
+    for (const auto& mutation : mutations) {
+        RecordHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = kRecordMagic;
+        header.type = static_cast<uint32_t>(mutation.type);
+        header.id = mutation.id;
+        header.person = mutation.person;
+        header.partition = mutation.partition;
+        header.dim = mutation.type == GalleryMutation::UPSERT ? static_cast<uint32_t>(mutation.feature.size()) : 0;
+        header.checksum = RecordChecksum(header, mutation.feature.data());
+        const char* header_bytes = reinterpret_cast<const char*>(&header);
+        const char* payload_bytes = reinterpret_cast<const char*>(mutation.feature.data());
+        buffer.insert(buffer.end(), header_bytes, header_bytes + sizeof(header));
+        buffer.insert(buffer.end(), payload_bytes, payload_bytes + header.dim * sizeof(float));
+    }
+    // One write per batch keeps the records of a batch contiguous in the file.
+    return WriteAll(fd_, buffer.data(), buffer.size()) ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+int32_t WriteAheadLog::Sync() {
+    if (fd_ < 0) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    return fdatasync(fd_) == 0 ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+}
+
+int32_t WriteAheadLog::Replay(const std::string& path, std::vector<GalleryMutation>& mutations) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? HSUCCEED : HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    while (true) {
+        RecordHeader header;
+        if (read(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)) || header.magic != kRecordMagic ||
+            header.type > GalleryMutation::PARTITION || header.dim > kMaxRecordDim) {
+            break;
+        }
+        GalleryMutation mutation;
+        mutation.type = static_cast<GalleryMutation::Type>(header.type);
+        mutation.id = header.id;
+        mutation.person = header.person;
+        mutation.partition = header.partition;
+        mutation.feature.resize(header.dim);
+        const ssize_t payload_size = header.dim * sizeof(float);
+        if (read(fd, mutation.feature.data(), payload_size) != payload_size || header.checksum != RecordChecksum(header, mutation.feature.data())) {
+            break;
+        }
+        mutations.push_back(std::move(mutation));
+    }
+    close(fd);
+    return HSUCCEED;
+}
+
+}  // namespace gallery
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef GALLERY_WAL_H
+#define GALLERY_WAL_H
+
+#include <string>
+#include <vector>
+#include "gallery_mutation.h"
+
+namespace gallery {
+
+/**
+ * @class WriteAheadLog
+ * @brief Append-only log of gallery mutations.
+ *
+ * Each record carries its own checksum; a torn or corrupt tail left by a crash ends the
+ * replay at the last complete record.
+ */
+class WriteAheadLog {
+public:
+    WriteAheadLog() = default;
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /**
+     * @brief Opens the log for appending, creating it if needed.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Open(const std::string& path);
+
+    /**
+     * @brief Closes the log file.
+     */
+    void Close();
+
+    /**
+     * @brief Appends mutations to the log (buffered by the OS until Sync).
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Append(const std::vector<GalleryMutation>& mutations);
+
+    /**
+     * @brief Forces appended records to stable storage.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Sync();
+
+    /**
+     * @brief Reads every complete record of a log file.
+     * @param path Log file; a missing file yields no records.
+     * @param mutations Output records in append order.
+     * @return int32_t Status code of the operation.
+     */
+    static int32_t Replay(const std::string& path, std::vector<GalleryMutation>& mutations);
+
+private:
+    int fd_ = -1;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_WAL_H
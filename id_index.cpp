@@ -0,0 +1,113 @@
+#include "id_index.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace gallery {
+
+namespace {
+
+// Marks a free slot; never a valid custom id (those are >= 0).
+const int64_t kEmpty = std::numeric_limits<int64_t>::min();
+const size_t kMinCapacity = 16;
+
+}  // namespace
+
+const size_t IdIndex::kNotFound;
+
+size_t IdIndex::Home(int64_t id) const {
+    // Ids are usually sequential; mix the bits so neighbours do not form one long probe run.
+    uint64_t hash = static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 32;
+    return static_cast<size_t>(hash) & (slots_.size() - 1);
+}
+
+size_t IdIndex::Find(int64_t id) const {
+    if (slots_.empty()) {
+        return kNotFound;
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = Home(id);; slot = (slot + 1) & mask) {
+        if (slots_[slot].id == id) {
+            return slots_[slot].row;
+        }
+        if (slots_[slot].id == kEmpty) {
+            return kNotFound;
+        }
+    }
+}
+
+void IdIndex::Set(int64_t id, size_t row) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+        Rehash(std::max(kMinCapacity, slots_.size() * 2));
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = Home(id);; slot = (slot + 1) & mask) {
+        if (slots_[slot].id == id) {
+            slots_[slot].row = row;
+            return;
+        }
+        if (slots_[slot].id == kEmpty) {
+            slots_[slot].id = id;
+            slots_[slot].row = row;
+            ++size_;
+            return;
+        }
+    }
+}
+
+bool IdIndex::Erase(int64_t id) {
+    if (slots_.empty()) {
+        return false;
+    }
+    const size_t mask = slots_.size() - 1;
+    size_t hole = Home(id);
+    while (slots_[hole].id != id) {
+        if (slots_[hole].id == kEmpty) {
+            return false;
+        }
+        hole = (hole + 1) & mask;
+    }
+    // Backward-shift deletion: pull later entries of the run into the hole when their home allows it.
+    for (size_t slot = (hole + 1) & mask; slots_[slot].id != kEmpty; slot = (slot + 1) & mask) {
+        const size_t home = Home(slots_[slot].id);
+        // The entry may move to the hole only if the hole lies on its probe path (home..slot, cyclically).
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            slots_[hole] = slots_[slot];
+            hole = slot;
+        }
+    }
+    slots_[hole].id = kEmpty;
+    --size_;
+    return true;
+}
+
+void IdIndex::Reserve(size_t count) {
+    size_t capacity = kMinCapacity;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    if (capacity > slots_.size()) {
+        Rehash(capacity);
+    }
+}
+
+void IdIndex::Clear() {
+    slots_.clear();
+    size_ = 0;
+}
+
+void IdIndex::Rehash(size_t capacity) {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    Slot empty = {kEmpty, 0};
+    slots_.assign(capacity, empty);
+    size_ = 0;
+    for (const auto& slot : old) {
+        if (slot.id != kEmpty) {
+            Set(slot.id, slot.row);
+        }
+    }
+}
+
+}  // namespace gallery
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef GALLERY_ID_INDEX_H
+#define GALLERY_ID_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @class IdIndex
+ * @brief Open-addressing hash map from custom id to gallery row.
+ *
+ * Linear probing over one flat slot array, kept at most half full. Erase shifts the
+ * following entries of the probe run back instead of leaving tombstones, so lookups stay
+ * short no matter how many ids have been removed.
+ */
+class IdIndex {
+public:
+    static const size_t kNotFound = static_cast<size_t>(-1);
+
+    IdIndex() = default;
+
+    /**
+     * @brief Row of an id, or kNotFound.
+     */
+    size_t Find(int64_t id) const;
+
+    /**
+     * @brief Sets the row of an id, adding the id if needed.
+     */
+    void Set(int64_t id, size_t row);
+
+    /**
+     * @brief Removes an id.
+     * @return false if the id was not present.
+     */
+    bool Erase(int64_t id);
+
+    /**
+     * @brief Sizes the table for count ids without rehashing.
+     */
+    void Reserve(size_t count);
+
+    /**
+     * @brief Removes every id.
+     */
+    void Clear();
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    struct Slot {
+        int64_t id;
+        size_t row;
+    };
+
+    size_t Home(int64_t id) const;
+    void Rehash(size_t capacity);
+
+    std::vector<Slot> slots_;  ///< Capacity is a power of two; free slots hold kEmpty
+    size_t size_ = 0;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_ID_INDEX_H
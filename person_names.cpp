@@ -0,0 +1,133 @@
+#include "person_names.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <inspireface/herror.h>
+
+namespace gallery {
+
+int32_t PersonNames::Load(const std::string& path) {
+    persons_.clear();
+    names_.clear();
+    unsaved_.clear();
+    next_person_ = kNamedPersonBase;
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return HSUCCEED;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos) {
+            continue;
+        }
+        std::istringstream fields(line);
+        int64_t person;
+        if (!(fields >> person) || fields.get() != ' ') {
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        std::string name;
+        std::getline(fields, name);
+        if (name.empty() || !persons_.emplace(name, person).second || !names_.emplace(person, name).second) {
+            return HERR_INVALID_SERIALIZATION_FAILED;
+        }
+        next_person_ = std::max(next_person_, person + 1);
+    }
+    return HSUCCEED;
+}
+
+int32_t PersonNames::Save(const std::string& path) {
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::trunc);
+    if (!file.is_open()) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    // In id order, so the file diffs cleanly between enrollment runs.
+    std::vector<std::pair<int64_t, const std::string*>> rows;
+    rows.reserve(names_.size());
+    for (const auto& entry : names_) {
+        rows.emplace_back(entry.first, &entry.second);
+    }
+    std::sort(rows.begin(), rows.end());
+    for (const auto& row : rows) {
+        file << row.first << " " << *row.second << "\n";
+    }
+    file.close();
+    if (file.fail() || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    unsaved_.clear();
+    return HSUCCEED;
+}
+
+int32_t PersonNames::Append(const std::string& path) {
+    if (unsaved_.empty()) {
+        return HSUCCEED;
+    }
+    std::ofstream file(path, std::ios::app);
+    for (auto person : unsaved_) {
+        file << person << " " << names_[person] << "\n";
+    }
+    file.close();
+    if (file.fail()) {
+        return HERR_INVALID_SERIALIZATION_FAILED;
+    }
+    unsaved_.clear();
+    return HSUCCEED;
+}
+
+int64_t PersonNames::Resolve(const std::string& name) {
+    auto it = persons_.find(name);
+    if (it != persons_.end()) {
+        return it->second;
+    }
+    const int64_t person = next_person_++;
+    persons_.emplace(name, person);
+    names_.emplace(person, name);
+    unsaved_.push_back(person);
+    return person;
+}
+
+void PersonNames::Reserve(int64_t person) {
+    next_person_ = std::max(next_person_, person + 1);
+}
+
+size_t PersonNames::Merge(const PersonNames& other, std::vector<std::string>& conflicts) {
+    // In id order, so the appended lines and the conflicts come out the same on every run.
+    std::vector<std::pair<int64_t, const std::string*>> rows;
+    rows.reserve(other.names_.size());
+    for (const auto& entry : other.names_) {
+        rows.emplace_back(entry.first, &entry.second);
+    }
+    std::sort(rows.begin(), rows.end());
+    size_t added = 0;
+    for (const auto& row : rows) {
+        auto person = persons_.find(*row.second);
+        auto name = names_.find(row.first);
+        if (person != persons_.end() || name != names_.end()) {
+            if (person == persons_.end() || person->second != row.first) {
+                conflicts.push_back(*row.second);
+            }
+            continue;
+        }
+        persons_.emplace(*row.second, row.first);
+        names_.emplace(row.first, *row.second);
+        unsaved_.push_back(row.first);
+        Reserve(row.first);
+        ++added;
+    }
+    return added;
+}
+
+const std::string* PersonNames::Name(int64_t person) const {
+    auto it = names_.find(person);
+    return it != names_.end() ? &it->second : nullptr;
+}
+
+}  // namespace gallery
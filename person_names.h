@@ -0,0 +1,92 @@
+#pragma once
+#ifndef GALLERY_PERSON_NAMES_H
+#define GALLERY_PERSON_NAMES_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @brief First person id handed out for a name.
+ *
+ * Feature ids are 32-bit and a feature without a label is its own person, so named persons
+ * start above every feature id and can never merge with one.
+ */
+const int64_t kNamedPersonBase = int64_t(1) << 32;
+
+/**
+ * @class PersonNames
+ * @brief Maps person names (such as the folder an image was enrolled from) to person ids.
+ *
+ * Stored next to the identity labels as a text file with one `person name` line per person;
+ * the name is the rest of the line and may contain spaces. The gallery itself only knows the
+ * ids.
+ */
+class PersonNames {
+public:
+    /**
+     * @brief Reads a names file; a missing file is an empty map.
+     * @return int32_t Status code; HERR_INVALID_SERIALIZATION_FAILED on a malformed line.
+     */
+    int32_t Load(const std::string& path);
+
+    /**
+     * @brief Writes the names file through a temporary file, so readers never see it half written.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Save(const std::string& path);
+
+    /**
+     * @brief Appends the names assigned since the last Load, Save or Append to a names file.
+     *
+     * Cheaper than Save when only a few names are new, so it can run after every insert batch.
+     * @return int32_t Status code of the operation.
+     */
+    int32_t Append(const std::string& path);
+
+    /**
+     * @brief Returns the person id of name, assigning the next free one to a new name.
+     */
+    int64_t Resolve(const std::string& name);
+
+    /**
+     * @brief Makes Resolve assign ids above person.
+     *
+     * Galleries can hold persons the names file does not know (imported from another device),
+     * so enrollment reserves the largest person id of the gallery before resolving names.
+     */
+    void Reserve(int64_t person);
+
+    /**
+     * @brief Adds the names of another map, such as the names of an imported gallery.
+     *
+     * A name is added with its id unless this map already has the name or the id for a
+     * different pairing; those are returned in conflicts and keep their current meaning.
+     * Added names are saved by the next Append or Save.
+     * @return Number of names added.
+     */
+    size_t Merge(const PersonNames& other, std::vector<std::string>& conflicts);
+
+    /**
+     * @brief Name of a person.
+     * @return The name, or nullptr if the person has none.
+     */
+    const std::string* Name(int64_t person) const;
+
+    size_t Size() const {
+        return persons_.size();
+    }
+
+private:
+    std::unordered_map<std::string, int64_t> persons_;  ///< Name -> person id
+    std::unordered_map<int64_t, std::string> names_;    ///< Person id -> name
+    std::vector<int64_t> unsaved_;                      ///< Persons assigned since the file was last written
+    int64_t next_person_ = kNamedPersonBase;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_PERSON_NAMES_H
@@ -0,0 +1,103 @@
+#include "score_converter.h"
+
+#include <cmath>
+#include <thread>
+
+namespace gallery {
+
+namespace {
+
+// Intervals of the lookup table over [-1, 1]; 2048 keeps the interpolation error far below display precision.
+const size_t kTableSize = 2048;
+
+}  // namespace
+
+double ScoreConverter::Snapshot::Exact(double cosine) const {
+    double shifted = config.steepness * (cosine - config.threshold);
+    double sigmoid = 1.0 / (1.0 + std::exp(-shifted - bias));
+    return sigmoid * scale + config.outputMin;
+}
+
+ScoreConverter::ScoreConverter(const inspire::SimilarityConverterConfig& config) : front_(0) {
+    readers_[0].store(0);
+    readers_[1].store(0);
+    UpdateConfig(config);
+}
+
+ScoreConverter::~ScoreConverter() = default;
+
+ScoreConverter& ScoreConverter::Instance() {
+    static ScoreConverter instance;
+    return instance;
+}
+
+void ScoreConverter::UpdateConfig(const inspire::SimilarityConverterConfig& config) {
+    std::unique_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->config = config;
+    snapshot->scale = config.outputMax - config.outputMin;
+    snapshot->bias = -std::log((config.outputMax - config.middleScore) / (config.middleScore - config.outputMin));
+    snapshot->table.resize(kTableSize + 1);
+    for (size_t i = 0; i <= kTableSize; ++i) {
+        snapshot->table[i] = snapshot->Exact(-1.0 + 2.0 * i / kTableSize);
+    }
+
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    // The spare slot was drained when it was replaced, and readers never pin a slot that is not published.
+    const int old_front = slots_[front_.load()] == nullptr ? 1 : front_.load();
+    slots_[1 - old_front] = std::move(snapshot);
+    front_.store(1 - old_front);
+    while (readers_[old_front].load() != 0) {
+        std::this_thread::yield();
+    }
+}
+
+int ScoreConverter::AcquireRead() const {
+    while (true) {
+        int slot = front_.load();
+        readers_[slot].fetch_add(1);
+        // An update may have republished between the load and the increment; pin the new front then.
+        if (front_.load() == slot) {
+            return slot;
+        }
+        readers_[slot].fetch_sub(1);
+    }
+}
+
+void ScoreConverter::ReleaseRead(int slot) const {
+    readers_[slot].fetch_sub(1);
+}
+
+inspire::SimilarityConverterConfig ScoreConverter::GetConfig() const {
+    const int slot = AcquireRead();
+    inspire::SimilarityConverterConfig config = slots_[slot]->config;
+    ReleaseRead(slot);
+    return config;
+}
+
+double ScoreConverter::Convert(float cosine) const {
+    const int slot = AcquireRead();
+    const double score = slots_[slot]->Exact(cosine);
+    ReleaseRead(slot);
+    return score;
+}
+
+void ScoreConverter::ConvertBatch(const float* cosine, double* result, size_t count) const {
+    const int slot = AcquireRead();
+    const Snapshot* snapshot = slots_[slot].get();
+    const double* table = snapshot->table.data();
+    const double step = kTableSize / 2.0;
+    for (size_t i = 0; i < count; ++i) {
+        const double position = (static_cast<double>(cosine[i]) + 1.0) * step;
+        if (!(position >= 0.0 && position < kTableSize)) {
+            // Out of range (or NaN): take the exact path.
+            result[i] = snapshot->Exact(cosine[i]);
+            continue;
+        }
+        const size_t cell = static_cast<size_t>(position);
+        const double fraction = position - cell;
+        result[i] = table[cell] + (table[cell + 1] - table[cell]) * fraction;
+    }
+    ReleaseRead(slot);
+}
+
+}  // namespace gallery
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef GALLERY_SCORE_CONVERTER_H
+#define GALLERY_SCORE_CONVERTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <inspireface/similarity_converter.h>
+
+namespace gallery {
+
+/**
+ * @class ScoreConverter
+ * @brief Lock-free cosine-to-percentage mapping with a batch path.
+ *
+ * Same sigmoid as inspire::SimilarityConverter, but the configuration is published as an
+ * immutable snapshot: conversions never take a lock, only pin the published snapshot with an
+ * atomic reader count. Each snapshot also carries a lookup table over [-1, 1] that
+ * ConvertBatch interpolates instead of calling exp per score.
+ *
+ * Like the FaceGallery contents, the snapshots are double-buffered: an update builds the new
+ * snapshot in the spare slot, publishes it, and waits for the conversions still reading the
+ * old one, which then becomes the spare. Only two snapshots ever exist.
+ */
+class ScoreConverter {
+public:
+    explicit ScoreConverter(const inspire::SimilarityConverterConfig& config = inspire::SimilarityConverterConfig());
+    ~ScoreConverter();
+
+    ScoreConverter(const ScoreConverter&) = delete;
+    ScoreConverter& operator=(const ScoreConverter&) = delete;
+
+    /**
+     * @brief Process-wide converter, initialized with the default configuration.
+     */
+    static ScoreConverter& Instance();
+
+    /**
+     * @brief Publishes a new configuration; conversions already running finish with the old one.
+     */
+    void UpdateConfig(const inspire::SimilarityConverterConfig& config);
+
+    /**
+     * @brief Current configuration.
+     */
+    inspire::SimilarityConverterConfig GetConfig() const;
+
+    /**
+     * @brief Converts one cosine similarity exactly.
+     */
+    double Convert(float cosine) const;
+
+    /**
+     * @brief Converts count cosine similarities, e.g. a top-K list or an N x M score matrix.
+     *
+     * Scores inside [-1, 1] are interpolated from the lookup table (absolute error below
+     * 1e-5 for the default curve); scores outside are computed exactly.
+     */
+    void ConvertBatch(const float* cosine, double* result, size_t count) const;
+
+private:
+    struct Snapshot {
+        inspire::SimilarityConverterConfig config;
+        double scale;              ///< outputMax - outputMin
+        double bias;               ///< Sigmoid bias putting middleScore at the threshold
+        std::vector<double> table; ///< Converted scores at kTableSize + 1 evenly spaced cosines over [-1, 1]
+
+        double Exact(double cosine) const;
+    };
+
+    // Pins the published slot against reuse; returns its index.
+    int AcquireRead() const;
+    void ReleaseRead(int slot) const;
+
+    std::unique_ptr<Snapshot> slots_[2];       ///< Published snapshot and the spare
+    std::atomic<int> front_;                   ///< Index of the published snapshot
+    mutable std::atomic<int> readers_[2];      ///< Conversions reading each slot
+    std::mutex update_mutex_;                  ///< Serializes writers only
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_SCORE_CONVERTER_H
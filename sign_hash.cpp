@@ -0,0 +1,66 @@
+#include "sign_hash.h"
+
+#include <random>
+
+namespace gallery {
+
+namespace {
+
+// In-place unnormalized fast Walsh-Hadamard transform; size must be a power of two.
+void Hadamard(float* data, size_t size) {
+    for (size_t half = 1; half < size; half *= 2) {
+        for (size_t block = 0; block < size; block += half * 2) {
+            for (size_t i = block; i < block + half; ++i) {
+                float a = data[i];
+                float b = data[i + half];
+                data[i] = a + b;
+                data[i + half] = a - b;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+SignHash::SignHash(size_t dim, bool rotate, uint32_t seed) : dim_(dim), bits_(64), rotate_(rotate) {
+    while (bits_ < dim) {
+        bits_ *= 2;
+    }
+    if (rotate_) {
+        std::mt19937 rng(seed);
+        for (auto& signs : signs_) {
+            signs.resize(bits_);
+            for (auto& sign : signs) {
+                sign = (rng() & 1) ? 1.0f : -1.0f;
+            }
+        }
+    }
+}
+
+void SignHash::Encode(const float* vec, uint64_t* code, std::vector<float>& scratch) const {
+    const float* values = vec;
+    if (rotate_) {
+        scratch.assign(bits_, 0.0f);
+        for (size_t i = 0; i < dim_; ++i) {
+            scratch[i] = vec[i] * signs_[0][i];
+        }
+        Hadamard(scratch.data(), bits_);
+        for (size_t i = 0; i < bits_; ++i) {
+            scratch[i] *= signs_[1][i];
+        }
+        Hadamard(scratch.data(), bits_);
+        values = scratch.data();
+    }
+    // Without rotation the padding bits past dim stay zero in every code and never count.
+    const size_t count = rotate_ ? bits_ : dim_;
+    for (size_t word = 0; word < bits_ / 64; ++word) {
+        code[word] = 0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (values[i] > 0.0f) {
+            code[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+}
+
+}  // namespace gallery
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef GALLERY_SIGN_HASH_H
+#define GALLERY_SIGN_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @class SignHash
+ * @brief Binary code of an embedding: one sign bit per (optionally rotated) dimension.
+ *
+ * The Hamming distance between two codes estimates the angle between the embeddings, so
+ * a scan over codes (one popcount per 64 dimensions) can shortlist candidates for an exact
+ * cosine re-rank. The optional rotation is a randomized Hadamard transform; it spreads
+ * energy evenly over the bits when a few dimensions dominate, at O(d log d) per vector.
+ */
+class SignHash {
+public:
+    /**
+     * @param dim Embedding dimension; codes are padded to a power of two bits.
+     * @param rotate Apply the random rotation before taking signs.
+     * @param seed Seed of the rotation; codes are only comparable under the same seed.
+     */
+    SignHash(size_t dim, bool rotate, uint32_t seed);
+
+    /**
+     * @brief Number of 64-bit words per code.
+     */
+    size_t Words() const {
+        return bits_ / 64;
+    }
+
+    /**
+     * @brief Writes the code of vec (dim floats) to code (Words() words).
+     * @param scratch Reused buffer of the rotation.
+     */
+    void Encode(const float* vec, uint64_t* code, std::vector<float>& scratch) const;
+
+    /**
+     * @brief Hamming distance of two codes.
+     */
+    static uint32_t Distance(const uint64_t* a, const uint64_t* b, size_t words) {
+        uint32_t distance = 0;
+        for (size_t i = 0; i < words; ++i) {
+            distance += static_cast<uint32_t>(__builtin_popcountll(a[i] ^ b[i]));
+        }
+        return distance;
+    }
+
+private:
+    size_t dim_;
+    size_t bits_;
+    bool rotate_;
+    std::vector<float> signs_[2];  ///< Random +-1 diagonals around the two Hadamard passes
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_SIGN_HASH_H
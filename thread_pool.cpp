@@ -0,0 +1,121 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace gallery {
+
+ThreadPool::ThreadPool(int32_t num_threads, const std::vector<int32_t>& cpu_affinity) {
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    caller_participates_ = cpu_affinity.empty();
+    workers_.reserve(num_threads);
+    for (int32_t i = 0; i < num_threads; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+#if defined(__linux__)
+        if (!cpu_affinity.empty()) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (auto cpu : cpu_affinity) {
+                CPU_SET(cpu, &cpu_set);
+            }
+            pthread_setaffinity_np(workers_.back().native_handle(), sizeof(cpu_set), &cpu_set);
+        }
+#endif
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::RunOne(Job* job, std::unique_lock<std::mutex>& lock) {
+    if (job->next >= job->count) {
+        return false;
+    }
+    size_t index = job->next++;
+    if (job->next >= job->count) {
+        // Last task handed out: drop the job so nobody touches it after its caller returns.
+        jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+    }
+    lock.unlock();
+    (*job->fn)(index);
+    lock.lock();
+    if (++job->done == job->count) {
+        done_cv_.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+            return;
+        }
+        RunOne(jobs_.front(), lock);
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    Job job;
+    job.fn = &fn;
+    job.count = count;
+    job.next = 0;
+    job.done = 0;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.push_back(&job);
+    work_cv_.notify_all();
+    if (caller_participates_) {
+        while (RunOne(&job, lock)) {
+        }
+    }
+    done_cv_.wait(lock, [&job] { return job.done == job.count; });
+}
+
+std::vector<int32_t> ThreadPool::BigCoreIds() {
+    std::vector<int32_t> cpus;
+    std::vector<long> max_freqs;
+    int32_t num_cpus = static_cast<int32_t>(std::thread::hardware_concurrency());
+    for (int32_t cpu = 0; cpu < num_cpus; ++cpu) {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/cpuinfo_max_freq");
+        long freq = 0;
+        if (!(file >> freq)) {
+            return std::vector<int32_t>();
+        }
+        cpus.push_back(cpu);
+        max_freqs.push_back(freq);
+    }
+    if (cpus.empty()) {
+        return cpus;
+    }
+    long top = *std::max_element(max_freqs.begin(), max_freqs.end());
+    // Big clusters on the same SoC may differ by a few speed bins (e.g. RK3588 A76 pairs), so allow 10% slack.
+    std::vector<int32_t> big_cores;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (max_freqs[i] * 10 >= top * 9) {
+            big_cores.push_back(cpus[i]);
+        }
+    }
+    return big_cores;
+}
+
+}  // namespace gallery
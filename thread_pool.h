@@ -0,0 +1,81 @@
+#pragma once
+#ifndef GALLERY_THREAD_POOL_H
+#define GALLERY_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gallery {
+
+/**
+ * @class ThreadPool
+ * @brief Persistent worker pool used to split one query across several CPU cores.
+ *
+ * Workers stay alive for the lifetime of the pool, so a search does not pay thread
+ * creation cost. Several threads may call ParallelFor at the same time; their tasks
+ * are interleaved on the same workers.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Creates the pool.
+     * @param num_threads Number of worker threads (0 means one per online core).
+     * @param cpu_affinity CPUs the workers are pinned to. Empty means no pinning.
+     */
+    explicit ThreadPool(int32_t num_threads, const std::vector<int32_t>& cpu_affinity = std::vector<int32_t>());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Runs fn(0) ... fn(count - 1) on the pool and blocks until all of them return.
+     *
+     * Without CPU pinning the calling thread takes tasks too. With pinning it only waits,
+     * so a caller sitting on a little core cannot become the straggler. The call itself
+     * does not allocate once the job queue has grown to the number of concurrent callers.
+     */
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    /**
+     * @brief Number of worker threads.
+     */
+    size_t Size() const {
+        return workers_.size();
+    }
+
+    /**
+     * @brief Lists the online CPUs whose maximum frequency is within 10% of the fastest one (the big cores on big.LITTLE SoCs).
+     * @return CPU ids, or an empty vector if the topology cannot be read.
+     */
+    static std::vector<int32_t> BigCoreIds();
+
+private:
+    // Lives on the stack of the ParallelFor caller, which outlives it in the queue.
+    struct Job {
+        const std::function<void(size_t)>* fn;
+        size_t count;
+        size_t next;
+        size_t done;
+    };
+
+    void WorkerLoop();
+    // Takes the next task of job and runs it. Must be called with lock held, returns with lock held.
+    bool RunOne(Job* job, std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> workers_;
+    std::vector<Job*> jobs_;  ///< Jobs with tasks left to hand out, oldest first
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    bool stop_ = false;
+    bool caller_participates_ = true;
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_THREAD_POOL_H
@@ -0,0 +1,353 @@
+#include "video_enrollment.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <opencv2/opencv.hpp>
+#include <inspirecv/inspirecv.h>
+#include <inspireface/herror.h>
+#include "cosine_similarity.h"
+
+namespace gallery {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// A frame kept for a track; the crop is dropped once its feature is extracted.
+struct KeptFrame {
+    int64_t frame;
+    float score;  ///< Quality times frontalness
+    float quality;
+    inspirecv::Image crop;
+    inspire::Embedded embedding;
+};
+
+struct Track {
+    size_t frames = 0;  ///< Frames passing the bar
+    std::vector<KeptFrame> kept;
+};
+
+// Output of one segment thread.
+struct SegmentResult {
+    std::vector<Track> tracks;  ///< Tracks with enough frames and at least one extracted feature
+    size_t frames = 0;
+    size_t extractions = 0;
+    size_t cache_hits = 0;
+    bool opened = false;
+};
+
+void Normalize(inspire::Embedded& embedding) {
+    const float norm = std::sqrt(DotProduct(embedding.data(), embedding.data(), embedding.size()));
+    const float scale = norm > 0.0f ? 1.0f / norm : 0.0f;
+    for (auto& value : embedding) {
+        value *= scale;
+    }
+}
+
+// Index of the kept frame a new frame takes the place of, kept.size() to append it, or -1 to drop it.
+// A frame within min_gap of kept frames competes with those only, so the kept frames stay spread
+// out; if it beats them all, the ones it does not replace are removed.
+int64_t ReplacedFrame(std::vector<KeptFrame>& kept, int64_t frame, float score, const VideoEnrollmentConfiguration& config) {
+    std::vector<size_t> close;
+    for (size_t i = 0; i < kept.size(); ++i) {
+        if (std::abs(kept[i].frame - frame) < config.min_frame_gap) {
+            if (kept[i].score >= score) {
+                return -1;
+            }
+            close.push_back(i);
+        }
+    }
+    if (!close.empty()) {
+        for (size_t i = close.size() - 1; i > 0; --i) {
+            kept.erase(kept.begin() + close[i]);
+        }
+        return static_cast<int64_t>(close[0]);
+    }
+    if (kept.size() < static_cast<size_t>(std::max(1, config.frames_per_track))) {
+        return static_cast<int64_t>(kept.size());
+    }
+    size_t worst = 0;
+    for (size_t i = 1; i < kept.size(); ++i) {
+        if (kept[i].score < kept[worst].score) {
+            worst = i;
+        }
+    }
+    return kept[worst].score < score ? static_cast<int64_t>(worst) : -1;
+}
+
+// Decodes and tracks frames [begin, end) of a file, then extracts the features of the kept frames.
+void TrackSegment(const std::string& path, int64_t begin, int64_t end, inspire::Session& session,
+                  const VideoEnrollmentConfiguration& config, EmbeddingCache* cache, SegmentResult& result) {
+    cv::VideoCapture capture(path);
+    if (!capture.isOpened()) {
+        return;
+    }
+    result.opened = true;
+    if (begin > 0) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(begin));
+    }
+    inspire::CustomPipelineParameter quality_param;
+    quality_param.enable_face_quality = true;
+    std::map<int, Track> tracks;
+    cv::Mat frame;
+    for (int64_t index = begin; index < end && capture.read(frame); ++index) {
+        ++result.frames;
+        inspirecv::FrameProcess process =
+            inspirecv::FrameProcess::Create(frame.data, frame.rows, frame.cols, inspirecv::BGR, inspirecv::ROTATION_0);
+        std::vector<inspire::FaceTrackWrap> faces;
+        if (session.FaceDetectAndTrack(process, faces) != HSUCCEED || faces.empty()) {
+            continue;
+        }
+        std::vector<float> quality;
+        if (session.MultipleFacePipelineProcess(process, quality_param, faces) == HSUCCEED) {
+            quality = session.GetFaceQualityConfidence();
+        }
+        if (config.min_quality > 0.0f && quality.size() < faces.size()) {
+            continue;  // Unmeasured faces must not pass the quality bar
+        }
+        for (size_t i = 0; i < faces.size(); ++i) {
+            inspire::FaceTrackWrap& face = faces[i];
+            const float pose = std::max(std::abs(face.face3DAngle.yaw), std::abs(face.face3DAngle.pitch));
+            const float face_quality = i < quality.size() ? quality[i] : 1.0f;
+            if (std::min(face.rect.width, face.rect.height) < config.min_face_side || (config.max_pose > 0.0f && pose > config.max_pose) ||
+                face_quality < config.min_quality) {
+                continue;
+            }
+            Track& track = tracks[face.trackId];
+            ++track.frames;
+            const float score = std::max(0.0f, std::min(1.0f, face_quality)) * std::max(0.0f, 1.0f - pose / 90.0f);
+            const int64_t slot = ReplacedFrame(track.kept, index, score, config);
+            if (slot < 0) {
+                continue;
+            }
+            // Aligning is cheap; the recognition model only runs on the frames still kept at the end
+            KeptFrame kept{index, score, face_quality, inspirecv::Image(), inspire::Embedded()};
+            session.GetFaceAlignmentImage(process, face, kept.crop);
+            if (static_cast<size_t>(slot) == track.kept.size()) {
+                track.kept.push_back(std::move(kept));
+            } else {
+                track.kept[slot] = std::move(kept);
+            }
+        }
+    }
+
+    for (auto& entry : tracks) {
+        Track& track = entry.second;
+        if (track.frames < static_cast<size_t>(std::max(1, config.min_track_frames))) {
+            continue;
+        }
+        std::vector<KeptFrame> extracted;
+        for (auto& kept : track.kept) {
+            uint64_t key = 0;
+            bool found = false;
+            if (cache != nullptr) {
+                key = cache->Key(kept.crop);
+                found = cache->Find(key, kept.embedding);
+            }
+            if (!found) {
+                inspire::FaceEmbedding feature;
+                if (session.FaceFeatureExtractWithAlignmentImage(kept.crop, feature) != HSUCCEED) {
+                    continue;
+                }
+                kept.embedding = std::move(feature.embedding);
+                if (cache != nullptr) {
+                    cache->Insert(key, kept.embedding);
+                }
+            }
+            ++result.extractions;
+            result.cache_hits += found ? 1 : 0;
+            kept.crop = inspirecv::Image();
+            Normalize(kept.embedding);
+            extracted.push_back(std::move(kept));
+        }
+        if (!extracted.empty()) {
+            track.kept.swap(extracted);
+            result.tracks.push_back(std::move(track));
+        }
+    }
+}
+
+size_t FindRoot(std::vector<size_t>& parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Highest cosine between the kept frames of two tracks.
+float TrackSimilarity(const Track& a, const Track& b) {
+    float best = -1.0f;
+    for (const auto& x : a.kept) {
+        for (const auto& y : b.kept) {
+            if (x.embedding.size() == y.embedding.size()) {
+                best = std::max(best, DotProduct(x.embedding.data(), y.embedding.data(), x.embedding.size()));
+            }
+        }
+    }
+    return best;
+}
+
+// Farthest-point selection over the kept frames of one person.
+std::vector<VideoTemplate> ChooseTemplates(std::vector<const KeptFrame*>& frames, double fps, const VideoEnrollmentConfiguration& config) {
+    std::vector<VideoTemplate> templates;
+    if (frames.empty()) {
+        return templates;
+    }
+    std::sort(frames.begin(), frames.end(), [](const KeptFrame* a, const KeptFrame* b) { return a->score > b->score; });
+    // Distance of every frame to its nearest chosen template
+    std::vector<float> distance(frames.size(), std::numeric_limits<float>::max());
+    size_t next = 0;
+    const size_t limit = static_cast<size_t>(std::max(1, config.templates));
+    while (templates.size() < limit) {
+        const KeptFrame& chosen = *frames[next];
+        templates.push_back(VideoTemplate{chosen.frame, fps > 0.0 ? chosen.frame / fps : 0.0, chosen.quality, chosen.embedding});
+        float farthest = -1.0f;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i]->embedding.size() == chosen.embedding.size()) {
+                const float d = 1.0f - DotProduct(frames[i]->embedding.data(), chosen.embedding.data(), chosen.embedding.size());
+                distance[i] = std::min(distance[i], d);
+            }
+            // Ties go to the better frame, which comes first
+            if (distance[i] > farthest) {
+                farthest = distance[i];
+                next = i;
+            }
+        }
+        // Chosen frames are at distance 0, so this also stops before one is chosen twice
+        if (farthest <= 0.0f || farthest < config.min_template_distance) {
+            break;
+        }
+    }
+    return templates;
+}
+
+}  // namespace
+
+VideoEnrollment::VideoEnrollment(const VideoEnrollmentConfiguration& config) : config_(config) {}
+
+bool VideoEnrollment::IsVideoFile(const std::string& name) {
+    const size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == "mp4" || ext == "avi" || ext == "mov" || ext == "mkv" || ext == "h264" || ext == "h265";
+}
+
+int32_t VideoEnrollment::Initialize() {
+    sessions_.clear();
+    if (config_.segments < 1) {
+        return HERR_INVALID_PARAM;
+    }
+    inspire::CustomPipelineParameter param;
+    param.enable_recognition = true;
+    param.enable_face_quality = true;
+    for (int32_t i = 0; i < config_.segments; ++i) {
+        std::shared_ptr<inspire::Session> session(
+            inspire::Session::CreatePtr(inspire::DETECT_MODE_LIGHT_TRACK, std::max(1, config_.max_faces), param, config_.detect_level));
+        if (session == nullptr) {
+            sessions_.clear();
+            return HERR_SESS_PIPELINE_FAILURE;
+        }
+        sessions_.push_back(session);
+    }
+    return HSUCCEED;
+}
+
+int32_t VideoEnrollment::Run(const std::string& path, std::vector<VideoIdentity>& identities, VideoStatistics* statistics) {
+    identities.clear();
+    if (sessions_.empty()) {
+        return HERR_INVALID_PARAM;
+    }
+    const Clock::time_point start = Clock::now();
+    cv::VideoCapture probe(path);
+    if (!probe.isOpened()) {
+        return HERR_INVALID_IMAGE_STREAM_PARAM;
+    }
+    const int64_t frame_count = static_cast<int64_t>(probe.get(cv::CAP_PROP_FRAME_COUNT));
+    const double fps = probe.get(cv::CAP_PROP_FPS);
+    probe.release();
+
+    // Streams without a frame count, and short clips, are tracked in one piece
+    size_t segments = 1;
+    if (frame_count > 0) {
+        const int64_t by_length = frame_count / std::max<int64_t>(1, config_.min_segment_frames);
+        segments = static_cast<size_t>(std::max<int64_t>(1, std::min<int64_t>(static_cast<int64_t>(sessions_.size()), by_length)));
+    }
+    const int64_t per_segment = frame_count > 0 ? (frame_count + segments - 1) / segments : 0;
+    std::vector<SegmentResult> results(segments);
+    std::vector<std::thread> threads;
+    for (size_t s = 0; s < segments; ++s) {
+        // The frame count can be an estimate, so the last segment reads to the end of the file
+        const int64_t begin = static_cast<int64_t>(s) * per_segment;
+        const int64_t end = s + 1 < segments ? begin + per_segment : std::numeric_limits<int64_t>::max();
+        threads.emplace_back(TrackSegment, std::cref(path), begin, end, std::ref(*sessions_[s]), std::cref(config_), cache_,
+                             std::ref(results[s]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<Track> tracks;
+    VideoStatistics stats;
+    stats.segments = static_cast<int32_t>(segments);
+    for (auto& result : results) {
+        if (!result.opened) {
+            return HERR_INVALID_IMAGE_STREAM_PARAM;
+        }
+        stats.frames += result.frames;
+        stats.extractions += result.extractions;
+        stats.cache_hits += result.cache_hits;
+        for (auto& track : result.tracks) {
+            tracks.push_back(std::move(track));
+        }
+    }
+    stats.tracks = tracks.size();
+
+    // Tracks of the same face, across segments or after the tracker lost it, become one person
+    std::vector<size_t> parent(tracks.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        for (size_t j = i + 1; j < tracks.size(); ++j) {
+            if (FindRoot(parent, i) != FindRoot(parent, j) && TrackSimilarity(tracks[i], tracks[j]) >= config_.same_person) {
+                parent[FindRoot(parent, j)] = FindRoot(parent, i);
+            }
+        }
+    }
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        groups[FindRoot(parent, i)].push_back(i);
+    }
+    for (const auto& group : groups) {
+        VideoIdentity identity;
+        std::vector<const KeptFrame*> frames;
+        for (size_t i : group.second) {
+            ++identity.tracks;
+            identity.frames += tracks[i].frames;
+            for (const auto& kept : tracks[i].kept) {
+                frames.push_back(&kept);
+            }
+        }
+        identity.templates = ChooseTemplates(frames, fps, config_);
+        identities.push_back(std::move(identity));
+    }
+    std::stable_sort(identities.begin(), identities.end(),
+                     [](const VideoIdentity& a, const VideoIdentity& b) { return a.frames > b.frames; });
+
+    stats.wall_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (statistics != nullptr) {
+        *statistics = stats;
+    }
+    return HSUCCEED;
+}
+
+}  // namespace gallery
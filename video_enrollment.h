@@ -0,0 +1,130 @@
+#pragma once
+#ifndef GALLERY_VIDEO_ENROLLMENT_H
+#define GALLERY_VIDEO_ENROLLMENT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <inspireface/inspireface.hpp>
+#include "embedding_cache.h"
+
+namespace gallery {
+
+/**
+ * @struct VideoEnrollmentConfiguration
+ * @brief Parallelism, frame selection and quality bar of a VideoEnrollment.
+ */
+struct VideoEnrollmentConfiguration {
+    int32_t segments = 4;                ///< Parts of the file decoded and tracked in parallel, each with its own Session
+    int32_t min_segment_frames = 150;    ///< Segments are never shorter than this, so tracks have time to form
+    int32_t detect_level = 320;          ///< Detector input size of the sessions
+    int32_t max_faces = 4;               ///< Faces tracked per frame
+    int32_t frames_per_track = 8;        ///< Best frames kept per track
+    int32_t min_frame_gap = 5;           ///< Kept frames of a track are at least this many frames apart
+    int32_t min_track_frames = 5;        ///< Tracks with fewer frames passing the bar are ignored
+    int32_t templates = 5;               ///< Templates enrolled per person at most
+    float min_template_distance = 0.1f;  ///< A frame within this cosine distance of a chosen template adds nothing
+    float same_person = 0.6f;            ///< Tracks whose kept frames are this similar belong to the same person
+    int32_t min_face_side = 64;          ///< Faces smaller than this are not kept
+    float max_pose = 30.0f;              ///< Faces turned further than this in yaw or pitch, in degrees, are not kept (0: no pose bar)
+    float min_quality = 0.5f;            ///< Faces below this quality confidence, or whose quality cannot be measured, are not kept (0: no quality bar)
+};
+
+/**
+ * @struct VideoTemplate
+ * @brief One frame chosen as a template.
+ */
+struct VideoTemplate {
+    int64_t frame = 0;            ///< Frame index in the file
+    double seconds = 0.0;         ///< Position in the file
+    float quality = 0.0f;         ///< Quality confidence of the face
+    inspire::Embedded embedding;  ///< L2-normalized feature
+};
+
+/**
+ * @struct VideoIdentity
+ * @brief A person seen in a video: the tracks found to be the same face and the templates chosen from them.
+ */
+struct VideoIdentity {
+    size_t tracks = 0;                     ///< Tracks merged into this person
+    size_t frames = 0;                     ///< Frames of those tracks that passed the bar
+    std::vector<VideoTemplate> templates;  ///< Mutually diverse templates, best first
+};
+
+/**
+ * @struct VideoStatistics
+ * @brief Throughput of one VideoEnrollment::Run.
+ */
+struct VideoStatistics {
+    size_t frames = 0;       ///< Frames decoded and tracked
+    size_t tracks = 0;       ///< Tracks with enough frames passing the bar
+    size_t extractions = 0;  ///< Kept frames whose feature was extracted
+    size_t cache_hits = 0;   ///< Of which found in the embedding cache instead
+    int32_t segments = 0;
+    double wall_seconds = 0.0;
+
+    double FramesPerSecond() const {
+        return wall_seconds > 0.0 ? frames / wall_seconds : 0.0;
+    }
+};
+
+/**
+ * @class VideoEnrollment
+ * @brief Picks enrollment templates from the faces of a video file.
+ *
+ * The file is split into segments that are decoded and tracked in parallel, each by a thread
+ * with a DETECT_MODE_LIGHT_TRACK Session of its own. For every track the frames_per_track
+ * frames with the best quality and frontalness are kept, at least min_frame_gap frames apart
+ * so that they are not all the same moment; only their aligned crops are held, and features
+ * are extracted once a segment is done, for the kept frames only.
+ *
+ * Tracks are then grouped into persons: a face that crosses a segment boundary, or that the
+ * tracker loses and finds again, leaves several tracks that are merged when their kept
+ * frames are at least same_person similar. The templates of a person are chosen from all
+ * its kept frames by farthest-point selection: the best frame first, then repeatedly the one
+ * farthest from those already chosen, until templates are chosen or the next one would be
+ * within min_template_distance. The models must already be loaded through inspire::Launch.
+ */
+class VideoEnrollment {
+public:
+    explicit VideoEnrollment(const VideoEnrollmentConfiguration& config = VideoEnrollmentConfiguration());
+
+    /**
+     * @brief Creates the segment sessions.
+     * @return int32_t Status code; HERR_SESS_PIPELINE_FAILURE if a session cannot be created.
+     */
+    int32_t Initialize();
+
+    /**
+     * @brief Looks up the aligned crop of every kept frame in cache before extracting it, and stores new embeddings in it.
+     * @param cache Open cache that outlives the following runs, or nullptr to extract every kept frame.
+     */
+    void SetEmbeddingCache(EmbeddingCache* cache) {
+        cache_ = cache;
+    }
+
+    /**
+     * @brief Tracks the faces of a video file and chooses the templates of every person in it.
+     * @param path Video file.
+     * @param identities Output persons, the one seen in the most frames first.
+     * @param statistics Optional output of the run.
+     * @return int32_t Status code; HERR_INVALID_IMAGE_STREAM_PARAM if the file cannot be opened,
+     * HERR_INVALID_PARAM if Initialize has not succeeded.
+     */
+    int32_t Run(const std::string& path, std::vector<VideoIdentity>& identities, VideoStatistics* statistics = nullptr);
+
+    /**
+     * @brief Checks the extension of a file name (mp4, avi, mov, mkv, h264 or h265, any case).
+     */
+    static bool IsVideoFile(const std::string& name);
+
+private:
+    VideoEnrollmentConfiguration config_;
+    EmbeddingCache* cache_ = nullptr;
+    std::vector<std::shared_ptr<inspire::Session>> sessions_;  ///< One per segment
+};
+
+}  // namespace gallery
+
+#endif  // GALLERY_VIDEO_ENROLLMENT_H